@@ -18,10 +18,36 @@
       "dependencies" : [ "lua5.1s", "hiredis0.14.1s" ],
       "cflags!": [ "-fno-exceptions", "-std=c++11" ],
       "cflags_cc!": [ "-fno-exceptions" ],
+      "cflags_cc": [ "-std=c++17" ],
+      'xcode_settings': {
+        'CLANG_CXX_LANGUAGE_STANDARD': 'c++17',
+      },
       'sources': [
         "src/extra/CLuaArgument.cpp",
         "src/extra/CLuaArguments.cpp",
+        "src/extra/CLuaFunctionRef.cpp",
+        "src/extra/CLuaLazyReply.cpp",
+        "src/extra/CLuaReply.cpp",
         "src/CFunctions.cpp",
+        "src/CRedisBlockingWorker.cpp",
+        "src/CRedisClient.cpp",
+        "src/CRedisEventLoop.cpp",
+        "src/CRedisGeoSet.cpp",
+        "src/CRedisKeepAlive.cpp",
+        "src/CRedisLeaderboard.cpp",
+        "src/CRedisLock.cpp",
+        "src/CRedisManager.cpp",
+        "src/CRedisQueueConsumer.cpp",
+        "src/CRedisRateLimiter.cpp",
+        "src/CRedisReplyHandler.cpp",
+        "src/CRedisRequest.cpp",
+        "src/CRedisSchedulePoller.cpp",
+        "src/CRedisSchema.cpp",
+        "src/CRedisSequence.cpp",
+        "src/CRedisScript.cpp",
+        "src/CRedisStreamConsumer.cpp",
+        "src/CRedisTemplate.cpp",
+        "src/CRedisWorker.cpp",
         "src/CThread.cpp",
         "src/CThreadData.cpp",
         "src/ml_redis.cpp",
@@ -36,6 +62,7 @@
       'msvs_settings': {
         'VCCLCompilerTool': {
           'ExceptionHandling': '2',  # /EHsc
+          'AdditionalOptions': [ '/std:c++17' ],
         },
       }
     },
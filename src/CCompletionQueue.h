@@ -0,0 +1,112 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//
+// Link embedded in everything that can be pushed to a CCompletionQueue.
+// The queue never allocates, the items themselves are the nodes.
+//
+class CCompletionNode
+{
+public:
+    CCompletionNode() { pQueueNext.store(NULL, std::memory_order_relaxed); };
+
+    std::atomic<CCompletionNode*> pQueueNext;
+};
+
+/////////////////////////////////////////////////////////////////////////
+//
+// CCompletionQueue
+//
+//
+// Intrusive lock-free multi-producer/single-consumer queue (D. Vyukov).
+// Push() is wait-free and may be called from any thread, Pop() must only
+// be called by the consumer (the main thread in DoPulse).
+//
+//////////////////////////////////////////////////////////////////////
+template <class T>
+class CCompletionQueue
+{
+public:
+    CCompletionQueue()
+    {
+        m_pHead.store(&m_Stub, std::memory_order_relaxed);
+        m_pTail = &m_Stub;
+    }
+
+    //
+    // Any thread
+    //
+    void Push(T* pItem) { PushNode(pItem); }
+
+    //
+    // Consumer only. Returns NULL when empty, or when a producer is between
+    // its two steps; the item then shows up on the next call.
+    //
+    T* Pop()
+    {
+        CCompletionNode* pTail = m_pTail;
+        CCompletionNode* pNext = pTail->pQueueNext.load(std::memory_order_acquire);
+
+        if (pTail == &m_Stub)
+        {
+            if (!pNext)
+                return NULL;
+            m_pTail = pNext;
+            pTail = pNext;
+            pNext = pNext->pQueueNext.load(std::memory_order_acquire);
+        }
+
+        if (pNext)
+        {
+            m_pTail = pNext;
+            return static_cast<T*>(pTail);
+        }
+
+        if (pTail != m_pHead.load(std::memory_order_acquire))
+            return NULL;
+
+        // pTail is the last item, put the stub behind it so it can be unlinked
+        PushNode(&m_Stub);
+
+        pNext = pTail->pQueueNext.load(std::memory_order_acquire);
+        if (pNext)
+        {
+            m_pTail = pNext;
+            return static_cast<T*>(pTail);
+        }
+        return NULL;
+    }
+
+private:
+    void PushNode(CCompletionNode* pNode)
+    {
+        pNode->pQueueNext.store(NULL, std::memory_order_relaxed);
+        CCompletionNode* pPrev = m_pHead.exchange(pNode, std::memory_order_acq_rel);
+        pPrev->pQueueNext.store(pNode, std::memory_order_release);
+    }
+
+    // Producers and the consumer each get their own cache line
+    alignas(64) std::atomic<CCompletionNode*> m_pHead;
+    alignas(64) CCompletionNode*              m_pTail;
+    CCompletionNode                           m_Stub;
+};
@@ -17,8 +17,62 @@
  *********************************************************/
 
 #include "CFunctions.h"
+#include "CRedisManager.h"
+#include "CRedisQueueConsumer.h"
+#include "CRedisSchedulePoller.h"
+#include "CRedisStreamConsumer.h"
+#include "CRedisTemplate.h"
 #include "extra/CLuaArguments.h"
+#include "extra/CLuaReply.h"
 #include "extra/CScriptArgReader.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <vector>
+
+// Scratch space for commands forwarded to hiredis. Only touched on the main
+// thread and reused across calls, so it stops allocating once warmed up.
+static std::vector<const char*> commandArgv;
+static std::vector<size_t>      commandArgvLen;
+static std::string              templateBuffer;
+
+// Second result of a transaction that EXEC discarded because of WATCH
+#define TRANSACTION_ABORTED "aborted"
+#define DEFAULT_TRANSACTION_ATTEMPTS 5
+
+// Held back bytes that make an auto batching client flush before the pulse
+#define DEFAULT_AUTO_BATCH_BYTES 65536
+
+// How long a command may wait for room under the "block" limit policy
+#define DEFAULT_LIMIT_BLOCK_MS 5
+
+// Entries per XREADGROUP and how long it blocks on the server
+#define DEFAULT_STREAM_COUNT 64
+#define DEFAULT_STREAM_BLOCK 1000
+
+// Jobs handled at once and how long a job may take before it is requeued
+#define DEFAULT_QUEUE_CONCURRENCY 1
+#define DEFAULT_QUEUE_VISIBILITY  30000
+
+// Due jobs claimed per poll
+#define DEFAULT_SCHEDULE_BATCH 100
+
+// How long a lock acquisition keeps retrying and the initial retry delay
+#define DEFAULT_LOCK_WAIT  10000
+#define DEFAULT_LOCK_RETRY 50
+
+// How long a leaderboard serves its top list from memory
+#define DEFAULT_LEADERBOARD_CACHE 1000
+
+// World units a position has to move by before it is written again
+#define DEFAULT_GEO_THRESHOLD 1.0
+
+// Ids reserved per INCRBY
+#define DEFAULT_ID_BLOCK 100
 
 int CFunctions::CreateRedisClient(lua_State* luaVM)
 {
@@ -36,6 +90,7 @@ int CFunctions::CreateRedisClient(lua_State* luaVM)
           lua_pushnil(luaVM);
           lua_pushinteger(luaVM, c->err);
           lua_pushstring(luaVM, c->errstr);
+          redisFree(c);
           return 3;
         } else {
           lua_pushnil(luaVM);
@@ -45,7 +100,7 @@ int CFunctions::CreateRedisClient(lua_State* luaVM)
         }
       }
       else {
-        lua_pushlightuserdata(luaVM, c);
+        lua_pushlightuserdata(luaVM, pRedisManager->CreateClient(luaVM, c, strIp, iPort));
         return 1;
       }
     }
@@ -58,12 +113,17 @@ int CFunctions::RedisClientPing(lua_State* luaVM)
 {
     if (luaVM)
     {
-        redisContext* c = NULL;
+        CRedisClient* pClient = NULL;
         CScriptArgReader argStream(luaVM);
-        argStream.ReadUserData(c);
+        argStream.ReadUserData(pClient);
+        if (argStream.HasErrors())
+        {
+            lua_pushboolean(luaVM, 0);
+            return 1;
+        }
 
         // PING server
-        redisReply* reply = reinterpret_cast<redisReply*>(redisCommand(c,"PING"));
+        redisReply* reply = reinterpret_cast<redisReply*>(redisCommand(pClient->GetContext(),"PING"));
         printf("PING: %s\n", reply->str);
         lua_pushstring(luaVM, reply->str);
         freeReplyObject(reply);
@@ -77,16 +137,32 @@ int CFunctions::RedisClientCommand(lua_State* luaVM)
 {
     if (luaVM)
     {
-        redisContext* c = NULL;
-        std::string strCommand;
+        CRedisClient* pClient = NULL;
+        unsigned int uiTimeoutMs = 0;
+        unsigned int uiReplyFlags = 0;
         CScriptArgReader argStream(luaVM);
-        argStream.ReadUserData(c);
-        argStream.ReadString(strCommand);
-        printf("COMMAND = %s\n", strCommand.c_str());
-        redisReply* reply = reinterpret_cast<redisReply*>(redisCommand(c, "%s", strCommand.c_str()));
-        lua_pushstring(luaVM, reply->str);
-        freeReplyObject(reply);
-        return 1;
+        argStream.ReadUserData(pClient);
+        if (argStream.NextIsTable())
+        {
+            uiTimeoutMs = GetOptionNumber(luaVM, argStream.m_iIndex, "timeout", 0);
+            uiReplyFlags = ReadReplyFlags(luaVM, argStream.m_iIndex);
+            argStream.Skip(1);
+        }
+        int iArguments = ReadCommandArguments(argStream);
+        if (iArguments == 1)
+            iArguments = SplitCommandString();
+        if (argStream.HasErrors() || iArguments == 0)
+        {
+            lua_pushboolean(luaVM, 0);
+            return 1;
+        }
+
+        std::string strError;
+        redisReply* reply = pClient->Command(iArguments, commandArgv.data(), commandArgvLen.data(), uiTimeoutMs, strError);
+        int iResults = CLuaReply::PushResult(luaVM, reply, strError.c_str(), uiReplyFlags);
+        if (reply)
+            freeReplyObject(reply);
+        return iResults;
     }
     lua_pushboolean(luaVM, 0);
     return 0;
@@ -96,19 +172,22 @@ int CFunctions::RedisClientSet(lua_State* luaVM)
 {
   if (luaVM)
   {
-    redisContext* c = NULL;
-    std::string strKey;
-    std::string strValue;
+    CRedisClient* pClient = NULL;
+    std::string_view strKey;
+    std::string_view strValue;
     CScriptArgReader argStream(luaVM);
-    argStream.ReadUserData(c);
-    argStream.ReadString(strKey);
-    argStream.ReadString(strValue);
+    argStream.ReadUserData(pClient);
+    argStream.ReadStringView(strKey);
+    argStream.ReadStringView(strValue);
 
     if (!argStream.HasErrors())
     {
-      redisReply* reply = reinterpret_cast<redisReply*>(redisCommand(c, "SET %s %s", strKey.c_str(), strValue.c_str()));
-      lua_pushboolean(luaVM, 1);
-      freeReplyObject(reply);
+      const char* argv[] = {"SET", strKey.data(), strValue.data()};
+      size_t argvlen[] = {3, strKey.length(), strValue.length()};
+      redisReply* reply = reinterpret_cast<redisReply*>(redisCommandArgv(pClient->GetContext(), 3, argv, argvlen));
+      lua_pushboolean(luaVM, reply && reply->type != REDIS_REPLY_ERROR);
+      if (reply)
+        freeReplyObject(reply);
       return 1;
     }
   }
@@ -153,19 +232,24 @@ int CFunctions::RedisClientGet(lua_State* luaVM)
 {
   if (luaVM)
   {
-    redisContext* c = NULL;
-    std::string strKey;
+    CRedisClient* pClient = NULL;
+    std::string_view strKey;
     CScriptArgReader argStream(luaVM);
-    argStream.ReadUserData(c);
-    argStream.ReadString(strKey);
+    argStream.ReadUserData(pClient);
+    argStream.ReadStringView(strKey);
 
     if (!argStream.HasErrors())
     {
-      redisReply* reply = reinterpret_cast<redisReply*>(redisCommand(c, "GET %s", strKey.c_str()));
+      const char* argv[] = {"GET", strKey.data()};
+      size_t argvlen[] = {3, strKey.length()};
+      redisReply* reply = reinterpret_cast<redisReply*>(redisCommandArgv(pClient->GetContext(), 2, argv, argvlen));
+      if (!reply)
+        return 0;
+
       switch (reply->type)
       {
       case REDIS_REPLY_STRING:
-        lua_pushstring(luaVM, reply->str);
+        lua_pushlstring(luaVM, reply->str, reply->len);
         freeReplyObject(reply);
         return 1;
       case REDIS_REPLY_ARRAY:
@@ -180,10 +264,12 @@ int CFunctions::RedisClientGet(lua_State* luaVM)
         return 1;
       case REDIS_REPLY_NIL:
         lua_pushnil(luaVM);
+        freeReplyObject(reply);
         return 1;
       case REDIS_REPLY_STATUS:
       case REDIS_REPLY_ERROR:
       default:
+        freeReplyObject(reply);
         break;
       }
     }
@@ -194,13 +280,1895 @@ int CFunctions::RedisClientGet(lua_State* luaVM)
 int CFunctions::RedisClientDestroy(lua_State* luaVM) {
   if (luaVM)
   {
-    redisContext* c = NULL;
+    CRedisClient* pClient = NULL;
     CScriptArgReader argStream(luaVM);
-    argStream.ReadUserData(c);
+    argStream.ReadUserData(pClient);
     if (!argStream.HasErrors())
     {
-      redisFree(c);
+      pRedisManager->DestroyClient(pClient);
     }
   }
   return 0;
 }
+
+int CFunctions::RedisClientLaneStats(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+
+    if (!argStream.HasErrors())
+    {
+      // The maximum starts over with every call
+      static const char* szLanes[LANE_MAX] = {"interactive", "bulk"};
+      lua_newtable(luaVM);
+      for (int i = 0; i < LANE_MAX; i++)
+      {
+        const SLaneStats& stats = pClient->GetLaneStats(static_cast<eRequestLane>(i));
+        lua_newtable(luaVM);
+        lua_pushnumber(luaVM, stats.uiDepth);
+        lua_setfield(luaVM, -2, "depth");
+        lua_pushnumber(luaVM, static_cast<double>(stats.ullCompleted));
+        lua_setfield(luaVM, -2, "completed");
+        lua_pushnumber(luaVM, stats.dLatencyMs);
+        lua_setfield(luaVM, -2, "latency");
+        lua_pushnumber(luaVM, stats.dMaxLatencyMs);
+        lua_setfield(luaVM, -2, "maxLatency");
+        lua_setfield(luaVM, -2, szLanes[i]);
+        pClient->ResetMaxLatency(static_cast<eRequestLane>(i));
+      }
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisClientSetLimits(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    SRedisLimits limits;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    ReadLimits(argStream, limits, NULL);
+
+    if (!argStream.HasErrors())
+    {
+      pClient->SetLimits(limits);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisClientAutoBatch(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    bool bEnabled;
+    unsigned int uiMaxBytes;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadBool(bEnabled);
+    argStream.ReadNumber(uiMaxBytes, DEFAULT_AUTO_BATCH_BYTES);
+
+    if (!argStream.HasErrors())
+    {
+      pClient->SetAutoBatch(bEnabled ? std::max(uiMaxBytes, 1u) : 0);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisClientCommandAsync(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadFunction(pRequest->callback);
+    if (argStream.NextIsTable())
+      ReadRequestOptions(argStream, pRequest);
+    int iArguments = ReadCommandArguments(argStream);
+
+    if (!argStream.HasErrors() && iArguments > 0)
+    {
+      pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+      if (!pRequest->SetCommand(iArguments, commandArgv.data(), commandArgvLen.data()))
+      {
+        pRedisManager->ReleaseRequest(pRequest);
+        lua_pushboolean(luaVM, 0);
+        return 1;
+      }
+
+      unsigned int uiId = pRedisManager->Send(pClient, pRequest);
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+    pRedisManager->ReleaseRequest(pRequest);
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisClientCancel(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    if (!argStream.HasErrors())
+    {
+      lua_pushboolean(luaVM, pRedisManager->Cancel(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::SplitCommandString()
+{
+  // Older scripts pass the whole command as one string ("SET key value"),
+  // split it on spaces. Arguments containing spaces need the argv form.
+  std::string_view strCommand(commandArgv[0], commandArgvLen[0]);
+  commandArgv.clear();
+  commandArgvLen.clear();
+  for (size_t sizePos = strCommand.find_first_not_of(' '); sizePos != std::string_view::npos;)
+  {
+    size_t sizeEnd = std::min(strCommand.find(' ', sizePos), strCommand.length());
+    commandArgv.push_back(strCommand.data() + sizePos);
+    commandArgvLen.push_back(sizeEnd - sizePos);
+    sizePos = strCommand.find_first_not_of(' ', sizeEnd);
+  }
+  return static_cast<int>(commandArgv.size());
+}
+
+unsigned int CFunctions::GetOptionNumber(lua_State* luaVM, int iTable, const char* szField, unsigned int uiDefault)
+{
+  // Positive whole numbers only, anything else keeps the default
+  lua_getfield(luaVM, iTable, szField);
+  if (lua_isnumber(luaVM, -1) && lua_tonumber(luaVM, -1) >= 1)
+    uiDefault = static_cast<unsigned int>(lua_tonumber(luaVM, -1));
+  lua_pop(luaVM, 1);
+  return uiDefault;
+}
+
+double CFunctions::GetOptionDouble(lua_State* luaVM, int iTable, const char* szField, double dDefault)
+{
+  lua_getfield(luaVM, iTable, szField);
+  if (lua_isnumber(luaVM, -1))
+    dDefault = lua_tonumber(luaVM, -1);
+  lua_pop(luaVM, 1);
+  return dDefault;
+}
+
+void CFunctions::ReadLimits(CScriptArgReader& argStream, SRedisLimits& limits, size_t* psizeReaderBytes)
+{
+  // Every call replaces the limits, fields left out are unlimited
+  lua_State* luaVM = argStream.m_luaVM;
+  int iTable = argStream.m_iIndex;
+  if (!argStream.NextIsTable())
+  {
+    argStream.SetTypeError("table");
+    return;
+  }
+
+  limits.uiMaxInFlight = GetOptionNumber(luaVM, iTable, "inFlight", 0);
+  limits.ullMaxReplyBytes = GetOptionNumber(luaVM, iTable, "replyBytes", 0);
+  limits.ePolicy = LIMIT_REJECT;
+  limits.uiBlockMs = GetOptionNumber(luaVM, iTable, "blockMs", DEFAULT_LIMIT_BLOCK_MS);
+  if (psizeReaderBytes)
+    *psizeReaderBytes = GetOptionNumber(luaVM, iTable, "readerBytes", 0);
+
+  lua_getfield(luaVM, iTable, "policy");
+  if (lua_type(luaVM, -1) == LUA_TSTRING)
+  {
+    const char* szPolicy = lua_tostring(luaVM, -1);
+    if (strcmp(szPolicy, "reject") == 0)
+      limits.ePolicy = LIMIT_REJECT;
+    else if (strcmp(szPolicy, "dropOldestBulk") == 0)
+      limits.ePolicy = LIMIT_DROP_OLDEST_BULK;
+    else if (strcmp(szPolicy, "block") == 0)
+      limits.ePolicy = LIMIT_BLOCK;
+    else
+      argStream.SetCustomError("policy must be 'reject', 'dropOldestBulk' or 'block'");
+  }
+  lua_pop(luaVM, 1);
+
+  argStream.Skip(1);
+}
+
+unsigned int CFunctions::ReadReplyFlags(lua_State* luaVM, int iTable)
+{
+  static const std::pair<const char*, unsigned int> flags[] = {{"lazy", REPLY_LAZY}, {"numbers", REPLY_NUMBERS}, {"pairs", REPLY_PAIRS}};
+
+  unsigned int uiFlags = 0;
+  for (const auto& flag : flags)
+  {
+    lua_getfield(luaVM, iTable, flag.first);
+    if (lua_toboolean(luaVM, -1))
+      uiFlags |= flag.second;
+    lua_pop(luaVM, 1);
+  }
+  return uiFlags;
+}
+
+int CFunctions::ReadCommandArguments(CScriptArgReader& argStream)
+{
+  // Views into the lua stack, valid until the calling function returns
+  commandArgv.clear();
+  commandArgvLen.clear();
+  while (!argStream.NextIsNone())
+  {
+    std::string_view strArgument;
+    argStream.ReadStringView(strArgument);
+    commandArgv.push_back(strArgument.data());
+    commandArgvLen.push_back(strArgument.length());
+  }
+  return static_cast<int>(commandArgv.size());
+}
+
+void CFunctions::ReadRequestOptions(CScriptArgReader& argStream, CRedisRequest* pRequest)
+{
+  lua_State* luaVM = argStream.m_luaVM;
+  int iTable = argStream.m_iIndex;
+
+  lua_getfield(luaVM, iTable, "priority");
+  if (lua_type(luaVM, -1) == LUA_TSTRING)
+  {
+    const char* szPriority = lua_tostring(luaVM, -1);
+    if (strcmp(szPriority, "high") == 0)
+      pRequest->ePriority = PRIORITY_HIGH;
+    else if (strcmp(szPriority, "normal") == 0)
+      pRequest->ePriority = PRIORITY_NORMAL;
+    else if (strcmp(szPriority, "bulk") == 0)
+      pRequest->ePriority = PRIORITY_BULK;
+    else
+      argStream.SetCustomError("priority must be 'high', 'normal' or 'bulk'");
+  }
+  lua_pop(luaVM, 1);
+
+  ReadLane(argStream, iTable, pRequest->eLane);
+
+  unsigned int uiTimeoutMs = GetOptionNumber(luaVM, iTable, "timeout", 0);
+  if (uiTimeoutMs)
+    pRequest->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(uiTimeoutMs);
+  pRequest->uiReplyFlags = ReadReplyFlags(luaVM, iTable);
+
+  argStream.Skip(1);
+}
+
+void CFunctions::ReadLane(CScriptArgReader& argStream, int iTable, eRequestLane& eLane)
+{
+  lua_State* luaVM = argStream.m_luaVM;
+  lua_getfield(luaVM, iTable, "lane");
+  if (lua_type(luaVM, -1) == LUA_TSTRING)
+  {
+    const char* szLane = lua_tostring(luaVM, -1);
+    if (strcmp(szLane, "interactive") == 0)
+      eLane = LANE_INTERACTIVE;
+    else if (strcmp(szLane, "bulk") == 0)
+      eLane = LANE_BULK;
+    else
+      argStream.SetCustomError("lane must be 'interactive' or 'bulk'");
+  }
+  lua_pop(luaVM, 1);
+}
+
+int CFunctions::RedisSetLimits(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    SRedisLimits limits;
+    size_t sizeReaderBytes = 0;
+    CScriptArgReader argStream(luaVM);
+    ReadLimits(argStream, limits, &sizeReaderBytes);
+
+    if (!argStream.HasErrors())
+    {
+      pRedisManager->SetLimits(limits, sizeReaderBytes);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisSetDispatchBudget(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    double dMaxTime;
+    double dMaxMessages;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(dMaxTime, 0);
+    argStream.ReadNumber(dMaxMessages, 0);
+
+    if (!argStream.HasErrors() && dMaxTime >= 0 && dMaxTime * 1000 <= UINT_MAX && dMaxMessages >= 0 && dMaxMessages <= UINT_MAX)
+    {
+      pRedisManager->SetDispatchBudget(static_cast<unsigned int>(dMaxTime * 1000), static_cast<unsigned int>(dMaxMessages));
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGetDispatchStats(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    static const char* szPriorities[PRIORITY_MAX] = {"high", "normal", "bulk"};
+    const SDispatchStats& stats = pRedisManager->GetDispatchStats();
+
+    lua_newtable(luaVM);
+    for (int i = 0; i < PRIORITY_MAX; i++)
+    {
+      lua_newtable(luaVM);
+      lua_pushnumber(luaVM, static_cast<double>(stats.ullDispatched[i]));
+      lua_setfield(luaVM, -2, "dispatched");
+      lua_pushnumber(luaVM, static_cast<double>(stats.ullDeferred[i]));
+      lua_setfield(luaVM, -2, "deferred");
+      lua_pushnumber(luaVM, static_cast<double>(pRedisManager->GetBacklog(static_cast<eRequestPriority>(i))));
+      lua_setfield(luaVM, -2, "backlog");
+      lua_setfield(luaVM, -2, szPriorities[i]);
+    }
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullDeferredPulses));
+    lua_setfield(luaVM, -2, "deferredPulses");
+    lua_pushnumber(luaVM, static_cast<double>(stats.sizeMaxBacklog));
+    lua_setfield(luaVM, -2, "maxBacklog");
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullCoalesced));
+    lua_setfield(luaVM, -2, "coalesced");
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullTimedOut));
+    lua_setfield(luaVM, -2, "timedOut");
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullRejected));
+    lua_setfield(luaVM, -2, "rejected");
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullDropped));
+    lua_setfield(luaVM, -2, "dropped");
+    lua_pushnumber(luaVM, static_cast<double>(stats.ullBlocked));
+    lua_setfield(luaVM, -2, "blocked");
+    lua_pushnumber(luaVM, pRedisManager->GetUsage().uiInFlight);
+    lua_setfield(luaVM, -2, "inFlight");
+    lua_pushnumber(luaVM, static_cast<double>(pRedisManager->GetUsage().ullReplyBytes));
+    lua_setfield(luaVM, -2, "replyBytes");
+    return 1;
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisTransaction(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iCommands = argStream.m_iIndex;
+    argStream.Skip(1);
+    int iWatch = 0;
+    if (argStream.NextIsTable())
+      iWatch = ReadTransactionOptions(argStream, NULL);
+
+    // WATCH goes out in the same write as MULTI/EXEC here, it only guards
+    // against changes made while the transaction is on its way. Values read
+    // before must be watched with redisTransactionRetry.
+    if (!argStream.HasErrors())
+      return ExecuteTransaction(luaVM, pClient->GetContext(), iCommands, iWatch);
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisTransactionRetry(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    if (!argStream.NextIsFunction())
+      argStream.SetTypeError("function");
+    int iBuilder = argStream.m_iIndex;
+    argStream.Skip(1);
+    int iWatch = 0;
+    unsigned int uiAttempts = DEFAULT_TRANSACTION_ATTEMPTS;
+    if (argStream.NextIsTable())
+      iWatch = ReadTransactionOptions(argStream, &uiAttempts);
+
+    if (!argStream.HasErrors())
+    {
+      redisContext* c = pClient->GetContext();
+      for (unsigned int uiAttempt = 1; uiAttempt <= uiAttempts; uiAttempt++)
+      {
+        // WATCH goes out on its own so the builder reads after it
+        if (iWatch && !AppendCommandTable(luaVM, c, iWatch, "WATCH"))
+          return PushContextError(luaVM, c);
+        if (iWatch && !ReadReplies(c, 1))
+          return PushContextError(luaVM, c);
+
+        lua_pushvalue(luaVM, iBuilder);
+        lua_pushlightuserdata(luaVM, pClient);
+        lua_pushnumber(luaVM, uiAttempt);
+        bool bCalled = CLuaFunctionRef::Call(luaVM, 2, 1);
+        if (!bCalled || !lua_istable(luaVM, -1))
+        {
+          if (bCalled)
+            lua_pop(luaVM, 1);
+
+          // Builder failed or gave up, drop the watch so the connection stays clean
+          if (iWatch)
+            freeReplyObject(redisCommand(c, "UNWATCH"));
+          lua_pushboolean(luaVM, 0);
+          lua_pushstring(luaVM, "cancelled");
+          return 2;
+        }
+
+        if (!CheckTransaction(luaVM, lua_gettop(luaVM)))
+        {
+          if (iWatch)
+            freeReplyObject(redisCommand(c, "UNWATCH"));
+          return 2;
+        }
+
+        int iResults = ExecuteTransaction(luaVM, c, lua_gettop(luaVM), 0);
+        if (!IsTransactionAborted(luaVM, iResults) || uiAttempt == uiAttempts)
+          return iResults;
+        lua_pop(luaVM, iResults + 1);
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::ReadTransactionOptions(CScriptArgReader& argStream, unsigned int* puiAttempts)
+{
+  lua_State* luaVM = argStream.m_luaVM;
+  int iTable = argStream.m_iIndex;
+  int iWatch = 0;
+
+  // The watch table stays referenced by the options table, use it in place
+  lua_getfield(luaVM, iTable, "watch");
+  if (lua_istable(luaVM, -1))
+    iWatch = lua_gettop(luaVM);
+  else
+  {
+    if (!lua_isnil(luaVM, -1))
+      argStream.SetCustomError("watch must be a table of keys");
+    lua_pop(luaVM, 1);
+  }
+
+  if (puiAttempts)
+  {
+    lua_getfield(luaVM, iTable, "attempts");
+    if (lua_isnumber(luaVM, -1) && lua_tonumber(luaVM, -1) >= 1)
+      *puiAttempts = static_cast<unsigned int>(lua_tonumber(luaVM, -1));
+    lua_pop(luaVM, 1);
+  }
+
+  argStream.Skip(1);
+  return iWatch;
+}
+
+bool CFunctions::AppendCommandTable(lua_State* luaVM, redisContext* c, int iTable, const char* szPrefix)
+{
+  int iTop = lua_gettop(luaVM);
+  int iCount = static_cast<int>(lua_objlen(luaVM, iTable));
+  if (iCount == 0)
+    return false;
+
+  commandArgv.clear();
+  commandArgvLen.clear();
+  if (szPrefix)
+  {
+    commandArgv.push_back(szPrefix);
+    commandArgvLen.push_back(strlen(szPrefix));
+  }
+
+  // Elements stay on the stack until hiredis has formatted the command,
+  // numbers get converted there instead of in the table
+  lua_checkstack(luaVM, iCount);
+  for (int i = 1; i <= iCount; i++)
+  {
+    lua_rawgeti(luaVM, iTable, i);
+    size_t sizeArgument = 0;
+    const char* szArgument = lua_isstring(luaVM, -1) ? lua_tolstring(luaVM, -1, &sizeArgument) : NULL;
+    if (!szArgument)
+    {
+      lua_settop(luaVM, iTop);
+      return false;
+    }
+    commandArgv.push_back(szArgument);
+    commandArgvLen.push_back(sizeArgument);
+  }
+
+  int iResult = redisAppendCommandArgv(c, static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data());
+  lua_settop(luaVM, iTop);
+  return iResult == REDIS_OK;
+}
+
+bool CFunctions::IsCommandTable(lua_State* luaVM, int iTable)
+{
+  if (!lua_istable(luaVM, iTable))
+    return false;
+
+  int iCount = static_cast<int>(lua_objlen(luaVM, iTable));
+  bool bValid = iCount > 0;
+  for (int i = 1; i <= iCount && bValid; i++)
+  {
+    lua_rawgeti(luaVM, iTable, i);
+    bValid = lua_isstring(luaVM, -1) != 0;
+    lua_pop(luaVM, 1);
+  }
+  return bValid;
+}
+
+bool CFunctions::ReadReplies(redisContext* c, int iCount)
+{
+  // Drain everything even after a failure, the context must stay in sync
+  bool bSuccess = true;
+  for (int i = 0; i < iCount; i++)
+  {
+    void* pReply = NULL;
+    if (redisGetReply(c, &pReply) != REDIS_OK)
+      return false;
+    if (static_cast<redisReply*>(pReply)->type == REDIS_REPLY_ERROR)
+      bSuccess = false;
+    freeReplyObject(pReply);
+  }
+  return bSuccess;
+}
+
+bool CFunctions::CheckTransaction(lua_State* luaVM, int iCommands)
+{
+  // Pushes false and the error when a command is unusable
+  int iCount = static_cast<int>(lua_objlen(luaVM, iCommands));
+  if (iCount == 0)
+  {
+    lua_pushboolean(luaVM, 0);
+    lua_pushstring(luaVM, "empty transaction");
+    return false;
+  }
+
+  for (int i = 1; i <= iCount; i++)
+  {
+    lua_rawgeti(luaVM, iCommands, i);
+    bool bValid = IsCommandTable(luaVM, lua_gettop(luaVM));
+    lua_pop(luaVM, 1);
+    if (!bValid)
+    {
+      lua_pushboolean(luaVM, 0);
+      lua_pushfstring(luaVM, "bad command #%d", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+int CFunctions::ExecuteTransaction(lua_State* luaVM, redisContext* c, int iCommands, int iWatch)
+{
+  // Check the commands up front, once something is in the output buffer
+  // there is no taking it back
+  if (!CheckTransaction(luaVM, iCommands))
+    return 2;
+
+  int iCount = static_cast<int>(lua_objlen(luaVM, iCommands));
+  // Queue everything in the output buffer first, a single write flushes it
+  int iPending = 0;
+  if (iWatch)
+  {
+    if (!AppendCommandTable(luaVM, c, iWatch, "WATCH"))
+      return PushContextError(luaVM, c);
+    iPending++;
+  }
+  if (redisAppendCommand(c, "MULTI") != REDIS_OK)
+    return PushContextError(luaVM, c);
+  iPending++;
+
+  for (int i = 1; i <= iCount; i++)
+  {
+    lua_rawgeti(luaVM, iCommands, i);
+    bool bAppended = AppendCommandTable(luaVM, c, lua_gettop(luaVM), NULL);
+    lua_pop(luaVM, 1);
+    if (!bAppended)
+      return PushContextError(luaVM, c);
+    iPending++;
+  }
+  if (redisAppendCommand(c, "EXEC") != REDIS_OK)
+    return PushContextError(luaVM, c);
+
+  // WATCH, MULTI and the QUEUED acknowledgements. A command rejected while
+  // queueing makes EXEC fail with EXECABORT, which is reported below.
+  if (!ReadReplies(c, iPending) && c->err)
+    return PushContextError(luaVM, c);
+
+  void* pExecReply = NULL;
+  if (redisGetReply(c, &pExecReply) != REDIS_OK)
+    return PushContextError(luaVM, c);
+
+  redisReply* reply = static_cast<redisReply*>(pExecReply);
+  int iResults;
+  if (reply->type == REDIS_REPLY_NIL)
+  {
+    // A watched key changed, nothing was executed
+    lua_pushboolean(luaVM, 0);
+    lua_pushstring(luaVM, TRANSACTION_ABORTED);
+    iResults = 2;
+  }
+  else if (reply->type != REDIS_REPLY_ARRAY)
+  {
+    iResults = CLuaReply::PushResult(luaVM, reply->type == REDIS_REPLY_ERROR ? reply : NULL, "unexpected EXEC reply");
+  }
+  else
+  {
+    // results[i] per command, failed commands are false there and have
+    // their message in errors[i]
+    bool bErrors = false;
+    lua_createtable(luaVM, static_cast<int>(reply->elements), 0);
+    lua_newtable(luaVM);
+    for (size_t i = 0; i < reply->elements; i++)
+    {
+      redisReply* element = reply->element[i];
+      if (element->type == REDIS_REPLY_ERROR)
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_rawseti(luaVM, -3, static_cast<int>(i + 1));
+        lua_pushlstring(luaVM, element->str, element->len);
+        lua_rawseti(luaVM, -2, static_cast<int>(i + 1));
+        bErrors = true;
+      }
+      else
+      {
+        CLuaReply::Push(luaVM, element);
+        lua_rawseti(luaVM, -3, static_cast<int>(i + 1));
+      }
+    }
+    if (!bErrors)
+      lua_pop(luaVM, 1);
+    iResults = bErrors ? 2 : 1;
+  }
+  freeReplyObject(reply);
+  return iResults;
+}
+
+bool CFunctions::IsTransactionAborted(lua_State* luaVM, int iResults)
+{
+  if (iResults != 2 || !lua_isboolean(luaVM, -2) || lua_toboolean(luaVM, -2))
+    return false;
+
+  const char* szError = lua_tostring(luaVM, -1);
+  return szError && strcmp(szError, TRANSACTION_ABORTED) == 0;
+}
+
+int CFunctions::PushContextError(lua_State* luaVM, redisContext* c)
+{
+  lua_pushboolean(luaVM, 0);
+  lua_pushstring(luaVM, c->err ? c->errstr : "Can't queue redis command");
+  return 2;
+}
+
+int CFunctions::RedisStreamAdd(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strStream;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strStream);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iFields = argStream.m_iIndex;
+    argStream.Skip(1);
+
+    unsigned int uiMaxLen = 0;
+    if (argStream.NextIsTable())
+    {
+      lua_getfield(luaVM, argStream.m_iIndex, "maxlen");
+      if (lua_isnumber(luaVM, -1) && lua_tonumber(luaVM, -1) > 0)
+        uiMaxLen = static_cast<unsigned int>(lua_tonumber(luaVM, -1));
+      lua_pop(luaVM, 1);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      int iTop = lua_gettop(luaVM);
+      commandArgv.assign({"XADD", strStream.c_str(), "*"});
+      commandArgvLen.assign({4, strStream.length(), 1});
+
+      // Either {field = value} or {field, value, ...} to keep the order.
+      // Copies of keys and values stay on the stack until formatted.
+      int iCount = static_cast<int>(lua_objlen(luaVM, iFields));
+      bool bValid = true;
+      if (iCount > 0)
+      {
+        lua_checkstack(luaVM, iCount);
+        for (int i = 1; i <= iCount; i++)
+          lua_rawgeti(luaVM, iFields, i);
+        bValid = iCount % 2 == 0;
+      }
+      else
+      {
+        // key value -> key_copy value key, so lua_next still finds its key on top
+        for (lua_pushnil(luaVM); lua_next(luaVM, iFields) != 0;)
+        {
+          lua_checkstack(luaVM, 3);
+          lua_pushvalue(luaVM, -2);
+          lua_insert(luaVM, -3);
+          lua_insert(luaVM, -2);
+        }
+      }
+
+      for (int i = iTop + 1; i <= lua_gettop(luaVM) && bValid; i++)
+      {
+        size_t sizeArgument = 0;
+        const char* szArgument = lua_isstring(luaVM, i) ? lua_tolstring(luaVM, i, &sizeArgument) : NULL;
+        bValid = szArgument != NULL;
+        commandArgv.push_back(szArgument);
+        commandArgvLen.push_back(sizeArgument);
+      }
+
+      if (bValid && commandArgv.size() > 3)
+      {
+        CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+        if (pRequest->SetCommand(static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data()))
+        {
+          lua_settop(luaVM, iTop);
+          if (pRedisManager->QueueStreamEntry(pClient, pRequest, strStream, uiMaxLen))
+          {
+            lua_pushboolean(luaVM, 1);
+            return 1;
+          }
+        }
+        pRedisManager->ReleaseRequest(pRequest);
+      }
+      lua_settop(luaVM, iTop);
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisStreamConsume(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strStream;
+    std::string strGroup;
+    std::string strConsumer;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strStream);
+    argStream.ReadString(strGroup);
+    argStream.ReadString(strConsumer);
+    argStream.ReadFunction(callback);
+
+    unsigned int uiCount = DEFAULT_STREAM_COUNT;
+    unsigned int uiBlockMs = DEFAULT_STREAM_BLOCK;
+    if (argStream.NextIsTable())
+    {
+      uiCount = GetOptionNumber(luaVM, argStream.m_iIndex, "count", uiCount);
+      uiBlockMs = GetOptionNumber(luaVM, argStream.m_iIndex, "block", uiBlockMs);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      std::shared_ptr<CRedisWorker> pConsumer =
+          std::make_shared<CRedisStreamConsumer>(luaVM, pClient, std::move(callback), strStream, strGroup, strConsumer, uiCount, uiBlockMs);
+      unsigned int uiId = pRedisManager->AddWorker(pConsumer);
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+template <class T>
+int CFunctions::StopWorker(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    // Only workers of the calling resource, and of the kind the function manages
+    std::shared_ptr<CRedisWorker> pWorker = argStream.HasErrors() ? NULL : pRedisManager->GetWorker(luaVM, uiId);
+    if (pWorker && dynamic_cast<T*>(pWorker.get()))
+    {
+      lua_pushboolean(luaVM, pRedisManager->StopWorker(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisStreamStop(lua_State* luaVM)
+{
+  return StopWorker<CRedisStreamConsumer>(luaVM);
+}
+
+int CFunctions::RedisBlockingPop(lua_State* luaVM)
+{
+  // The pops of a client share one blocking connection and run one after
+  // another, a pop waits for the ones before it. The timeout has to be
+  // positive so none of them can hold the connection forever. Cancelling
+  // or timing out doesn't interrupt a pop the server is running already,
+  // an element it still returns is pushed back to the end of the list it
+  // came from. With a target the element stays in the target list.
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    double dTimeout;
+    CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    int iKeys = argStream.m_iIndex;
+    if (!argStream.NextCouldBeString() && !argStream.NextIsTable())
+      argStream.SetTypeError("string or table");
+    argStream.Skip(1);
+    argStream.ReadNumber(dTimeout);
+    argStream.ReadFunction(pRequest->callback);
+
+    // {right = true} pops from the tail, {target = key} moves the element
+    // into another list (BRPOPLPUSH)
+    bool bRight = false;
+    std::string strTarget;
+    if (argStream.NextIsTable())
+    {
+      lua_getfield(luaVM, argStream.m_iIndex, "right");
+      bRight = lua_toboolean(luaVM, -1) != 0;
+      lua_getfield(luaVM, argStream.m_iIndex, "target");
+      if (lua_isstring(luaVM, -1))
+        strTarget = lua_tostring(luaVM, -1);
+      lua_pop(luaVM, 2);
+      ReadRequestOptions(argStream, pRequest);
+    }
+
+    if (!argStream.HasErrors() && dTimeout > 0)
+    {
+      int iTop = lua_gettop(luaVM);
+      // Whole seconds, servers before 6.0 reject fractions. Rounded up so a
+      // short wait never turns into 0 = forever.
+      char szTimeout[32];
+      snprintf(szTimeout, sizeof(szTimeout), "%.0f", std::ceil(dTimeout));
+
+      commandArgv.clear();
+      commandArgvLen.clear();
+      commandArgv.push_back(!strTarget.empty() ? "BRPOPLPUSH" : bRight ? "BRPOP" : "BLPOP");
+      commandArgvLen.push_back(strlen(commandArgv.back()));
+
+      if (lua_istable(luaVM, iKeys))
+      {
+        int iCount = static_cast<int>(lua_objlen(luaVM, iKeys));
+        lua_checkstack(luaVM, iCount);
+        for (int i = 1; i <= iCount; i++)
+          lua_rawgeti(luaVM, iKeys, i);
+      }
+      else
+        lua_pushvalue(luaVM, iKeys);
+
+      bool bValid = lua_gettop(luaVM) > iTop;
+      for (int i = iTop + 1; i <= lua_gettop(luaVM) && bValid; i++)
+      {
+        size_t sizeKey = 0;
+        const char* szKey = lua_isstring(luaVM, i) ? lua_tolstring(luaVM, i, &sizeKey) : NULL;
+        bValid = szKey != NULL;
+        commandArgv.push_back(szKey);
+        commandArgvLen.push_back(sizeKey);
+      }
+
+      // BRPOPLPUSH takes exactly one source
+      if (!strTarget.empty())
+      {
+        bValid = bValid && commandArgv.size() == 2;
+        commandArgv.push_back(strTarget.c_str());
+        commandArgvLen.push_back(strTarget.length());
+      }
+      commandArgv.push_back(szTimeout);
+      commandArgvLen.push_back(strlen(szTimeout));
+
+      pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+      pRequest->eRestore = !strTarget.empty() ? RESTORE_NONE : bRight ? RESTORE_TAIL : RESTORE_HEAD;
+      bValid = bValid && pRequest->SetCommand(static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data());
+      lua_settop(luaVM, iTop);
+
+      unsigned int uiId = bValid ? pRedisManager->SendBlocking(pClient, pRequest) : 0;
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+    pRedisManager->ReleaseRequest(pRequest);
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisQueueConsume(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strQueue;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strQueue);
+    argStream.ReadFunction(callback);
+
+    unsigned int uiConcurrency = DEFAULT_QUEUE_CONCURRENCY;
+    unsigned int uiVisibilityMs = DEFAULT_QUEUE_VISIBILITY;
+    if (argStream.NextIsTable())
+    {
+      uiConcurrency = GetOptionNumber(luaVM, argStream.m_iIndex, "concurrency", uiConcurrency);
+      uiVisibilityMs = GetOptionNumber(luaVM, argStream.m_iIndex, "visibility", uiVisibilityMs);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      std::shared_ptr<CRedisWorker> pConsumer =
+          std::make_shared<CRedisQueueConsumer>(luaVM, pClient, std::move(callback), strQueue, uiConcurrency, uiVisibilityMs);
+      unsigned int uiId = pRedisManager->AddWorker(pConsumer);
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisQueueStop(lua_State* luaVM)
+{
+  return StopWorker<CRedisQueueConsumer>(luaVM);
+}
+
+int CFunctions::RedisSchedule(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strQueue;
+    double dDelayMs;
+    std::string_view strPayload;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strQueue);
+    argStream.ReadNumber(dDelayMs);
+    argStream.ReadStringView(strPayload);
+
+    if (!argStream.HasErrors() && dDelayMs >= 0)
+    {
+      // Random id in front of the payload, the same payload may be scheduled twice
+      static std::mt19937_64 random(std::random_device{}());
+      char szId[17];
+      snprintf(szId, sizeof(szId), "%016llx", static_cast<unsigned long long>(random()));
+
+      std::string strMember;
+      strMember.reserve(17 + strPayload.length());
+      strMember.append(szId, 16).append(1, ':').append(strPayload);
+
+      long long llDueMs =
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + static_cast<long long>(dDelayMs);
+      std::string strDue = std::to_string(llDueMs);
+
+      const char* argv[] = {"ZADD", strQueue.c_str(), strDue.c_str(), strMember.data()};
+      size_t argvlen[] = {4, strQueue.length(), strDue.length(), strMember.length()};
+      CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+      pRequest->pHandler = std::make_shared<CRedisScheduleNudge>(strQueue, llDueMs);
+      if (pRequest->SetCommand(4, argv, argvlen) && pRedisManager->Send(pClient, pRequest))
+      {
+        lua_pushlstring(luaVM, szId, 16);
+        return 1;
+      }
+      pRedisManager->ReleaseRequest(pRequest);
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisScheduleConsume(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strQueue;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strQueue);
+    argStream.ReadFunction(callback);
+
+    unsigned int uiBatch = DEFAULT_SCHEDULE_BATCH;
+    if (argStream.NextIsTable())
+    {
+      uiBatch = GetOptionNumber(luaVM, argStream.m_iIndex, "batch", uiBatch);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      std::shared_ptr<CRedisWorker> pPoller = std::make_shared<CRedisSchedulePoller>(luaVM, pClient, std::move(callback), strQueue, uiBatch);
+      unsigned int uiId = pRedisManager->AddWorker(pPoller);
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisScheduleStop(lua_State* luaVM)
+{
+  return StopWorker<CRedisSchedulePoller>(luaVM);
+}
+
+int CFunctions::RedisLock(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strName;
+    unsigned int uiTtlMs;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strName);
+    argStream.ReadNumber(uiTtlMs);
+    argStream.ReadFunction(callback);
+
+    unsigned int uiWaitMs = DEFAULT_LOCK_WAIT;
+    unsigned int uiRetryMs = DEFAULT_LOCK_RETRY;
+    if (argStream.NextIsTable())
+    {
+      uiWaitMs = GetOptionNumber(luaVM, argStream.m_iIndex, "wait", uiWaitMs);
+      uiRetryMs = GetOptionNumber(luaVM, argStream.m_iIndex, "retry", uiRetryMs);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors() && uiTtlMs > 0)
+    {
+      unsigned int uiId = pRedisManager->CreateLock(luaVM, pClient, strName, uiTtlMs, uiWaitMs, uiRetryMs, std::move(callback));
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisUnlock(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    if (!argStream.HasErrors())
+    {
+      lua_pushboolean(luaVM, pRedisManager->ReleaseLock(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLockHeld(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    if (!argStream.HasErrors())
+    {
+      lua_pushboolean(luaVM, pRedisManager->IsLockHeld(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisRateLimit(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strKey;
+    double dLimit;
+    double dWindowMs;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strKey);
+    argStream.ReadNumber(dLimit);
+    argStream.ReadNumber(dWindowMs);
+
+    // Read as doubles, a negative number would wrap around as unsigned
+    if (!argStream.HasErrors() && dLimit >= 1 && dLimit <= UINT_MAX && dWindowMs >= 1 && dWindowMs <= UINT_MAX)
+    {
+      unsigned int uiLimit = static_cast<unsigned int>(dLimit);
+      unsigned int uiWindowMs = static_cast<unsigned int>(dWindowMs);
+
+      // allowed, remaining, retry after (ms) - or nil and the error
+      SRateLimitResult result;
+      std::string strError;
+      if (!pClient->GetRateLimiter().Consume(pClient->GetContext(), strKey, uiLimit, uiWindowMs, result, strError))
+      {
+        lua_pushnil(luaVM);
+        lua_pushstring(luaVM, strError.c_str());
+        return 2;
+      }
+
+      lua_pushboolean(luaVM, result.bAllowed);
+      lua_pushnumber(luaVM, result.uiRemaining);
+      lua_pushnumber(luaVM, result.uiRetryAfterMs);
+      return 3;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisDefineSchema(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    std::string strName;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadString(strName);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iTable = argStream.m_iIndex;
+    argStream.Skip(1);
+
+    if (!argStream.HasErrors())
+    {
+      // Sorted by name, pairs() order differs from one table to the next
+      std::vector<std::pair<std::string, eSchemaType>> fields;
+      lua_pushnil(luaVM);
+      while (lua_next(luaVM, iTable))
+      {
+        eSchemaType eType;
+        if (lua_type(luaVM, -2) != LUA_TSTRING || lua_type(luaVM, -1) != LUA_TSTRING || !CRedisSchema::ParseType(lua_tostring(luaVM, -1), eType))
+        {
+          lua_pop(luaVM, 2);
+          argStream.SetCustomError("fields must map names to 'int', 'float', 'bool', 'string' or 'packed'");
+          break;
+        }
+        fields.emplace_back(lua_tostring(luaVM, -2), eType);
+        lua_pop(luaVM, 1);
+      }
+
+      if (!argStream.HasErrors() && !fields.empty())
+      {
+        std::sort(fields.begin(), fields.end());
+        pRedisManager->DefineSchema(luaVM, strName, std::make_shared<CRedisSchema>(std::move(fields)));
+        lua_pushboolean(luaVM, 1);
+        return 1;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLoad(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strSchema;
+    std::string_view strKey;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strSchema);
+    argStream.ReadStringView(strKey);
+    if (argStream.NextIsFunction())
+      argStream.ReadFunction(callback);
+
+    std::shared_ptr<CRedisSchema> pSchema = pRedisManager->GetSchema(luaVM, strSchema);
+    if (!argStream.HasErrors() && pSchema)
+    {
+      int argc;
+      const char** argv;
+      const size_t* argvlen;
+      pSchema->GetLoadCommand(strKey, argc, argv, argvlen);
+
+      // object (nil when the hash doesn't exist) or false and the error
+      if (!callback.IsValid())
+      {
+        std::string strError;
+        redisReply* reply = pClient->Command(argc, argv, argvlen, 0, strError);
+        int iResults = pSchema->PushResult(luaVM, reply, strError.c_str());
+        if (reply)
+          freeReplyObject(reply);
+        return iResults;
+      }
+
+      CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+      pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+      pRequest->callback = std::move(callback);
+      pRequest->pHandler = pSchema;
+      unsigned int uiId = pRequest->SetCommand(argc, argv, argvlen) ? pRedisManager->Send(pClient, pRequest) : 0;
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+      pRedisManager->ReleaseRequest(pRequest);
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisSave(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strSchema;
+    std::string_view strKey;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strSchema);
+    argStream.ReadStringView(strKey);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iObject = argStream.m_iIndex;
+    argStream.Skip(1);
+    if (argStream.NextIsFunction())
+      argStream.ReadFunction(callback);
+
+    std::shared_ptr<CRedisSchema> pSchema = pRedisManager->GetSchema(luaVM, strSchema);
+    if (!argStream.HasErrors() && pSchema)
+    {
+      CRedisSchema::SChanges changes;
+      std::string strError;
+      if (!pSchema->GetChanges(luaVM, iObject, changes, strError))
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, strError.c_str());
+        return 2;
+      }
+
+      // Removals and changes in one script, a failed save writes nothing
+      std::string strRemoved;
+      std::vector<const char*> argv;
+      std::vector<size_t> argvlen;
+      pSchema->GetSaveCommand(strKey, changes, strRemoved, argv, argvlen);
+      int argc = static_cast<int>(argv.size());
+
+      if (!callback.IsValid())
+      {
+        redisReply* reply = pClient->Command(argc, argv.data(), argvlen.data(), 0, strError);
+        if (!reply || reply->type == REDIS_REPLY_ERROR)
+        {
+          int iResults = CLuaReply::PushResult(luaVM, reply, strError.c_str());
+          if (reply)
+            freeReplyObject(reply);
+          return iResults;
+        }
+        freeReplyObject(reply);
+        pSchema->CommitChanges(luaVM, iObject, changes);
+      }
+      else
+      {
+        // The snapshot is updated when the reply confirms the write
+        size_t sizeWritten = changes.changed.size() + changes.removed.size();
+        CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+        pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+        pRequest->callback = std::move(callback);
+        if (!pRequest->SetCommand(argc, argv.data(), argvlen.data()))
+        {
+          pRedisManager->ReleaseRequest(pRequest);
+          lua_pushboolean(luaVM, 0);
+          return 1;
+        }
+        pRequest->pHandler = std::make_shared<CRedisSchemaSave>(luaVM, iObject, pSchema, std::move(changes));
+        if (!pRedisManager->Send(pClient, pRequest))
+        {
+          pRedisManager->ReleaseRequest(pRequest);
+          lua_pushboolean(luaVM, 0);
+          return 1;
+        }
+        lua_pushnumber(luaVM, static_cast<lua_Number>(sizeWritten));
+        return 1;
+      }
+
+      lua_pushnumber(luaVM, static_cast<lua_Number>(changes.changed.size() + changes.removed.size()));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisPrepare(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CScriptArgReader argStream(luaVM);
+    int iArguments = ReadCommandArguments(argStream);
+
+    if (!argStream.HasErrors() && iArguments > 0)
+    {
+      std::vector<std::string_view> arguments;
+      for (int i = 0; i < iArguments; i++)
+        arguments.emplace_back(commandArgv[i], commandArgvLen[i]);
+      CRedisTemplate::Push(luaVM, arguments);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisExecute(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    CRedisTemplate* pTemplate = CRedisTemplate::Get(luaVM, argStream.m_iIndex);
+    if (!pTemplate)
+      argStream.SetTypeError("redis template");
+    argStream.Skip(1);
+    int iFirst = argStream.m_iIndex;
+
+    if (!argStream.HasErrors() && lua_gettop(luaVM) - iFirst + 1 == static_cast<int>(pTemplate->GetPlaceholderCount()) &&
+        pTemplate->Format(luaVM, iFirst, templateBuffer))
+    {
+      std::string strError;
+      redisReply* reply = pClient->Command(templateBuffer.data(), templateBuffer.length(), 0, strError);
+      int iResults = CLuaReply::PushResult(luaVM, reply, strError.c_str());
+      if (reply)
+        freeReplyObject(reply);
+      return iResults;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisExecuteAsync(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    CRedisTemplate* pTemplate = CRedisTemplate::Get(luaVM, argStream.m_iIndex);
+    if (!pTemplate)
+      argStream.SetTypeError("redis template");
+    argStream.Skip(1);
+    argStream.ReadFunction(pRequest->callback);
+    if (argStream.NextIsTable())
+      ReadRequestOptions(argStream, pRequest);
+    int iFirst = argStream.m_iIndex;
+
+    if (!argStream.HasErrors() && lua_gettop(luaVM) - iFirst + 1 == static_cast<int>(pTemplate->GetPlaceholderCount()) &&
+        pTemplate->Format(luaVM, iFirst, templateBuffer))
+    {
+      pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+      unsigned int uiId = pRequest->SetCommand(templateBuffer.data(), templateBuffer.length()) ? pRedisManager->Send(pClient, pRequest) : 0;
+      if (uiId)
+      {
+        lua_pushnumber(luaVM, uiId);
+        return 1;
+      }
+    }
+    pRedisManager->ReleaseRequest(pRequest);
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLeaderboard(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strKey;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strKey);
+
+    unsigned int uiCacheMs = DEFAULT_LEADERBOARD_CACHE;
+    if (argStream.NextIsTable())
+    {
+      uiCacheMs = GetOptionNumber(luaVM, argStream.m_iIndex, "cache", uiCacheMs);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      lua_pushnumber(luaVM, pRedisManager->CreateLeaderboard(luaVM, pClient, strKey, uiCacheMs));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLeaderboardAdd(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    std::string_view strMember;
+    double dDelta;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    argStream.ReadStringView(strMember);
+    argStream.ReadNumber(dDelta);
+
+    CRedisLeaderboard* pLeaderboard = pRedisManager->GetLeaderboard(luaVM, uiId);
+    if (!argStream.HasErrors() && pLeaderboard)
+    {
+      // Sent with the next pulse, summed up with other increments until then
+      pLeaderboard->Add(strMember, dDelta);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLeaderboardTop(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    unsigned int uiCount;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    argStream.ReadNumber(uiCount);
+
+    CRedisLeaderboard* pLeaderboard = pRedisManager->GetLeaderboard(luaVM, uiId);
+    if (!argStream.HasErrors() && pLeaderboard && uiCount > 0)
+    {
+      // {{member, score}, ...} highest first, or false and the error
+      std::string strError;
+      const CRedisLeaderboard::Entries* pEntries = pLeaderboard->GetTop(uiCount, strError);
+      if (!pEntries)
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, strError.c_str());
+        return 2;
+      }
+
+      // The cache may hold more than asked for
+      int iCount = static_cast<int>(std::min<size_t>(uiCount, pEntries->size()));
+      lua_createtable(luaVM, iCount, 0);
+      for (int i = 0; i < iCount; i++)
+      {
+        const auto& entry = (*pEntries)[i];
+        lua_createtable(luaVM, 2, 0);
+        lua_pushlstring(luaVM, entry.first.c_str(), entry.first.length());
+        lua_rawseti(luaVM, -2, 1);
+        lua_pushnumber(luaVM, entry.second);
+        lua_rawseti(luaVM, -2, 2);
+        lua_rawseti(luaVM, -2, i + 1);
+      }
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLeaderboardRanks(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iTable = argStream.m_iIndex;
+    argStream.Skip(1);
+
+    CRedisLeaderboard* pLeaderboard = pRedisManager->GetLeaderboard(luaVM, uiId);
+    if (!argStream.HasErrors() && pLeaderboard)
+    {
+      // Views into the table argument, it stays on the stack until we return
+      std::vector<std::string_view> members;
+      int iCount = static_cast<int>(lua_objlen(luaVM, iTable));
+      members.reserve(iCount);
+      for (int i = 1; i <= iCount; i++)
+      {
+        lua_rawgeti(luaVM, iTable, i);
+        size_t sizeMember;
+        const char* szMember = lua_type(luaVM, -1) == LUA_TSTRING ? lua_tolstring(luaVM, -1, &sizeMember) : NULL;
+        lua_pop(luaVM, 1);
+        if (!szMember)
+          break;
+        members.emplace_back(szMember, sizeMember);
+      }
+
+      // member -> rank starting at 1, unranked members are left out
+      std::vector<long long> ranks;
+      std::string strError;
+      if (members.size() == static_cast<size_t>(iCount) && pLeaderboard->GetRanks(members, ranks, strError))
+      {
+        lua_createtable(luaVM, 0, iCount);
+        for (size_t i = 0; i < members.size(); i++)
+        {
+          if (!ranks[i])
+            continue;
+          lua_pushlstring(luaVM, members[i].data(), members[i].length());
+          lua_pushnumber(luaVM, static_cast<lua_Number>(ranks[i]));
+          lua_rawset(luaVM, -3);
+        }
+        return 1;
+      }
+
+      if (!strError.empty())
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, strError.c_str());
+        return 2;
+      }
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisLeaderboardDestroy(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    if (!argStream.HasErrors())
+    {
+      // Increments still held back are sent first
+      lua_pushboolean(luaVM, pRedisManager->DestroyLeaderboard(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGeo(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strKey;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strKey);
+
+    // One world unit is a metre around 0, 0 unless told otherwise
+    SGeoTransform transform = {1 / CRedisGeoSet::METRES_PER_DEGREE, 0, 0};
+    double dThreshold = DEFAULT_GEO_THRESHOLD;
+    if (argStream.NextIsTable())
+    {
+      transform.dScale = GetOptionDouble(luaVM, argStream.m_iIndex, "scale", transform.dScale);
+      transform.dOriginLon = GetOptionDouble(luaVM, argStream.m_iIndex, "lon", transform.dOriginLon);
+      transform.dOriginLat = GetOptionDouble(luaVM, argStream.m_iIndex, "lat", transform.dOriginLat);
+      dThreshold = GetOptionDouble(luaVM, argStream.m_iIndex, "threshold", dThreshold);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors() && transform.dScale > 0 && dThreshold >= 0)
+    {
+      lua_pushnumber(luaVM, pRedisManager->CreateGeoSet(luaVM, pClient, strKey, transform, dThreshold));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGeoUpdate(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    if (!argStream.NextIsTable())
+      argStream.SetTypeError("table");
+    int iTable = argStream.m_iIndex;
+    argStream.Skip(1);
+
+    std::shared_ptr<CRedisGeoSet> pGeoSet = pRedisManager->GetGeoSet(luaVM, uiId);
+    if (!argStream.HasErrors() && pGeoSet)
+    {
+      // {id = {x, y}, ...}, written with the next pulse. Nothing is taken
+      // when a position is outside what the server can store.
+      std::vector<std::pair<std::string, CRedisGeoSet::SPosition>> positions;
+      lua_pushnil(luaVM);
+      while (lua_next(luaVM, iTable))
+      {
+        int iType = lua_type(luaVM, -2);
+        if ((iType == LUA_TSTRING || iType == LUA_TNUMBER) && lua_istable(luaVM, -1))
+        {
+          lua_rawgeti(luaVM, -1, 1);
+          lua_rawgeti(luaVM, -2, 2);
+          if (lua_isnumber(luaVM, -2) && lua_isnumber(luaVM, -1))
+          {
+            // tolstring would turn a number key into a string under lua_next
+            lua_pushvalue(luaVM, -4);
+            size_t sizeId;
+            const char* szId = lua_tolstring(luaVM, -1, &sizeId);
+            positions.emplace_back(std::string(szId, sizeId), CRedisGeoSet::SPosition{lua_tonumber(luaVM, -3), lua_tonumber(luaVM, -2)});
+            lua_pop(luaVM, 1);
+            if (!pGeoSet->IsValidPosition(positions.back().second.dX, positions.back().second.dY))
+            {
+              lua_pop(luaVM, 4);
+              lua_pushboolean(luaVM, 0);
+              lua_pushstring(luaVM, ("Position of '" + positions.back().first + "' is out of the longitude/latitude range").c_str());
+              return 2;
+            }
+          }
+          lua_pop(luaVM, 2);
+        }
+        lua_pop(luaVM, 1);
+      }
+
+      for (const auto& position : positions)
+        pGeoSet->Update(position.first, position.second.dX, position.second.dY);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGeoRemove(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    std::string_view strMember;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    argStream.ReadStringView(strMember);
+
+    std::shared_ptr<CRedisGeoSet> pGeoSet = pRedisManager->GetGeoSet(luaVM, uiId);
+    if (!argStream.HasErrors() && pGeoSet)
+    {
+      pGeoSet->Remove(strMember);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGeoNear(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    double dX, dY, dRadius;
+    unsigned int uiCount = 0;
+    CLuaFunctionRef callback;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+    argStream.ReadNumber(dX);
+    argStream.ReadNumber(dY);
+    argStream.ReadNumber(dRadius);
+    if (argStream.NextIsNumber())
+      argStream.ReadNumber(uiCount);
+    if (argStream.NextIsFunction())
+      argStream.ReadFunction(callback);
+
+    // Interactive unless told otherwise. {lane = "bulk"} queues the search
+    // behind the flushed updates, so it sees them at the cost of waiting on
+    // bulk traffic.
+    eRequestLane eLane = LANE_INTERACTIVE;
+    if (argStream.NextIsTable())
+    {
+      ReadLane(argStream, argStream.m_iIndex, eLane);
+      argStream.Skip(1);
+    }
+
+    std::shared_ptr<CRedisGeoSet> pGeoSet = pRedisManager->GetGeoSet(luaVM, uiId);
+    if (!argStream.HasErrors() && pGeoSet && dRadius > 0)
+    {
+      if (!pGeoSet->IsValidPosition(dX, dY))
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, "Position is out of the longitude/latitude range");
+        return 2;
+      }
+
+      // {{id =, x =, y =, distance =}, ...} nearest first, or false and the error
+      if (!callback.IsValid())
+      {
+        std::string strError;
+        redisReply* reply = pGeoSet->Near(dX, dY, dRadius, uiCount, strError);
+        int iResults = pGeoSet->PushResult(luaVM, reply, strError.c_str());
+        if (reply)
+          freeReplyObject(reply);
+        return iResults;
+      }
+
+      // Held back updates go out first
+      pGeoSet->Flush();
+
+      CRedisGeoSet::SNearCommand command;
+      pGeoSet->PrepareNear(dX, dY, dRadius, uiCount, command);
+
+      CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+      pRequest->luaVM = CLuaFunctionRef::GetMainState(luaVM);
+      pRequest->callback = std::move(callback);
+      pRequest->pHandler = pGeoSet;
+      pRequest->eLane = eLane;
+      unsigned int uiRequestId = pRequest->SetCommand(command.argc, command.argv, command.argvlen) ? pRedisManager->Send(pGeoSet->GetClient(), pRequest) : 0;
+      if (uiRequestId)
+      {
+        lua_pushnumber(luaVM, uiRequestId);
+        return 1;
+      }
+      pRedisManager->ReleaseRequest(pRequest);
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisGeoDestroy(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    unsigned int uiId;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadNumber(uiId);
+
+    if (!argStream.HasErrors())
+    {
+      // Updates still held back are sent first
+      lua_pushboolean(luaVM, pRedisManager->DestroyGeoSet(luaVM, uiId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisNextId(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strSequence;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strSequence);
+
+    unsigned int uiBlockSize = DEFAULT_ID_BLOCK;
+    if (argStream.NextIsTable())
+    {
+      uiBlockSize = GetOptionNumber(luaVM, argStream.m_iIndex, "block", uiBlockSize);
+      argStream.Skip(1);
+    }
+
+    if (!argStream.HasErrors())
+    {
+      // id, or false and the error - only blocks when the reserved ids ran out
+      long long llId;
+      std::string strError;
+      if (!pRedisManager->GetSequence(pClient, strSequence)->Next(uiBlockSize, llId, strError))
+      {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, strError.c_str());
+        return 2;
+      }
+
+      lua_pushnumber(luaVM, static_cast<lua_Number>(llId));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisKeepAlive(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strKey;
+    unsigned int uiTtlMs;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strKey);
+    argStream.ReadNumber(uiTtlMs);
+
+    if (!argStream.HasErrors() && uiTtlMs > 0)
+    {
+      // Refreshed until stopped or the client goes away, the first PEXPIRE may take up to a third of the ttl
+      pRedisManager->GetKeepAlive().Add(pClient, strKey, uiTtlMs);
+      lua_pushboolean(luaVM, 1);
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
+
+int CFunctions::RedisKeepAliveStop(lua_State* luaVM)
+{
+  if (luaVM)
+  {
+    CRedisClient* pClient = NULL;
+    std::string strKey;
+    CScriptArgReader argStream(luaVM);
+    argStream.ReadUserData(pClient);
+    argStream.ReadString(strKey);
+
+    if (!argStream.HasErrors())
+    {
+      lua_pushboolean(luaVM, pRedisManager->GetKeepAlive().Remove(pClient, strKey));
+      return 1;
+    }
+  }
+  lua_pushboolean(luaVM, 0);
+  return 1;
+}
@@ -24,18 +24,83 @@ class CFunctions;
 
 #include "include/ILuaModuleManager.h"
 #include "hiredis.h"
+#include "CRedisRequest.h"
+
+class CRedisRequest;
+struct SRedisLimits;
+class CScriptArgReader;
 
 extern ILuaModuleManager10* pModuleManager;
 
 class CFunctions
 {
 private:
-    static int PopulateTableWithReply(lua_State* luaVM, redisReply* reply);
+    static int          PopulateTableWithReply(lua_State* luaVM, redisReply* reply);
+    static unsigned int GetOptionNumber(lua_State* luaVM, int iTable, const char* szField, unsigned int uiDefault);
+    static double       GetOptionDouble(lua_State* luaVM, int iTable, const char* szField, double dDefault);
+    static unsigned int ReadReplyFlags(lua_State* luaVM, int iTable);
+    static int          ReadCommandArguments(CScriptArgReader& argStream);
+    static int          SplitCommandString();
+    static void         ReadLimits(CScriptArgReader& argStream, SRedisLimits& limits, size_t* psizeReaderBytes);
+    static void         ReadRequestOptions(CScriptArgReader& argStream, CRedisRequest* pRequest);
+    static void         ReadLane(CScriptArgReader& argStream, int iTable, eRequestLane& eLane);
+    static int          ReadTransactionOptions(CScriptArgReader& argStream, unsigned int* puiAttempts);
+    static bool         AppendCommandTable(lua_State* luaVM, redisContext* c, int iTable, const char* szPrefix);
+    static bool         IsCommandTable(lua_State* luaVM, int iTable);
+    static bool         ReadReplies(redisContext* c, int iCount);
+    static bool         CheckTransaction(lua_State* luaVM, int iCommands);
+    static int          ExecuteTransaction(lua_State* luaVM, redisContext* c, int iCommands, int iWatch);
+    template <class T>
+    static int StopWorker(lua_State* luaVM);
+    static bool         IsTransactionAborted(lua_State* luaVM, int iResults);
+    static int          PushContextError(lua_State* luaVM, redisContext* c);
 public:
     static int CreateRedisClient(lua_State* luaVM);
     static int RedisClientPing(lua_State* luaVM);
     static int RedisClientCommand(lua_State* luaVM);
+    static int RedisClientCommandAsync(lua_State* luaVM);
+    static int RedisClientCancel(lua_State* luaVM);
     static int RedisClientSet(lua_State* luaVM);
     static int RedisClientGet(lua_State* luaVM);
     static int RedisClientDestroy(lua_State* luaVM);
+    static int RedisClientLaneStats(lua_State* luaVM);
+    static int RedisClientSetLimits(lua_State* luaVM);
+    static int RedisClientAutoBatch(lua_State* luaVM);
+    static int RedisSetLimits(lua_State* luaVM);
+    static int RedisSetDispatchBudget(lua_State* luaVM);
+    static int RedisGetDispatchStats(lua_State* luaVM);
+    static int RedisTransaction(lua_State* luaVM);
+    static int RedisTransactionRetry(lua_State* luaVM);
+    static int RedisStreamAdd(lua_State* luaVM);
+    static int RedisStreamConsume(lua_State* luaVM);
+    static int RedisStreamStop(lua_State* luaVM);
+    static int RedisBlockingPop(lua_State* luaVM);
+    static int RedisQueueConsume(lua_State* luaVM);
+    static int RedisQueueStop(lua_State* luaVM);
+    static int RedisSchedule(lua_State* luaVM);
+    static int RedisScheduleConsume(lua_State* luaVM);
+    static int RedisScheduleStop(lua_State* luaVM);
+    static int RedisLock(lua_State* luaVM);
+    static int RedisUnlock(lua_State* luaVM);
+    static int RedisLockHeld(lua_State* luaVM);
+    static int RedisRateLimit(lua_State* luaVM);
+    static int RedisDefineSchema(lua_State* luaVM);
+    static int RedisLoad(lua_State* luaVM);
+    static int RedisSave(lua_State* luaVM);
+    static int RedisPrepare(lua_State* luaVM);
+    static int RedisExecute(lua_State* luaVM);
+    static int RedisExecuteAsync(lua_State* luaVM);
+    static int RedisLeaderboard(lua_State* luaVM);
+    static int RedisLeaderboardAdd(lua_State* luaVM);
+    static int RedisLeaderboardTop(lua_State* luaVM);
+    static int RedisLeaderboardRanks(lua_State* luaVM);
+    static int RedisLeaderboardDestroy(lua_State* luaVM);
+    static int RedisGeo(lua_State* luaVM);
+    static int RedisGeoUpdate(lua_State* luaVM);
+    static int RedisGeoRemove(lua_State* luaVM);
+    static int RedisGeoNear(lua_State* luaVM);
+    static int RedisGeoDestroy(lua_State* luaVM);
+    static int RedisNextId(lua_State* luaVM);
+    static int RedisKeepAlive(lua_State* luaVM);
+    static int RedisKeepAliveStop(lua_State* luaVM);
 };
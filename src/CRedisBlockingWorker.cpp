@@ -0,0 +1,83 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisBlockingWorker.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+CRedisBlockingWorker::CRedisBlockingWorker(lua_State* luaVM, CRedisClient* pOwner) : CRedisWorker(luaVM, pOwner, CLuaFunctionRef())
+{
+}
+
+void CRedisBlockingWorker::Queue(CRedisRequest* pRequest)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Requests.push_back(pRequest);
+    m_Condition.notify_all();
+}
+
+size_t CRedisBlockingWorker::GetQueueSize()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Requests.size();
+}
+
+bool CRedisBlockingWorker::Work(redisContext* c)
+{
+    CRedisRequest* pRequest;
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Condition.wait(lock, [this]() { return !m_Requests.empty() || IsStopping(); });
+        if (IsStopping())
+            return false;
+
+        pRequest = m_Requests.front();
+    }
+
+    void* reply = NULL;
+    if (redisAppendFormattedCommand(c, pRequest->szCommand, pRequest->iCommandLength) != REDIS_OK || redisGetReply(c, &reply) != REDIS_OK)
+    {
+        // Stopped or the connection broke. The command may have run on the
+        // server already, a pop can't be retried blindly.
+        pRequest->SetError(c->errstr[0] ? c->errstr : "Connection lost");
+    }
+    else
+        pRequest->pReply = static_cast<redisReply*>(reply);
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Requests.pop_front();
+    }
+
+    // The main thread owns the request once completed, it may be back in the pool already
+    bool bConnected = pRequest->pReply != NULL;
+    pRedisManager->Complete(pRequest);
+    return bConnected;
+}
+
+void CRedisBlockingWorker::OnFinished()
+{
+    // Hand back what never ran, the main thread cleans up cancelled ones
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (CRedisRequest* pRequest : m_Requests)
+    {
+        pRequest->SetError("Blocking worker stopped");
+        pRedisManager->Complete(pRequest);
+    }
+    m_Requests.clear();
+}
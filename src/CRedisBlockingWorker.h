@@ -0,0 +1,48 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisBlockingWorker;
+
+#pragma once
+
+#include <deque>
+
+#include "CRedisWorker.h"
+
+//
+// Runs the blocking commands of one client (BLPOP, BRPOPLPUSH, ...) one
+// after another on its own connection. The queued requests are ordinary
+// tracked requests, they complete and get cancelled like async ones.
+//
+class CRedisBlockingWorker : public CRedisWorker
+{
+public:
+    CRedisBlockingWorker(lua_State* luaVM, CRedisClient* pOwner);
+
+    // Main thread
+    void   Queue(CRedisRequest* pRequest);
+    void   Dispatch(CRedisRequest*) {};
+    size_t GetQueueSize();
+
+protected:
+    bool Work(redisContext* c);
+    void OnFinished();
+
+private:
+    std::deque<CRedisRequest*> m_Requests;            // guarded by m_Mutex
+};
@@ -0,0 +1,452 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <errno.h>
+#include <sys/time.h>
+
+// Weight of the newest sample in the lane latency average
+#define LANE_LATENCY_SMOOTHING 0.1
+
+// Connect timeout (s) when the sync context has to be replaced
+#define SYNC_CONNECT_TIMEOUT 2
+
+// Wait (ms) after a failed reconnect of the sync context, doubled per failure
+#define SYNC_RECONNECT_BACKOFF_MS     500
+#define SYNC_RECONNECT_BACKOFF_MAX_MS 10000
+
+CRedisClient::CRedisClient(lua_State* luaVM, redisContext* pContext, const std::string& strHost, int iPort)
+{
+    m_luaVM = CLuaFunctionRef::GetMainState(luaVM);
+    m_pContext = pContext;
+    m_strHost = strHost;
+    m_iPort = iPort;
+    m_bAsync = false;
+    m_uiCommandEpoch = 0;
+    m_bReconnect = false;
+    m_uiReconnectBackoffMs = SYNC_RECONNECT_BACKOFF_MS;
+    for (redisAsyncContext*& ac : m_pAsyncContexts)
+        ac = NULL;
+    m_bClosed = false;
+    m_uiAutoBatchBytes = 0;
+    m_sizePendingBytes = 0;
+    memset(m_LaneStats, 0, sizeof(m_LaneStats));
+    memset(&m_Limits, 0, sizeof(m_Limits));
+    memset(&m_Usage, 0, sizeof(m_Usage));
+}
+
+CRedisClient::~CRedisClient()
+{
+    if (m_pContext)
+        redisFree(m_pContext);
+}
+
+void CRedisClient::Send(CRedisRequest* pRequest)
+{
+    pRequest->sentAt = std::chrono::steady_clock::now();
+    m_LaneStats[pRequest->eLane].uiDepth++;
+
+    if (m_uiAutoBatchBytes)
+    {
+        m_PendingBatch.push_back(pRequest);
+        m_sizePendingBytes += pRequest->iCommandLength;
+        if (m_sizePendingBytes >= m_uiAutoBatchBytes)
+            Flush();
+        return;
+    }
+
+    Post([this, pRequest]() { Submit(pRequest); });
+}
+
+void CRedisClient::SendBatch(std::vector<CRedisRequest*>&& requests)
+{
+    auto now = std::chrono::steady_clock::now();
+    for (CRedisRequest* pRequest : requests)
+    {
+        pRequest->sentAt = now;
+        m_LaneStats[pRequest->eLane].uiDepth++;
+    }
+
+    if (m_uiAutoBatchBytes)
+    {
+        for (CRedisRequest* pRequest : requests)
+        {
+            m_PendingBatch.push_back(pRequest);
+            m_sizePendingBytes += pRequest->iCommandLength;
+        }
+        if (m_sizePendingBytes >= m_uiAutoBatchBytes)
+            Flush();
+        return;
+    }
+
+    PostBatch(std::move(requests));
+}
+
+void CRedisClient::SetAutoBatch(unsigned int uiMaxBytes)
+{
+    m_uiAutoBatchBytes = uiMaxBytes;
+    if (!uiMaxBytes)
+        Flush();
+}
+
+void CRedisClient::Flush()
+{
+    if (m_PendingBatch.empty())
+        return;
+
+    std::vector<CRedisRequest*> requests;
+    requests.swap(m_PendingBatch);
+    m_sizePendingBytes = 0;
+    PostBatch(std::move(requests));
+}
+
+bool CRedisClient::Unqueue(CRedisRequest* pRequest)
+{
+    auto iter = std::find(m_PendingBatch.begin(), m_PendingBatch.end(), pRequest);
+    if (iter == m_PendingBatch.end())
+        return false;
+
+    m_PendingBatch.erase(iter);
+    m_sizePendingBytes -= pRequest->iCommandLength;
+    m_LaneStats[pRequest->eLane].uiDepth--;
+    return true;
+}
+
+void CRedisClient::PostBatch(std::vector<CRedisRequest*>&& requests)
+{
+    // One hand-over for the lot, hiredis writes them out together and the
+    // replies come back in order on the one connection
+    Post([this, requests = std::move(requests)]() {
+        for (CRedisRequest* pRequest : requests)
+            Submit(pRequest);
+    });
+}
+
+redisContext* CRedisClient::GetContext()
+{
+    NoteCommand();
+    if (m_bReconnect)
+        Reconnect();
+    return m_pContext;
+}
+
+redisReply* CRedisClient::Command(int argc, const char** argv, const size_t* argvlen, unsigned int uiTimeoutMs, std::string& strError)
+{
+    if (!GetContext())
+    {
+        strError = "Client is closed";
+        return NULL;
+    }
+
+    if (m_bReconnect)
+    {
+        strError = "Can't reconnect to redis server";
+        return NULL;
+    }
+
+    if (redisAppendCommandArgv(m_pContext, argc, argv, argvlen) != REDIS_OK)
+    {
+        strError = m_pContext->errstr;
+        return NULL;
+    }
+
+    redisReply* reply = ReadReply(uiTimeoutMs, strError);
+    RememberSession(argc, argv, argvlen, reply);
+    return reply;
+}
+
+redisReply* CRedisClient::Command(const char* szCommand, size_t sizeCommand, unsigned int uiTimeoutMs, std::string& strError)
+{
+    if (!GetContext())
+    {
+        strError = "Client is closed";
+        return NULL;
+    }
+
+    if (m_bReconnect)
+    {
+        strError = "Can't reconnect to redis server";
+        return NULL;
+    }
+
+    if (redisAppendFormattedCommand(m_pContext, szCommand, sizeCommand) != REDIS_OK)
+    {
+        strError = m_pContext->errstr;
+        return NULL;
+    }
+    return ReadReply(uiTimeoutMs, strError);
+}
+
+redisReply* CRedisClient::ReadReply(unsigned int uiTimeoutMs, std::string& strError)
+{
+    if (uiTimeoutMs)
+    {
+        timeval timeout = {static_cast<time_t>(uiTimeoutMs / 1000), static_cast<suseconds_t>((uiTimeoutMs % 1000) * 1000)};
+        redisSetTimeout(m_pContext, timeout);
+    }
+
+    // Writes the appended command first
+    void* reply = NULL;
+    if (redisGetReply(m_pContext, &reply) != REDIS_OK)
+    {
+        bool bTimedOut = uiTimeoutMs && m_pContext->err == REDIS_ERR_IO && (errno == EAGAIN || errno == EWOULDBLOCK);
+        strError = bTimedOut ? "Timeout" : m_pContext->errstr;
+        reply = NULL;
+
+        // The reply may still arrive and would be taken for the next one,
+        // the connection can't be used anymore
+        if (bTimedOut)
+        {
+            m_bReconnect = true;
+            Reconnect();
+            return NULL;
+        }
+    }
+
+    if (uiTimeoutMs)
+    {
+        timeval none = {0, 0};
+        redisSetTimeout(m_pContext, none);
+    }
+    return static_cast<redisReply*>(reply);
+}
+
+void CRedisClient::RememberSession(int argc, const char** argv, const size_t* argvlen, const redisReply* reply)
+{
+    if (argc < 1 || !reply || reply->type == REDIS_REPLY_ERROR)
+        return;
+
+    std::string strName(argv[0], argvlen ? argvlen[0] : strlen(argv[0]));
+    std::transform(strName.begin(), strName.end(), strName.begin(), ::toupper);
+    if (strName != "AUTH" && strName != "SELECT")
+        return;
+
+    char* szCommand = NULL;
+    int   iLength = redisFormatCommandArgv(&szCommand, argc, argv, argvlen);
+    if (iLength > 0)
+        m_SessionCommands[strName].assign(szCommand, iLength);
+    redisFreeCommand(szCommand);
+}
+
+bool CRedisClient::Reconnect()
+{
+    // Blocks the main thread, so a server that is down gets one attempt per
+    // backoff period and sync commands fail fast in between
+    if (std::chrono::steady_clock::now() < m_NextReconnect)
+        return false;
+
+    redisContext* c = ConnectSync();
+    if (!c)
+    {
+        m_NextReconnect = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_uiReconnectBackoffMs);
+        m_uiReconnectBackoffMs = std::min(m_uiReconnectBackoffMs * 2, static_cast<unsigned int>(SYNC_RECONNECT_BACKOFF_MAX_MS));
+        return false;
+    }
+
+    redisFree(m_pContext);
+    m_pContext = c;
+    m_bReconnect = false;
+    m_uiReconnectBackoffMs = SYNC_RECONNECT_BACKOFF_MS;
+    return true;
+}
+
+redisContext* CRedisClient::ConnectSync()
+{
+    // Never blocks longer than SYNC_CONNECT_TIMEOUT per step, the old
+    // context stays until a new one is ready
+    timeval       timeout = {SYNC_CONNECT_TIMEOUT, 0};
+    redisContext* c = redisConnectWithTimeout(m_strHost.c_str(), m_iPort, timeout);
+    if (!c || c->err)
+    {
+        if (c)
+            redisFree(c);
+        return NULL;
+    }
+
+    // AUTH before SELECT, the map is sorted
+    redisSetTimeout(c, timeout);
+    for (const auto& pair : m_SessionCommands)
+    {
+        void* reply = NULL;
+        if (redisAppendFormattedCommand(c, pair.second.data(), pair.second.length()) != REDIS_OK || redisGetReply(c, &reply) != REDIS_OK ||
+            static_cast<redisReply*>(reply)->type == REDIS_REPLY_ERROR)
+        {
+            if (reply)
+                freeReplyObject(reply);
+            redisFree(c);
+            return NULL;
+        }
+        freeReplyObject(reply);
+    }
+
+    timeval none = {0, 0};
+    redisSetTimeout(c, none);
+    return c;
+}
+
+void CRedisClient::Post(std::function<void()> task)
+{
+    std::shared_ptr<CRedisClient> pSelf = shared_from_this();
+    m_bAsync = true;
+    pRedisManager->GetEventLoop()->Post([pSelf, task = std::move(task)]() { task(); });
+}
+
+void CRedisClient::OnCompleted(const CRedisRequest* pRequest)
+{
+    if (pRequest->sentAt == std::chrono::steady_clock::time_point())
+        return;
+
+    SLaneStats& stats = m_LaneStats[pRequest->eLane];
+    double      dLatencyMs = pRequest->uiLatencyUs / 1000.0;
+    stats.uiDepth--;
+    stats.dLatencyMs = stats.ullCompleted++ ? stats.dLatencyMs + (dLatencyMs - stats.dLatencyMs) * LANE_LATENCY_SMOOTHING : dLatencyMs;
+    stats.dMaxLatencyMs = std::max(stats.dMaxLatencyMs, dLatencyMs);
+}
+
+redisAsyncContext* CRedisClient::GetAsyncContext(eRequestLane eLane)
+{
+    if (!m_pAsyncContexts[eLane] && !m_bClosed)
+        Connect(eLane);
+    return m_pAsyncContexts[eLane];
+}
+
+void CRedisClient::Close()
+{
+    // The blocking context belongs to the main thread, the async one has to
+    // be torn down on the loop. Requests still in flight are answered
+    // before it closes, held back commands go out first.
+    Flush();
+    if (m_pContext)
+    {
+        redisFree(m_pContext);
+        m_pContext = NULL;
+    }
+
+    if (m_bAsync)
+    {
+        std::shared_ptr<CRedisClient> pSelf = shared_from_this();
+        pRedisManager->GetEventLoop()->Post([pSelf]() { pSelf->Disconnect(); });
+    }
+}
+
+void CRedisClient::Submit(CRedisRequest* pRequest)
+{
+    redisAsyncContext* ac = GetAsyncContext(pRequest->eLane);
+    if (!ac)
+    {
+        pRequest->SetError("Can't connect to redis server");
+        pRedisManager->Complete(pRequest);
+        return;
+    }
+
+    if (redisAsyncFormattedCommand(ac, &CRedisClient::OnReply, pRequest, pRequest->szCommand, pRequest->iCommandLength) != REDIS_OK)
+    {
+        pRequest->SetError(ac->errstr[0] ? ac->errstr : "Can't queue redis command");
+        pRedisManager->Complete(pRequest);
+    }
+}
+
+bool CRedisClient::Connect(eRequestLane eLane)
+{
+    redisAsyncContext* ac = redisAsyncConnect(m_strHost.c_str(), m_iPort);
+    if (!ac)
+        return false;
+
+    if (ac->err)
+    {
+        redisAsyncFree(ac);
+        return false;
+    }
+
+    ac->data = this;
+    redisAsyncSetConnectCallback(ac, &CRedisClient::OnConnect);
+    redisAsyncSetDisconnectCallback(ac, &CRedisClient::OnDisconnect);
+
+    if (!pRedisManager->GetEventLoop()->Attach(ac))
+    {
+        redisAsyncFree(ac);
+        return false;
+    }
+
+    m_pAsyncContexts[eLane] = ac;
+    return true;
+}
+
+void CRedisClient::Disconnect()
+{
+    m_bClosed = true;
+    for (redisAsyncContext*& ac : m_pAsyncContexts)
+    {
+        // Commands already queued are still written and answered, the
+        // context goes away after the last reply. We may be gone by then.
+        if (ac)
+        {
+            ac->data = NULL;
+            redisAsyncDisconnect(ac);
+            ac = NULL;
+        }
+    }
+}
+
+void CRedisClient::OnConnect(const redisAsyncContext* ac, int iStatus)
+{
+    // hiredis frees the context itself after a failed connect
+    if (iStatus != REDIS_OK)
+    {
+        CRedisClient* pClient = static_cast<CRedisClient*>(ac->data);
+        if (pClient)
+            pClient->Forget(ac);
+    }
+}
+
+void CRedisClient::OnDisconnect(const redisAsyncContext* ac, int /*iStatus*/)
+{
+    // Connect again lazily with the next command
+    CRedisClient* pClient = static_cast<CRedisClient*>(ac->data);
+    if (pClient)
+        pClient->Forget(ac);
+}
+
+void CRedisClient::Forget(const redisAsyncContext* ac)
+{
+    for (redisAsyncContext*& lane : m_pAsyncContexts)
+    {
+        if (lane == ac)
+            lane = NULL;
+    }
+}
+
+void CRedisClient::OnReply(redisAsyncContext* ac, void* reply, void* privdata)
+{
+    CRedisRequest* pRequest = static_cast<CRedisRequest*>(privdata);
+    pRequest->uiLatencyUs = static_cast<unsigned int>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pRequest->sentAt).count());
+
+    if (reply)
+        pRequest->SetReply(static_cast<redisReply*>(reply));
+    else
+        pRequest->SetError(ac->errstr[0] ? ac->errstr : "Connection lost");
+
+    pRedisManager->Complete(pRequest);
+}
@@ -0,0 +1,161 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisClient;
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "CRedisRateLimiter.h"
+#include "CRedisRequest.h"
+#include "hiredis.h"
+#include "async.h"
+
+// Traffic of one lane, main thread view
+struct SLaneStats
+{
+    unsigned int       uiDepth;              // sent and not answered yet
+    unsigned long long ullCompleted;
+    double             dLatencyMs;           // moving average, sent to answered
+    double             dMaxLatencyMs;        // since the last ResetMaxLatency()
+};
+
+enum eLimitPolicy
+{
+    LIMIT_REJECT,                   // refuse the new command
+    LIMIT_DROP_OLDEST_BULK,         // give up the oldest bulk request to make room
+    LIMIT_BLOCK,                    // wait a little (50ms at most) for replies, then refuse; refuses right away over the reply bytes
+};
+
+// Admission limits for async commands, 0 = unlimited
+struct SRedisLimits
+{
+    unsigned int       uiMaxInFlight;
+    unsigned long long ullMaxReplyBytes;            // answered, waiting to be dispatched
+    eLimitPolicy       ePolicy;
+    unsigned int       uiBlockMs;
+};
+
+struct SRedisUsage
+{
+    unsigned int       uiInFlight;
+    unsigned long long ullReplyBytes;
+};
+
+//
+// Script side redis client. Owns the blocking context used by the sync
+// functions and, once the first async command is sent, async contexts
+// driven by the module event loop. Every lane has a connection of its
+// own, so bulk traffic never queues in front of interactive requests.
+//
+class CRedisClient : public std::enable_shared_from_this<CRedisClient>
+{
+public:
+    CRedisClient(lua_State* luaVM, redisContext* pContext, const std::string& strHost, int iPort);
+    ~CRedisClient();
+
+    lua_State*         GetLuaVM() const { return m_luaVM; };
+    redisContext*      GetContext();            // for a sync command, see NoteCommand()
+    const std::string& GetHost() const { return m_strHost; };
+    int                GetPort() const { return m_iPort; };
+    CRedisRateLimiter& GetRateLimiter() { return m_RateLimiter; };
+
+    // Main thread. With auto batching on, commands are held back until
+    // Flush() or until uiMaxBytes are waiting, then go out as one batch.
+    void Send(CRedisRequest* pRequest);
+    void SendBatch(std::vector<CRedisRequest*>&& requests);
+    void SetAutoBatch(unsigned int uiMaxBytes);            // 0 = off
+    void Flush();
+    bool Unqueue(CRedisRequest* pRequest);            // takes back a request auto batching still holds
+
+    // Main thread. Blocking command on the sync context that gives up after
+    // uiTimeoutMs (0 = wait forever). NULL with strError set on failure.
+    redisReply* Command(int argc, const char** argv, const size_t* argvlen, unsigned int uiTimeoutMs, std::string& strError);
+    redisReply* Command(const char* szCommand, size_t sizeCommand, unsigned int uiTimeoutMs, std::string& strError);            // RESP encoded
+    void Post(std::function<void()> task);            // runs on the I/O thread, keeps us alive until then
+    void Close();
+
+    // Main thread
+    const SLaneStats& GetLaneStats(eRequestLane eLane) const { return m_LaneStats[eLane]; };
+    void              ResetMaxLatency(eRequestLane eLane) { m_LaneStats[eLane].dMaxLatencyMs = 0; };
+    void              OnCompleted(const CRedisRequest* pRequest);
+
+    const SRedisLimits& GetLimits() const { return m_Limits; };
+    void                SetLimits(const SRedisLimits& limits) { m_Limits = limits; };
+    SRedisUsage&        GetUsage() { return m_Usage; };
+
+    // Any thread. Commands that don't go through CRedisManager::Send (sync
+    // context, locks) count here, so reads already in flight on the async
+    // connection aren't reused for reads sent after them.
+    void         NoteCommand() { m_uiCommandEpoch++; };
+    unsigned int GetCommandEpoch() const { return m_uiCommandEpoch; };
+
+    // I/O thread. Connects lazily, NULL once closed or when the server can't be reached.
+    redisAsyncContext* GetAsyncContext(eRequestLane eLane = LANE_INTERACTIVE);
+
+private:
+    void          PostBatch(std::vector<CRedisRequest*>&& requests);
+    redisReply*   ReadReply(unsigned int uiTimeoutMs, std::string& strError);
+    void          RememberSession(int argc, const char** argv, const size_t* argvlen, const redisReply* reply);
+    bool          Reconnect();
+    redisContext* ConnectSync();            // sync context with the session restored, NULL on failure
+
+    // I/O thread
+    void Submit(CRedisRequest* pRequest);
+    bool Connect(eRequestLane eLane);
+    void Disconnect();
+    void Forget(const redisAsyncContext* ac);
+
+    static void OnConnect(const redisAsyncContext* ac, int iStatus);
+    static void OnDisconnect(const redisAsyncContext* ac, int iStatus);
+    static void OnReply(redisAsyncContext* ac, void* reply, void* privdata);
+
+    lua_State*    m_luaVM;
+    redisContext* m_pContext;
+    std::string   m_strHost;
+    int           m_iPort;
+    bool          m_bAsync;
+
+    std::atomic<unsigned int> m_uiCommandEpoch;
+
+    // Sync context. AUTH and SELECT that went through it, sent again after a
+    // reconnect; m_bReconnect once a timed out reply may still be on the way.
+    std::map<std::string, std::string>    m_SessionCommands;
+    bool                                  m_bReconnect;
+    std::chrono::steady_clock::time_point m_NextReconnect;            // no attempt before
+    unsigned int                          m_uiReconnectBackoffMs;
+
+    CRedisRateLimiter           m_RateLimiter;              // main thread only
+    unsigned int                m_uiAutoBatchBytes;         // main thread only
+    std::vector<CRedisRequest*> m_PendingBatch;             // main thread only
+    size_t                      m_sizePendingBytes;         // main thread only
+    SLaneStats                  m_LaneStats[LANE_MAX];      // main thread only
+    SRedisLimits                m_Limits;                   // main thread only
+    SRedisUsage                 m_Usage;                    // main thread only, kept by CRedisManager
+
+    redisAsyncContext* m_pAsyncContexts[LANE_MAX];            // I/O thread only
+    bool               m_bClosed;                             // I/O thread only
+};
@@ -0,0 +1,417 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisEventLoop.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+    #include <sys/epoll.h>
+#else
+    #include <poll.h>
+#endif
+
+#define MAX_EVENTS_PER_WAIT 128
+
+CRedisEventLoop::CRedisEventLoop()
+{
+    m_hLoopThread = 0;
+    m_iPollFd = -1;
+    m_WakePipe[0] = -1;
+    m_WakePipe[1] = -1;
+    m_bWakePending = false;
+    m_bRunning = false;
+    m_ullTimerSequence = 0;
+    m_sizeReaderLimit = 0;
+}
+
+CRedisEventLoop::~CRedisEventLoop()
+{
+    Shutdown();
+}
+
+bool CRedisEventLoop::Startup()
+{
+    if (m_bRunning)
+        return true;
+
+    if (pipe(m_WakePipe) != 0)
+        return false;
+
+    for (int fd : m_WakePipe)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    #ifdef __linux__
+    m_iPollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_iPollFd == -1)
+    {
+        Shutdown();
+        return false;
+    }
+
+    // The wake pipe is the only registration without a watch attached
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(m_iPollFd, EPOLL_CTL_ADD, m_WakePipe[0], &event);
+    #endif
+
+    m_ThreadData.bAbortThread = false;
+    m_bRunning = true;
+    if (!Start(&m_ThreadData))
+    {
+        m_bRunning = false;
+        Shutdown();
+        return false;
+    }
+    return true;
+}
+
+void CRedisEventLoop::Shutdown()
+{
+    if (m_bRunning)
+    {
+        Stop();
+        Wake();
+        Join();
+        m_bRunning = false;
+    }
+
+    for (int& fd : m_WakePipe)
+    {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+
+    if (m_iPollFd != -1)
+    {
+        close(m_iPollFd);
+        m_iPollFd = -1;
+    }
+}
+
+void CRedisEventLoop::Post(std::function<void()> task)
+{
+    Lock(&m_ThreadData.MutexLogical);
+    m_PostedTasks.push_back(std::move(task));
+    Unlock(&m_ThreadData.MutexLogical);
+
+    Wake();
+}
+
+bool CRedisEventLoop::IsLoopThread() const
+{
+    return m_bRunning && pthread_equal(pthread_self(), m_hLoopThread);
+}
+
+bool CRedisEventLoop::Attach(redisAsyncContext* ac)
+{
+    if (ac->ev.data != NULL)
+        return false;
+
+    SWatch* pWatch = new SWatch;
+    pWatch->pLoop = this;
+    pWatch->ac = ac;
+    pWatch->iFd = ac->c.fd;
+    pWatch->bReading = false;
+    pWatch->bWriting = false;
+    pWatch->bRegistered = false;
+    m_Watches.push_back(pWatch);
+
+    ac->ev.addRead = &CRedisEventLoop::AddRead;
+    ac->ev.delRead = &CRedisEventLoop::DelRead;
+    ac->ev.addWrite = &CRedisEventLoop::AddWrite;
+    ac->ev.delWrite = &CRedisEventLoop::DelWrite;
+    ac->ev.cleanup = &CRedisEventLoop::Cleanup;
+    ac->ev.data = pWatch;
+    return true;
+}
+
+void CRedisEventLoop::Schedule(unsigned int uiDelayMs, std::function<void()> task)
+{
+    STimer timer;
+    timer.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(uiDelayMs);
+    timer.ullSequence = m_ullTimerSequence++;
+    timer.task = std::move(task);
+
+    m_Timers.push_back(std::move(timer));
+    std::push_heap(m_Timers.begin(), m_Timers.end(), std::greater<STimer>());
+}
+
+int CRedisEventLoop::Execute(CThreadData* pData)
+{
+    m_hLoopThread = pthread_self();
+
+    while (!pData->bAbortThread)
+    {
+        Wait(GetTimerTimeout());
+        RunPostedTasks();
+        RunTimers();
+        CollectGarbage();
+    }
+
+    // Tear down whatever is still connected, pending callbacks get a NULL reply.
+    // Timers that haven't fired are dropped.
+    RunPostedTasks();
+    m_Timers.clear();
+    while (!m_Watches.empty())
+        redisAsyncFree(m_Watches.back()->ac);
+    CollectGarbage();
+
+    return 0;
+}
+
+void CRedisEventLoop::AddRead(void* privdata)
+{
+    SWatch* pWatch = static_cast<SWatch*>(privdata);
+    if (!pWatch->bReading)
+    {
+        pWatch->bReading = true;
+        pWatch->pLoop->UpdateWatch(pWatch);
+    }
+}
+
+void CRedisEventLoop::DelRead(void* privdata)
+{
+    SWatch* pWatch = static_cast<SWatch*>(privdata);
+    if (pWatch->bReading)
+    {
+        pWatch->bReading = false;
+        pWatch->pLoop->UpdateWatch(pWatch);
+    }
+}
+
+void CRedisEventLoop::AddWrite(void* privdata)
+{
+    SWatch* pWatch = static_cast<SWatch*>(privdata);
+    if (!pWatch->bWriting)
+    {
+        pWatch->bWriting = true;
+        pWatch->pLoop->UpdateWatch(pWatch);
+    }
+}
+
+void CRedisEventLoop::DelWrite(void* privdata)
+{
+    SWatch* pWatch = static_cast<SWatch*>(privdata);
+    if (pWatch->bWriting)
+    {
+        pWatch->bWriting = false;
+        pWatch->pLoop->UpdateWatch(pWatch);
+    }
+}
+
+void CRedisEventLoop::Cleanup(void* privdata)
+{
+    // Called by hiredis right before the context goes away. The watch may
+    // still be referenced by events of the current batch, so only free it
+    // once the batch has been handled.
+    SWatch*          pWatch = static_cast<SWatch*>(privdata);
+    CRedisEventLoop* pLoop = pWatch->pLoop;
+
+    pWatch->bReading = false;
+    pWatch->bWriting = false;
+    pLoop->UpdateWatch(pWatch);
+    pWatch->ac->ev.data = NULL;
+    pWatch->ac = NULL;
+
+    pLoop->m_Watches.erase(std::remove(pLoop->m_Watches.begin(), pLoop->m_Watches.end(), pWatch), pLoop->m_Watches.end());
+    pLoop->m_Garbage.push_back(pWatch);
+}
+
+void CRedisEventLoop::UpdateWatch(SWatch* pWatch)
+{
+    #ifdef __linux__
+    epoll_event event = {};
+    event.events = (pWatch->bReading ? (uint32_t)EPOLLIN : 0) | (pWatch->bWriting ? (uint32_t)EPOLLOUT : 0);
+    event.data.ptr = pWatch;
+
+    if (event.events == 0)
+    {
+        if (pWatch->bRegistered)
+            epoll_ctl(m_iPollFd, EPOLL_CTL_DEL, pWatch->iFd, &event);
+        pWatch->bRegistered = false;
+    }
+    else if (!pWatch->bRegistered)
+    {
+        epoll_ctl(m_iPollFd, EPOLL_CTL_ADD, pWatch->iFd, &event);
+        pWatch->bRegistered = true;
+    }
+    else
+    {
+        epoll_ctl(m_iPollFd, EPOLL_CTL_MOD, pWatch->iFd, &event);
+    }
+    #else
+    // poll() rebuilds its set from m_Watches on every wait
+    pWatch->bRegistered = pWatch->bReading || pWatch->bWriting;
+    #endif
+}
+
+int CRedisEventLoop::Wait(int iTimeoutMs)
+{
+    #ifdef __linux__
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+    int         iCount = epoll_wait(m_iPollFd, events, MAX_EVENTS_PER_WAIT, iTimeoutMs);
+    if (iCount < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < iCount; i++)
+    {
+        SWatch*  pWatch = static_cast<SWatch*>(events[i].data.ptr);
+        uint32_t uiEvents = events[i].events;
+
+        if (pWatch == NULL)
+        {
+            char buffer[64];
+            while (read(m_WakePipe[0], buffer, sizeof(buffer)) > 0)
+                ;
+            m_bWakePending = false;
+            continue;
+        }
+
+        // An earlier event of this batch may have freed the context
+        if (pWatch->ac && pWatch->bReading && (uiEvents & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            HandleRead(pWatch);
+        if (pWatch->ac && pWatch->bWriting && (uiEvents & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            redisAsyncHandleWrite(pWatch->ac);
+    }
+    return iCount;
+    #else
+    std::vector<pollfd>  fds;
+    std::vector<SWatch*> watches;
+    fds.push_back({m_WakePipe[0], POLLIN, 0});
+    watches.push_back(NULL);
+    for (SWatch* pWatch : m_Watches)
+    {
+        if (!pWatch->bRegistered)
+            continue;
+        short sEvents = (pWatch->bReading ? POLLIN : 0) | (pWatch->bWriting ? POLLOUT : 0);
+        fds.push_back({pWatch->iFd, sEvents, 0});
+        watches.push_back(pWatch);
+    }
+
+    int iCount = poll(fds.data(), fds.size(), iTimeoutMs);
+    if (iCount < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+        SWatch* pWatch = watches[i];
+        short   sEvents = fds[i].revents;
+        if (sEvents == 0)
+            continue;
+
+        if (pWatch == NULL)
+        {
+            char buffer[64];
+            while (read(m_WakePipe[0], buffer, sizeof(buffer)) > 0)
+                ;
+            m_bWakePending = false;
+            continue;
+        }
+
+        if (pWatch->ac && pWatch->bReading && (sEvents & (POLLIN | POLLERR | POLLHUP)))
+            HandleRead(pWatch);
+        if (pWatch->ac && pWatch->bWriting && (sEvents & (POLLOUT | POLLERR | POLLHUP)))
+            redisAsyncHandleWrite(pWatch->ac);
+    }
+    return iCount;
+    #endif
+}
+
+void CRedisEventLoop::HandleRead(SWatch* pWatch)
+{
+    redisAsyncHandleRead(pWatch->ac);
+
+    // hiredis buffers a reply until it is complete. One growing past the
+    // limit takes the connection with it, its commands fail with the error.
+    size_t sizeLimit = m_sizeReaderLimit;
+    if (!pWatch->ac || !sizeLimit)
+        return;
+
+    redisContext* c = &pWatch->ac->c;
+    if (c->reader->len - c->reader->pos <= sizeLimit)
+        return;
+
+    c->err = REDIS_ERR_OTHER;
+    snprintf(c->errstr, sizeof(c->errstr), "Reply exceeds reader limit of %zu bytes", sizeLimit);
+    pWatch->ac->err = c->err;
+    redisAsyncFree(pWatch->ac);
+}
+
+void CRedisEventLoop::Wake()
+{
+    // One byte in the pipe is enough no matter how many tasks are waiting
+    if (m_WakePipe[1] != -1 && !m_bWakePending.exchange(true))
+    {
+        char cByte = 1;
+        if (write(m_WakePipe[1], &cByte, 1) != 1)
+            m_bWakePending = false;
+    }
+}
+
+void CRedisEventLoop::RunPostedTasks()
+{
+    Lock(&m_ThreadData.MutexLogical);
+    m_RunningTasks.swap(m_PostedTasks);
+    Unlock(&m_ThreadData.MutexLogical);
+
+    for (auto& task : m_RunningTasks)
+        task();
+    m_RunningTasks.clear();
+}
+
+int CRedisEventLoop::GetTimerTimeout() const
+{
+    if (m_Timers.empty())
+        return -1;
+
+    // Round up, waking a millisecond early would just spin
+    auto remaining = m_Timers.front().deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero())
+        return 0;
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+}
+
+void CRedisEventLoop::RunTimers()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    while (!m_Timers.empty() && m_Timers.front().deadline <= now)
+    {
+        std::pop_heap(m_Timers.begin(), m_Timers.end(), std::greater<STimer>());
+        std::function<void()> task = std::move(m_Timers.back().task);
+        m_Timers.pop_back();
+        task();
+    }
+}
+
+void CRedisEventLoop::CollectGarbage()
+{
+    for (SWatch* pWatch : m_Garbage)
+        delete pWatch;
+    m_Garbage.clear();
+}
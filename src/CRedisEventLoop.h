@@ -0,0 +1,115 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisEventLoop;
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "CThread.h"
+#include "CThreadData.h"
+#include "hiredis.h"
+#include "async.h"
+
+//
+// I/O thread multiplexing every hiredis async context of the module
+// with epoll (poll() on other POSIX systems).
+//
+// redisAsyncContext is not thread safe, so anything touching one has to run
+// on this thread. The main thread hands work over with Post().
+//
+class CRedisEventLoop : public CThread
+{
+public:
+    CRedisEventLoop();
+    ~CRedisEventLoop();
+
+    bool Startup();
+    void Shutdown();
+
+    void Post(std::function<void()> task);
+    bool IsLoopThread() const;
+
+    // Largest unparsed reply a connection may buffer, 0 = unlimited
+    void SetReaderLimit(size_t sizeLimit) { m_sizeReaderLimit = sizeLimit; };
+
+    // I/O thread only
+    bool Attach(redisAsyncContext* ac);
+    void Schedule(unsigned int uiDelayMs, std::function<void()> task);
+
+protected:
+    int Execute(CThreadData* pData);
+
+private:
+    // Adapter state stored in redisAsyncContext::ev.data
+    struct SWatch
+    {
+        CRedisEventLoop*   pLoop;
+        redisAsyncContext* ac;
+        int                iFd;
+        bool               bReading;
+        bool               bWriting;
+        bool               bRegistered;
+    };
+
+    struct STimer
+    {
+        std::chrono::steady_clock::time_point deadline;
+        unsigned long long                    ullSequence;            // keeps equal deadlines in order
+        std::function<void()>                 task;
+
+        bool operator>(const STimer& other) const
+        {
+            return deadline != other.deadline ? deadline > other.deadline : ullSequence > other.ullSequence;
+        }
+    };
+
+    static void AddRead(void* privdata);
+    static void DelRead(void* privdata);
+    static void AddWrite(void* privdata);
+    static void DelWrite(void* privdata);
+    static void Cleanup(void* privdata);
+
+    void UpdateWatch(SWatch* pWatch);
+    void HandleRead(SWatch* pWatch);
+    int  Wait(int iTimeoutMs);
+    void Wake();
+    void RunPostedTasks();
+    int  GetTimerTimeout() const;
+    void RunTimers();
+    void CollectGarbage();
+
+    CThreadData         m_ThreadData;
+    ThreadHandle        m_hLoopThread;
+    int                 m_iPollFd;
+    int                 m_WakePipe[2];
+    std::atomic<bool>   m_bWakePending;
+    std::atomic<bool>   m_bRunning;
+    std::atomic<size_t> m_sizeReaderLimit;
+
+    std::vector<std::function<void()>> m_PostedTasks;            // guarded by m_ThreadData.MutexLogical
+    std::vector<std::function<void()>> m_RunningTasks;           // I/O thread only
+    std::vector<SWatch*>               m_Watches;                // I/O thread only
+    std::vector<SWatch*>               m_Garbage;                // I/O thread only
+    std::vector<STimer>                m_Timers;                 // I/O thread only, min heap
+    unsigned long long                 m_ullTimerSequence;       // I/O thread only
+};
@@ -0,0 +1,328 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisGeoSet.h"
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+#include "extra/CLuaReply.h"
+
+#include <charconv>
+#include <cmath>
+
+// Largest coordinates GEOADD accepts, latitudes stop short of the poles
+#define GEO_MAX_LONGITUDE 180.0
+#define GEO_MAX_LATITUDE  85.05112878
+
+static std::string FormatNumber(double dValue)
+{
+    char szBuffer[32];
+    auto result = std::to_chars(szBuffer, szBuffer + sizeof(szBuffer), dValue);
+    return std::string(szBuffer, result.ptr);
+}
+
+static void GetArgv(const std::vector<std::string>& args, std::vector<const char*>& argv, std::vector<size_t>& argvlen)
+{
+    argv.clear();
+    argvlen.clear();
+    for (const std::string& strArg : args)
+    {
+        argv.push_back(strArg.c_str());
+        argvlen.push_back(strArg.length());
+    }
+}
+
+CRedisGeoSet::CRedisGeoSet(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey, const SGeoTransform& transform,
+                           double dThreshold)
+    : m_pClient(pClient), m_strKey(strKey), m_Transform(transform), m_dThreshold(dThreshold)
+{
+    m_uiId = 0;
+    m_luaVM = CLuaFunctionRef::GetMainState(luaVM);
+}
+
+bool CRedisGeoSet::IsValidPosition(double dX, double dY) const
+{
+    double dLon = m_Transform.dOriginLon + dX * m_Transform.dScale;
+    double dLat = m_Transform.dOriginLat + dY * m_Transform.dScale;
+    return std::fabs(dLon) <= GEO_MAX_LONGITUDE && std::fabs(dLat) <= GEO_MAX_LATITUDE;
+}
+
+void CRedisGeoSet::Update(std::string_view strId, double dX, double dY)
+{
+    std::string strKey(strId);
+    m_Removed.erase(strKey);
+
+    // Compared to what the server has, small moves never add up to a write
+    auto iter = m_Written.find(strKey);
+    if (iter != m_Written.end())
+    {
+        double dDeltaX = dX - iter->second.dX;
+        double dDeltaY = dY - iter->second.dY;
+        if (dDeltaX * dDeltaX + dDeltaY * dDeltaY < m_dThreshold * m_dThreshold)
+        {
+            m_Pending.erase(strKey);
+            return;
+        }
+    }
+    m_Pending[std::move(strKey)] = {dX, dY};
+}
+
+void CRedisGeoSet::Remove(std::string_view strId)
+{
+    std::string strKey(strId);
+    m_Pending.erase(strKey);
+    m_Written.erase(strKey);
+    m_Sent.erase(strKey);
+    m_Removed.insert(std::move(strKey));
+}
+
+void CRedisGeoSet::TakePending(std::vector<std::string>& add, std::vector<std::string>& remove, Positions& positions)
+{
+    if (!m_Pending.empty())
+    {
+        add.reserve(2 + m_Pending.size() * 3);
+        add.push_back("GEOADD");
+        add.push_back(m_strKey);
+        for (const auto& pending : m_Pending)
+        {
+            add.push_back(FormatNumber(m_Transform.dOriginLon + pending.second.dX * m_Transform.dScale));
+            add.push_back(FormatNumber(m_Transform.dOriginLat + pending.second.dY * m_Transform.dScale));
+            add.push_back(pending.first);
+            m_Sent[pending.first] = pending.second;
+            positions.emplace_back(pending.first, pending.second);
+        }
+        m_Pending.clear();
+    }
+
+    if (!m_Removed.empty())
+    {
+        remove.reserve(2 + m_Removed.size());
+        remove.push_back("ZREM");
+        remove.push_back(m_strKey);
+        remove.insert(remove.end(), m_Removed.begin(), m_Removed.end());
+        m_Removed.clear();
+    }
+}
+
+void CRedisGeoSet::Flush()
+{
+    std::vector<std::string> add, remove;
+    Positions                positions;
+    TakePending(add, remove, positions);
+
+    // Nobody waits on these, they trail everything interactive
+    std::vector<CRedisRequest*> requests;
+    std::vector<const char*>    argv;
+    std::vector<size_t>         argvlen;
+    for (const std::vector<std::string>* pArgs : {&add, &remove})
+    {
+        if (pArgs->empty())
+            continue;
+
+        GetArgv(*pArgs, argv, argvlen);
+        CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+        pRequest->ePriority = PRIORITY_BULK;
+        pRequest->eLane = LANE_BULK;
+        if (pRequest->SetCommand(static_cast<int>(argv.size()), argv.data(), argvlen.data()))
+        {
+            if (pArgs == &add)
+                pRequest->pHandler = std::make_shared<CRedisGeoWrite>(shared_from_this(), std::move(positions));
+            requests.push_back(pRequest);
+        }
+        else
+        {
+            if (pArgs == &add)
+                CommitWritten(positions, false);
+            pRedisManager->ReleaseRequest(pRequest);
+        }
+    }
+
+    pRedisManager->SendBatch(m_pClient.get(), std::move(requests));
+}
+
+void CRedisGeoSet::CommitWritten(const Positions& positions, bool bWritten)
+{
+    // A failed write leaves the last acknowledged position, the next update retries
+    for (const auto& position : positions)
+    {
+        // Removed or sent again since, the newer write decides
+        auto iter = m_Sent.find(position.first);
+        if (iter == m_Sent.end() || iter->second.dX != position.second.dX || iter->second.dY != position.second.dY)
+            continue;
+
+        if (bWritten)
+            m_Written[position.first] = position.second;
+        m_Sent.erase(iter);
+    }
+}
+
+void CRedisGeoSet::PrepareNear(double dX, double dY, double dRadius, unsigned int uiCount, SNearCommand& command) const
+{
+    command.strLon = FormatNumber(m_Transform.dOriginLon + dX * m_Transform.dScale);
+    command.strLat = FormatNumber(m_Transform.dOriginLat + dY * m_Transform.dScale);
+    command.strRadius = FormatNumber(dRadius * m_Transform.dScale * METRES_PER_DEGREE);
+    command.strCount = std::to_string(uiCount);
+
+    int i = 0;
+    auto Add = [&](const char* szArg, size_t sizeArg) {
+        command.argv[i] = szArg;
+        command.argvlen[i++] = sizeArg;
+    };
+    Add("GEOSEARCH", 9);
+    Add(m_strKey.c_str(), m_strKey.length());
+    Add("FROMLONLAT", 10);
+    Add(command.strLon.c_str(), command.strLon.length());
+    Add(command.strLat.c_str(), command.strLat.length());
+    Add("BYRADIUS", 8);
+    Add(command.strRadius.c_str(), command.strRadius.length());
+    Add("m", 1);
+    Add("ASC", 3);
+    if (uiCount)
+    {
+        Add("COUNT", 5);
+        Add(command.strCount.c_str(), command.strCount.length());
+    }
+    Add("WITHCOORD", 9);
+    Add("WITHDIST", 8);
+    command.argc = i;
+}
+
+redisReply* CRedisGeoSet::Near(double dX, double dY, double dRadius, unsigned int uiCount, std::string& strError)
+{
+    redisContext* c = m_pClient->GetContext();
+    if (!c)
+    {
+        strError = "Client is closed";
+        return NULL;
+    }
+
+    std::vector<std::string> add, remove;
+    std::vector<const char*> argv;
+    std::vector<size_t>      argvlen;
+    Positions                positions;
+    int                      iPending = 0;
+    int                      iAdd = -1;
+    TakePending(add, remove, positions);
+    for (const std::vector<std::string>* pArgs : {&add, &remove})
+    {
+        if (pArgs->empty())
+            continue;
+
+        GetArgv(*pArgs, argv, argvlen);
+        if (redisAppendCommandArgv(c, static_cast<int>(argv.size()), argv.data(), argvlen.data()) == REDIS_OK)
+        {
+            if (pArgs == &add)
+                iAdd = iPending;
+            iPending++;
+        }
+    }
+
+    SNearCommand command;
+    PrepareNear(dX, dY, dRadius, uiCount, command);
+    bool bSearch = redisAppendCommandArgv(c, command.argc, command.argv, command.argvlen) == REDIS_OK;
+    if (!bSearch)
+        strError = c->errstr;
+
+    // Updates are reported like a flush would, their replies are read even
+    // when the search didn't go out. The search reply is the last one.
+    redisReply* pResult = NULL;
+    bool        bWritten = false;
+    for (int i = 0; i < iPending + (bSearch ? 1 : 0); i++)
+    {
+        void* reply = NULL;
+        if (redisGetReply(c, &reply) != REDIS_OK)
+        {
+            strError = c->errstr;
+            break;
+        }
+        if (i == iPending)
+        {
+            pResult = static_cast<redisReply*>(reply);
+            break;
+        }
+
+        if (static_cast<redisReply*>(reply)->type == REDIS_REPLY_ERROR)
+            pModuleManager->ErrorPrintf("Redis Module: %s\n", static_cast<redisReply*>(reply)->str);
+        else if (i == iAdd)
+            bWritten = true;
+        freeReplyObject(reply);
+    }
+    CommitWritten(positions, bWritten);
+    return pResult;
+}
+
+int CRedisGeoSet::PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const
+{
+    if (!pReply || pReply->type == REDIS_REPLY_ERROR)
+        return CLuaReply::PushResult(luaVM, pReply, szError);
+
+    if (pReply->type != REDIS_REPLY_ARRAY)
+    {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, "Unexpected reply");
+        return 2;
+    }
+
+    // {{id =, x =, y =, distance =}, ...} nearest first, in world units
+    double dUnitsPerMetre = 1 / (m_Transform.dScale * METRES_PER_DEGREE);
+    lua_createtable(luaVM, static_cast<int>(pReply->elements), 0);
+    for (size_t i = 0; i < pReply->elements; i++)
+    {
+        // member, distance, {lon, lat}
+        const redisReply* pItem = pReply->element[i];
+        if (pItem->type != REDIS_REPLY_ARRAY || pItem->elements != 3 || pItem->element[2]->type != REDIS_REPLY_ARRAY ||
+            pItem->element[2]->elements != 2)
+            continue;
+
+        double dDistance = 0, dLon = 0, dLat = 0;
+        const redisReply* pDistance = pItem->element[1];
+        const redisReply* pLon = pItem->element[2]->element[0];
+        const redisReply* pLat = pItem->element[2]->element[1];
+        std::from_chars(pDistance->str, pDistance->str + pDistance->len, dDistance);
+        std::from_chars(pLon->str, pLon->str + pLon->len, dLon);
+        std::from_chars(pLat->str, pLat->str + pLat->len, dLat);
+
+        lua_createtable(luaVM, 0, 4);
+        lua_pushlstring(luaVM, pItem->element[0]->str, pItem->element[0]->len);
+        lua_setfield(luaVM, -2, "id");
+        lua_pushnumber(luaVM, (dLon - m_Transform.dOriginLon) / m_Transform.dScale);
+        lua_setfield(luaVM, -2, "x");
+        lua_pushnumber(luaVM, (dLat - m_Transform.dOriginLat) / m_Transform.dScale);
+        lua_setfield(luaVM, -2, "y");
+        lua_pushnumber(luaVM, dDistance * dUnitsPerMetre);
+        lua_setfield(luaVM, -2, "distance");
+        lua_rawseti(luaVM, -2, static_cast<int>(lua_objlen(luaVM, -2)) + 1);
+    }
+    return 1;
+}
+
+CRedisGeoWrite::CRedisGeoWrite(const std::shared_ptr<CRedisGeoSet>& pGeoSet, CRedisGeoSet::Positions&& positions)
+    : m_pGeoSet(pGeoSet), m_Positions(std::move(positions))
+{
+}
+
+void CRedisGeoWrite::Dispatch(CRedisRequest* pRequest)
+{
+    bool bWritten = pRequest->pReply && pRequest->pReply->type != REDIS_REPLY_ERROR;
+    if (!bWritten)
+        pModuleManager->ErrorPrintf("Redis Module: %s\n", pRequest->pReply ? pRequest->pReply->str : pRequest->strError.c_str());
+
+    // The set may have been destroyed while the write was in flight
+    if (std::shared_ptr<CRedisGeoSet> pGeoSet = m_pGeoSet.lock())
+        pGeoSet->CommitWritten(m_Positions, bWritten);
+}
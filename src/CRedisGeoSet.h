@@ -0,0 +1,130 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisGeoSet;
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Common.h"
+#include "CRedisReplyHandler.h"
+#include "hiredis.h"
+
+class CRedisClient;
+class CRedisRequest;
+
+// World position -> longitude/latitude, linear around an origin. Distances
+// only match world units near the equator, a degree of longitude shrinks with latitude.
+struct SGeoTransform
+{
+    double dScale;            // degrees per world unit
+    double dOriginLon;
+    double dOriginLat;
+};
+
+//
+// Geo set of entity positions in world coordinates. Updates are filtered
+// against the position last written, anything that moved less than the
+// threshold is dropped, the rest goes out as one GEOADD per pulse. A
+// position counts as written once the server acknowledged the GEOADD.
+// Searches take and return world coordinates, distances included, and use
+// GEOSEARCH, which needs redis 6.2 or later.
+//
+// Async searches carry the set as their handler and pass (results) or
+// (false, error) to the callback of the request.
+//
+class CRedisGeoSet : public CRedisReplyHandler, public std::enable_shared_from_this<CRedisGeoSet>
+{
+public:
+    struct SPosition
+    {
+        double dX;
+        double dY;
+    };
+    typedef std::vector<std::pair<std::string, SPosition>> Positions;
+
+    // GEOSEARCH FROMLONLAT <lon> <lat> BYRADIUS <r> m ASC [COUNT <n>] WITHCOORD WITHDIST
+    struct SNearCommand
+    {
+        std::string strLon, strLat, strRadius, strCount;
+        const char* argv[13];
+        size_t      argvlen[13];
+        int         argc;
+    };
+
+    // Same sphere as the server, one world unit is a metre with a scale of 1 / METRES_PER_DEGREE
+    static constexpr double METRES_PER_DEGREE = 6372797.560856 * 3.14159265358979323846 / 180;
+
+    CRedisGeoSet(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey, const SGeoTransform& transform,
+                 double dThreshold);
+
+    // Main thread. Positions must pass IsValidPosition.
+    bool IsValidPosition(double dX, double dY) const;
+    void Update(std::string_view strId, double dX, double dY);
+    void Remove(std::string_view strId);
+    void Flush();
+    void CommitWritten(const Positions& positions, bool bWritten);
+
+    void PrepareNear(double dX, double dY, double dRadius, unsigned int uiCount, SNearCommand& command) const;
+    int  PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const;
+
+    // Blocking search on the sync context, updates not flushed yet are sent ahead of it
+    redisReply* Near(double dX, double dY, double dRadius, unsigned int uiCount, std::string& strError);
+
+    void          SetId(unsigned int uiId) { m_uiId = uiId; };
+    unsigned int  GetId() const { return m_uiId; };
+    lua_State*    GetLuaVM() const { return m_luaVM; };
+    CRedisClient* GetClient() const { return m_pClient.get(); };
+
+private:
+    // GEOADD and ZREM of everything waiting, empty when there is nothing to send
+    void TakePending(std::vector<std::string>& add, std::vector<std::string>& remove, Positions& positions);
+
+    unsigned int                               m_uiId;
+    lua_State*                                 m_luaVM;            // main state of the creating resource
+    std::shared_ptr<CRedisClient>              m_pClient;
+    std::string                                m_strKey;
+    SGeoTransform                              m_Transform;
+    double                                     m_dThreshold;
+    std::unordered_map<std::string, SPosition> m_Written;            // as last acknowledged
+    std::unordered_map<std::string, SPosition> m_Sent;               // GEOADD awaiting its reply
+    std::unordered_map<std::string, SPosition> m_Pending;
+    std::unordered_set<std::string>            m_Removed;
+};
+
+//
+// GEOADD of one flush, hands its positions back to the set with the reply
+//
+class CRedisGeoWrite : public CRedisHandler
+{
+public:
+    CRedisGeoWrite(const std::shared_ptr<CRedisGeoSet>& pGeoSet, CRedisGeoSet::Positions&& positions);
+
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return false; };
+
+private:
+    std::weak_ptr<CRedisGeoSet> m_pGeoSet;
+    CRedisGeoSet::Positions     m_Positions;
+};
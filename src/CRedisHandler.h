@@ -0,0 +1,38 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisHandler;
+
+#pragma once
+
+class CRedisRequest;
+
+//
+// Main thread destination of requests that don't go through the generic
+// callback path (worker deliveries, lock results, ...). Requests carrying
+// a handler in pHandler are handed to it by CRedisManager::DoPulse.
+//
+class CRedisHandler
+{
+public:
+    virtual ~CRedisHandler() {};
+
+    // Main thread
+    virtual void Dispatch(CRedisRequest* pRequest) = 0;
+    virtual bool IsCancelled() const = 0;
+};
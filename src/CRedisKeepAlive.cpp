@@ -0,0 +1,125 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisKeepAlive.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <algorithm>
+
+// Wheel resolution and size, one turn covers 25.6s
+#define KEEPALIVE_TICK_MS 50
+#define KEEPALIVE_SLOTS   512
+
+CRedisKeepAlive::CRedisKeepAlive() : m_Slots(KEEPALIVE_SLOTS), m_Random(std::random_device()())
+{
+    m_sizeCurrentSlot = 0;
+    m_uiNextGeneration = 1;
+    m_LastTick = std::chrono::steady_clock::now();
+}
+
+void CRedisKeepAlive::Add(CRedisClient* pClient, const std::string& strKey, unsigned int uiTtlMs)
+{
+    // Registering again replaces the ttl, the old schedule goes stale
+    SEntry& entry = m_Entries[pClient][strKey];
+    entry.uiTtlMs = uiTtlMs;
+    entry.uiIntervalTicks = std::max(1u, uiTtlMs / 3 / KEEPALIVE_TICK_MS);
+    entry.uiGeneration = m_uiNextGeneration++;
+
+    std::uniform_int_distribution<unsigned int> first(1, entry.uiIntervalTicks);
+    Schedule(pClient, strKey, entry.uiGeneration, first(m_Random));
+}
+
+bool CRedisKeepAlive::Remove(CRedisClient* pClient, const std::string& strKey)
+{
+    // Its slot entry is dropped once reached
+    auto iter = m_Entries.find(pClient);
+    if (iter == m_Entries.end() || !iter->second.erase(strKey))
+        return false;
+
+    if (iter->second.empty())
+        m_Entries.erase(iter);
+    return true;
+}
+
+void CRedisKeepAlive::RemoveClient(CRedisClient* pClient)
+{
+    m_Entries.erase(pClient);
+}
+
+void CRedisKeepAlive::Schedule(CRedisClient* pClient, const std::string& strKey, unsigned int uiGeneration, unsigned int uiTicks)
+{
+    size_t sizeSlot = (m_sizeCurrentSlot + uiTicks) % KEEPALIVE_SLOTS;
+    m_Slots[sizeSlot].push_back({pClient, strKey, uiGeneration, (uiTicks - 1) / KEEPALIVE_SLOTS});
+}
+
+void CRedisKeepAlive::Pulse()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (m_Entries.empty())
+    {
+        // Stale slot entries can wait, nothing of an idle wheel is due
+        m_LastTick = now;
+        return;
+    }
+
+    std::map<CRedisClient*, std::vector<CRedisRequest*>> batches;
+    std::vector<SSlotEntry>                              slot;
+    while (now - m_LastTick >= std::chrono::milliseconds(KEEPALIVE_TICK_MS))
+    {
+        m_LastTick += std::chrono::milliseconds(KEEPALIVE_TICK_MS);
+        m_sizeCurrentSlot = (m_sizeCurrentSlot + 1) % KEEPALIVE_SLOTS;
+
+        slot.clear();
+        slot.swap(m_Slots[m_sizeCurrentSlot]);
+        for (SSlotEntry& slotEntry : slot)
+        {
+            auto clientIter = m_Entries.find(slotEntry.pClient);
+            if (clientIter == m_Entries.end())
+                continue;
+            auto entryIter = clientIter->second.find(slotEntry.strKey);
+            if (entryIter == clientIter->second.end() || entryIter->second.uiGeneration != slotEntry.uiGeneration)
+                continue;
+
+            if (slotEntry.uiRounds)
+            {
+                slotEntry.uiRounds--;
+                m_Slots[m_sizeCurrentSlot].push_back(std::move(slotEntry));
+                continue;
+            }
+
+            const SEntry& entry = entryIter->second;
+            std::string   strTtl = std::to_string(entry.uiTtlMs);
+            const char*   argv[] = {"PEXPIRE", slotEntry.strKey.c_str(), strTtl.c_str()};
+            size_t        argvlen[] = {7, slotEntry.strKey.length(), strTtl.length()};
+
+            CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+            pRequest->ePriority = PRIORITY_BULK;
+            pRequest->eLane = LANE_BULK;
+            if (pRequest->SetCommand(3, argv, argvlen))
+                batches[slotEntry.pClient].push_back(pRequest);
+            else
+                pRedisManager->ReleaseRequest(pRequest);
+
+            Schedule(slotEntry.pClient, slotEntry.strKey, slotEntry.uiGeneration, entry.uiIntervalTicks);
+        }
+    }
+
+    for (auto& pair : batches)
+        pRedisManager->SendBatch(pair.first, std::move(pair.second));
+}
@@ -0,0 +1,78 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisKeepAlive;
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+
+class CRedisClient;
+
+//
+// Keys kept from expiring with a PEXPIRE every third of their ttl.
+//
+// Refreshes sit in a hashed timing wheel, intervals longer than a turn
+// wait for a number of rounds in their slot. The first refresh of a key
+// lands at a random point of its interval, so keys registered together
+// don't stay in step. Whatever comes due within a pulse goes out as one
+// pipeline per client on the bulk lane.
+//
+class CRedisKeepAlive
+{
+public:
+    CRedisKeepAlive();
+
+    // Main thread
+    void Add(CRedisClient* pClient, const std::string& strKey, unsigned int uiTtlMs);
+    bool Remove(CRedisClient* pClient, const std::string& strKey);
+    void RemoveClient(CRedisClient* pClient);
+    void Pulse();
+
+private:
+    struct SEntry
+    {
+        unsigned int uiTtlMs;
+        unsigned int uiIntervalTicks;
+        unsigned int uiGeneration;            // slot entries of an older registration are stale
+    };
+
+    struct SSlotEntry
+    {
+        CRedisClient* pClient;
+        std::string   strKey;
+        unsigned int  uiGeneration;
+        unsigned int  uiRounds;            // full turns left before it is due
+    };
+
+    void Schedule(CRedisClient* pClient, const std::string& strKey, unsigned int uiGeneration, unsigned int uiTicks);
+
+    std::map<CRedisClient*, std::unordered_map<std::string, SEntry>> m_Entries;
+    std::vector<std::vector<SSlotEntry>>                             m_Slots;
+    size_t                                                           m_sizeCurrentSlot;            // last slot processed
+    std::chrono::steady_clock::time_point                            m_LastTick;
+    unsigned int                                                     m_uiNextGeneration;
+    std::minstd_rand                                                 m_Random;
+};
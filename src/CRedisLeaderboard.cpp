@@ -0,0 +1,217 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisLeaderboard.h"
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <charconv>
+
+CRedisLeaderboard::CRedisLeaderboard(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey, unsigned int uiCacheMs)
+    : m_pClient(pClient), m_strKey(strKey), m_CacheDuration(uiCacheMs)
+{
+    m_uiId = 0;
+    m_luaVM = CLuaFunctionRef::GetMainState(luaVM);
+    m_sizeTopRequested = 0;
+}
+
+void CRedisLeaderboard::Add(std::string_view strMember, double dDelta)
+{
+    m_Pending[std::string(strMember)] += dDelta;
+}
+
+void CRedisLeaderboard::Flush()
+{
+    if (m_Pending.empty())
+        return;
+
+    std::vector<CRedisRequest*> requests;
+    requests.reserve(m_Pending.size());
+    for (const auto& pending : m_Pending)
+    {
+        char szDelta[32];
+        auto result = std::to_chars(szDelta, szDelta + sizeof(szDelta), pending.second);
+
+        const char* argv[] = {"ZINCRBY", m_strKey.c_str(), szDelta, pending.first.c_str()};
+        size_t      argvlen[] = {7, m_strKey.length(), static_cast<size_t>(result.ptr - szDelta), pending.first.length()};
+
+        CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+        pRequest->ePriority = PRIORITY_BULK;
+        pRequest->eLane = LANE_BULK;
+        if (pRequest->SetCommand(4, argv, argvlen))
+            requests.push_back(pRequest);
+        else
+            pRedisManager->ReleaseRequest(pRequest);
+    }
+    m_Pending.clear();
+
+    pRedisManager->SendBatch(m_pClient.get(), std::move(requests));
+}
+
+int CRedisLeaderboard::AppendPending(redisContext* c)
+{
+    // In m_Pending order, kept until CommitPending saw the replies
+    int iCount = 0;
+    for (const auto& pending : m_Pending)
+    {
+        char szDelta[32];
+        auto result = std::to_chars(szDelta, szDelta + sizeof(szDelta), pending.second);
+
+        const char* argv[] = {"ZINCRBY", m_strKey.c_str(), szDelta, pending.first.c_str()};
+        size_t      argvlen[] = {7, m_strKey.length(), static_cast<size_t>(result.ptr - szDelta), pending.first.length()};
+        if (redisAppendCommandArgv(c, 4, argv, argvlen) != REDIS_OK)
+            break;
+        iCount++;
+    }
+    return iCount;
+}
+
+void CRedisLeaderboard::CommitPending(const std::vector<redisReply*>& replies, int iPending)
+{
+    // Increments the server refused stay pending for the next flush
+    auto iter = m_Pending.begin();
+    for (int i = 0; i < iPending && iter != m_Pending.end(); i++)
+    {
+        if (replies[i]->type != REDIS_REPLY_ERROR)
+            iter = m_Pending.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+bool CRedisLeaderboard::ReadReplies(redisContext* c, int iCount, std::vector<redisReply*>& replies, std::string& strError)
+{
+    // Error replies are read like any other, a broken connection can't be used anymore anyway
+    replies.reserve(iCount);
+    for (int i = 0; i < iCount; i++)
+    {
+        void* reply = NULL;
+        if (redisGetReply(c, &reply) != REDIS_OK)
+        {
+            strError = c->errstr;
+            for (redisReply* pReply : replies)
+                freeReplyObject(pReply);
+            replies.clear();
+            return false;
+        }
+        replies.push_back(static_cast<redisReply*>(reply));
+    }
+    return true;
+}
+
+const CRedisLeaderboard::Entries* CRedisLeaderboard::GetTop(size_t sizeCount, std::string& strError)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (sizeCount <= m_sizeTopRequested && now - m_TopAt < m_CacheDuration)
+        return &m_Top;
+
+    redisContext* c = m_pClient->GetContext();
+    if (!c)
+    {
+        strError = "Client is closed";
+        return NULL;
+    }
+
+    // Local increments go first so the list includes them, in the same round trip
+    int         iPending = AppendPending(c);
+    int         iCount = iPending;
+    std::string strStop = std::to_string(static_cast<long long>(sizeCount) - 1);
+    const char* argv[] = {"ZREVRANGE", m_strKey.c_str(), "0", strStop.c_str(), "WITHSCORES"};
+    size_t      argvlen[] = {9, m_strKey.length(), 1, strStop.length(), 10};
+    if (redisAppendCommandArgv(c, 5, argv, argvlen) == REDIS_OK)
+        iCount++;
+
+    std::vector<redisReply*> replies;
+    if (!ReadReplies(c, iCount, replies, strError))
+        return NULL;
+    CommitPending(replies, iPending);
+
+    const redisReply* pReply = replies.empty() ? NULL : replies.back();
+    bool              bValid = pReply && pReply->type == REDIS_REPLY_ARRAY && pReply->elements % 2 == 0;
+    if (bValid)
+    {
+        m_Top.clear();
+        m_Top.reserve(pReply->elements / 2);
+        for (size_t i = 0; i + 1 < pReply->elements; i += 2)
+        {
+            const redisReply* pMember = pReply->element[i];
+            const redisReply* pScore = pReply->element[i + 1];
+            double            dScore = 0;
+            std::from_chars(pScore->str, pScore->str + pScore->len, dScore);
+            m_Top.emplace_back(std::string(pMember->str, pMember->len), dScore);
+        }
+        m_TopAt = now;
+        m_sizeTopRequested = sizeCount;
+    }
+    else
+        strError = pReply && pReply->type == REDIS_REPLY_ERROR ? pReply->str : "Unexpected reply";
+
+    for (redisReply* pReply : replies)
+        freeReplyObject(pReply);
+    return bValid ? &m_Top : NULL;
+}
+
+bool CRedisLeaderboard::GetRanks(const std::vector<std::string_view>& members, std::vector<long long>& ranks, std::string& strError)
+{
+    redisContext* c = m_pClient->GetContext();
+    if (!c)
+    {
+        strError = "Client is closed";
+        return false;
+    }
+
+    int iPending = AppendPending(c);
+    int iCount = iPending;
+    for (std::string_view strMember : members)
+    {
+        const char* argv[] = {"ZREVRANK", m_strKey.c_str(), strMember.data()};
+        size_t      argvlen[] = {8, m_strKey.length(), strMember.length()};
+        if (redisAppendCommandArgv(c, 3, argv, argvlen) != REDIS_OK)
+            break;
+        iCount++;
+    }
+
+    std::vector<redisReply*> replies;
+    if (!ReadReplies(c, iCount, replies, strError))
+        return false;
+    CommitPending(replies, iPending);
+
+    bool bValid = replies.size() == static_cast<size_t>(iPending) + members.size();
+    ranks.clear();
+    ranks.reserve(members.size());
+    for (size_t i = static_cast<size_t>(iPending); i < replies.size() && bValid; i++)
+    {
+        const redisReply* pReply = replies[i];
+        if (pReply->type == REDIS_REPLY_INTEGER)
+            ranks.push_back(pReply->integer + 1);
+        else if (pReply->type == REDIS_REPLY_NIL)
+            ranks.push_back(0);
+        else
+        {
+            strError = pReply->type == REDIS_REPLY_ERROR ? pReply->str : "Unexpected reply";
+            bValid = false;
+        }
+    }
+    if (!bValid && strError.empty())
+        strError = "Can't format command";
+
+    for (redisReply* pReply : replies)
+        freeReplyObject(pReply);
+    return bValid;
+}
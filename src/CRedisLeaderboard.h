@@ -0,0 +1,79 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisLeaderboard;
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+#include "hiredis.h"
+
+class CRedisClient;
+
+//
+// Sorted set used as a leaderboard, highest score first.
+//
+// Score increments are summed up per member and go out as one pipeline
+// of ZINCRBY per pulse on the bulk lane. Reads run on the sync context and
+// send whatever wasn't flushed yet ahead of them. Increments already handed
+// to the bulk lane may still be queued there and can be missing from a read.
+// The top list is kept for a short while and served from memory.
+//
+class CRedisLeaderboard
+{
+public:
+    typedef std::vector<std::pair<std::string, double>> Entries;
+
+    CRedisLeaderboard(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey, unsigned int uiCacheMs);
+
+    // Main thread
+    void Add(std::string_view strMember, double dDelta);
+    void Flush();
+
+    // Entries stay valid until the next call, ranks start at 1 with 0 for unranked members
+    const Entries* GetTop(size_t sizeCount, std::string& strError);
+    bool           GetRanks(const std::vector<std::string_view>& members, std::vector<long long>& ranks, std::string& strError);
+
+    void          SetId(unsigned int uiId) { m_uiId = uiId; };
+    unsigned int  GetId() const { return m_uiId; };
+    lua_State*    GetLuaVM() const { return m_luaVM; };
+    CRedisClient* GetClient() const { return m_pClient.get(); };
+
+private:
+    int  AppendPending(redisContext* c);
+    void CommitPending(const std::vector<redisReply*>& replies, int iPending);
+    bool ReadReplies(redisContext* c, int iCount, std::vector<redisReply*>& replies, std::string& strError);
+
+    unsigned int                            m_uiId;
+    lua_State*                              m_luaVM;            // main state of the creating resource
+    std::shared_ptr<CRedisClient>           m_pClient;
+    std::string                             m_strKey;
+    std::unordered_map<std::string, double> m_Pending;            // member -> summed increment
+
+    std::chrono::milliseconds             m_CacheDuration;
+    std::chrono::steady_clock::time_point m_TopAt;
+    Entries                               m_Top;
+    size_t                                m_sizeTopRequested;            // ZREVRANGE count the cache answers
+};
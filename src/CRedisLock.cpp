@@ -0,0 +1,306 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisLock.h"
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+#include "CRedisScript.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Upper bound of the acquisition backoff, before jitter
+#define LOCK_RETRY_DELAY_MAX 1000
+
+// Delay between renewals that failed for connection reasons
+#define LOCK_RENEW_RETRY_DELAY 250
+
+static const CRedisScript renewScript(
+    "if redis.call('GET', KEYS[1]) == ARGV[1] then\n"
+    "    return redis.call('PEXPIRE', KEYS[1], ARGV[2])\n"
+    "end\n"
+    "return 0\n");
+
+static const CRedisScript unlockScript(
+    "if redis.call('GET', KEYS[1]) == ARGV[1] then\n"
+    "    return redis.call('DEL', KEYS[1])\n"
+    "end\n"
+    "return 0\n");
+
+CRedisLock::CRedisLock(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strName, unsigned int uiTtlMs,
+                       unsigned int uiWaitMs, unsigned int uiRetryMs, CLuaFunctionRef&& callback)
+    : m_pClient(pClient), m_Callback(std::move(callback))
+{
+    // The resource that asked for it, which needn't be the one owning the client
+    m_luaVM = CLuaFunctionRef::GetMainState(luaVM);
+    m_uiId = 0;
+    m_strKey = strName;
+    m_strTtl = std::to_string(uiTtlMs);
+    m_uiTtlMs = uiTtlMs;
+    m_uiRenewMs = std::max(uiTtlMs / 3, 1u);
+    m_uiRetryMs = std::max(uiRetryMs, 1u);
+    m_eState = STATE_ACQUIRING;
+    m_bReleaseRequested = false;
+    m_WaitDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(uiWaitMs);
+    m_uiAttempt = 0;
+
+    // 128 bit token, only ever compared by the server
+    std::random_device device;
+    char               szToken[33];
+    snprintf(szToken, sizeof(szToken), "%08x%08x%08x%08x", device(), device(), device(), device());
+    m_strToken = szToken;
+    m_Random.seed(device());
+}
+
+void CRedisLock::Acquire()
+{
+    std::shared_ptr<CRedisLock> pSelf = shared_from_this();
+    m_pClient->Post([pSelf]() { pSelf->TryAcquire(); });
+}
+
+bool CRedisLock::Release()
+{
+    // The lua state may be about to go away, drop our reference right now
+    m_Callback.Release();
+    if (m_bReleaseRequested.exchange(true) || m_eState > STATE_HELD)
+        return false;
+
+    // Still acquiring: the pending attempt sees the flag and gives up or unlocks
+    std::shared_ptr<CRedisLock> pSelf = shared_from_this();
+    m_pClient->Post([pSelf]() { pSelf->Unlock(); });
+    return true;
+}
+
+void CRedisLock::Dispatch(CRedisRequest* pRequest)
+{
+    if (!m_Callback.Push())
+        return;
+
+    lua_State* luaVM = m_Callback.GetLuaVM();
+    if (pRequest->strError.empty())
+    {
+        lua_pushboolean(luaVM, 1);
+        lua_pushnumber(luaVM, m_uiId);
+    }
+    else
+    {
+        lua_pushboolean(luaVM, 0);
+        lua_pushlstring(luaVM, pRequest->strError.c_str(), pRequest->strError.length());
+    }
+
+    // Failures are final, nothing to call back for afterwards
+    if (!pRequest->strError.empty())
+        m_Callback.Release();
+    CLuaFunctionRef::Call(luaVM, 2);
+}
+
+void CRedisLock::TryAcquire()
+{
+    if (m_bReleaseRequested)
+    {
+        m_eState = STATE_RELEASED;
+        return;
+    }
+
+    redisAsyncContext* ac = m_pClient->GetAsyncContext();
+    if (!ac)
+    {
+        RetryOrFail("Can't connect to redis server");
+        return;
+    }
+
+    const char* argv[] = {"SET", m_strKey.c_str(), m_strToken.c_str(), "NX", "PX", m_strTtl.c_str()};
+    size_t      argvlen[] = {3, m_strKey.length(), m_strToken.length(), 2, 2, m_strTtl.length()};
+    void*       privdata = Retain();
+    m_pClient->NoteCommand();
+    if (redisAsyncCommandArgv(ac, &CRedisLock::OnAcquireReply, privdata, 6, argv, argvlen) != REDIS_OK)
+    {
+        Adopt(privdata);
+        RetryOrFail(ac->errstr[0] ? ac->errstr : "Can't queue redis command");
+    }
+}
+
+void CRedisLock::RetryOrFail(const char* szError)
+{
+    // Exponential backoff with +-50% jitter, so contenders don't retry in lockstep
+    unsigned int uiDelay = m_uiRetryMs << std::min(m_uiAttempt++, 10u);
+    uiDelay = std::min(uiDelay, static_cast<unsigned int>(LOCK_RETRY_DELAY_MAX));
+    uiDelay = std::uniform_int_distribution<unsigned int>(uiDelay / 2, uiDelay + uiDelay / 2)(m_Random);
+
+    if (m_bReleaseRequested)
+    {
+        m_eState = STATE_RELEASED;
+        return;
+    }
+
+    if (std::chrono::steady_clock::now() + std::chrono::milliseconds(uiDelay) > m_WaitDeadline)
+    {
+        m_eState = STATE_FAILED;
+        Deliver(szError);
+        return;
+    }
+
+    std::shared_ptr<CRedisLock> pSelf = shared_from_this();
+    pRedisManager->GetEventLoop()->Schedule(uiDelay, [pSelf]() { pSelf->TryAcquire(); });
+}
+
+void CRedisLock::Renew(bool bSource)
+{
+    if (m_eState != STATE_HELD || m_bReleaseRequested)
+        return;
+
+    redisAsyncContext* ac = m_pClient->GetAsyncContext();
+    const char*        argv[] = {m_strKey.c_str(), m_strToken.c_str(), m_strTtl.c_str()};
+    void*              privdata = Retain();
+    if (!ac || renewScript.CallAsync(ac, &CRedisLock::OnRenewReply, privdata, 1, 3, argv, NULL, bSource) != REDIS_OK)
+        OnRenewReply(ac, NULL, privdata);
+}
+
+void CRedisLock::Unlock()
+{
+    if (m_eState != STATE_HELD)
+        return;
+
+    m_eState = STATE_RELEASED;
+    SendUnlock(false);
+}
+
+void CRedisLock::SendUnlock(bool bSource)
+{
+    redisAsyncContext* ac = m_pClient->GetAsyncContext();
+    const char*        argv[] = {m_strKey.c_str(), m_strToken.c_str()};
+    void*              privdata = Retain();
+    m_pClient->NoteCommand();
+
+    // Nothing to do if it fails, the lease runs out on its own
+    if (!ac || unlockScript.CallAsync(ac, &CRedisLock::OnUnlockReply, privdata, 1, 2, argv, NULL, bSource) != REDIS_OK)
+        Adopt(privdata);
+}
+
+void CRedisLock::Deliver(const char* szError)
+{
+    // Not from the pool, that one belongs to the main thread
+    CRedisRequest* pRequest = new CRedisRequest();
+    pRequest->pHandler = shared_from_this();
+    pRequest->luaVM = m_luaVM;
+    pRequest->ePriority = PRIORITY_HIGH;
+    if (szError)
+        pRequest->SetError(szError);
+    pRedisManager->Complete(pRequest);
+}
+
+void CRedisLock::OnAcquireReply(redisAsyncContext* ac, void* reply, void* privdata)
+{
+    std::shared_ptr<CRedisLock> pLock = Adopt(privdata);
+    redisReply*                 pReply = static_cast<redisReply*>(reply);
+
+    if (!pReply)
+    {
+        pLock->RetryOrFail(ac->errstr[0] ? ac->errstr : "Connection lost");
+        return;
+    }
+
+    if (pReply->type == REDIS_REPLY_ERROR)
+    {
+        pLock->m_eState = STATE_FAILED;
+        pLock->Deliver(pReply->str);
+        return;
+    }
+
+    // Nil: somebody else holds it
+    if (pReply->type != REDIS_REPLY_STATUS)
+    {
+        pLock->RetryOrFail("Timed out waiting for the lock");
+        return;
+    }
+
+    pLock->m_LeaseExpiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(pLock->m_uiTtlMs);
+    pLock->m_eState = STATE_HELD;
+
+    // Released while the SET was in flight, give it straight back
+    if (pLock->m_bReleaseRequested)
+    {
+        pLock->Unlock();
+        return;
+    }
+
+    pLock->Deliver(NULL);
+    pRedisManager->GetEventLoop()->Schedule(pLock->m_uiRenewMs, [pLock]() { pLock->Renew(); });
+}
+
+void CRedisLock::OnRenewReply(redisAsyncContext* /*ac*/, void* reply, void* privdata)
+{
+    std::shared_ptr<CRedisLock> pLock = Adopt(privdata);
+    redisReply*                 pReply = static_cast<redisReply*>(reply);
+    auto                        now = std::chrono::steady_clock::now();
+
+    if (pLock->m_eState != STATE_HELD)
+        return;
+
+    if (CRedisScript::IsNoScript(pReply))
+    {
+        pLock->Renew(true);
+        return;
+    }
+
+    if (pReply && pReply->type == REDIS_REPLY_INTEGER && pReply->integer == 1)
+    {
+        pLock->m_LeaseExpiry = now + std::chrono::milliseconds(pLock->m_uiTtlMs);
+        pRedisManager->GetEventLoop()->Schedule(pLock->m_uiRenewMs, [pLock]() { pLock->Renew(); });
+        return;
+    }
+
+    // The token no longer matches, the lease expired and may be someone else's now
+    if (pReply && pReply->type == REDIS_REPLY_INTEGER)
+    {
+        pLock->m_eState = STATE_LOST;
+        pLock->Deliver("Lock lost");
+        return;
+    }
+
+    // Connection trouble, keep trying for as long as the lease may still be ours
+    unsigned int uiDelay = std::min(pLock->m_uiRenewMs, static_cast<unsigned int>(LOCK_RENEW_RETRY_DELAY));
+    if (now + std::chrono::milliseconds(uiDelay) >= pLock->m_LeaseExpiry)
+    {
+        pLock->m_eState = STATE_LOST;
+        pLock->Deliver(pReply && pReply->type == REDIS_REPLY_ERROR ? pReply->str : "Lock lost, can't reach redis server");
+        return;
+    }
+    pRedisManager->GetEventLoop()->Schedule(uiDelay, [pLock]() { pLock->Renew(); });
+}
+
+void CRedisLock::OnUnlockReply(redisAsyncContext* /*ac*/, void* reply, void* privdata)
+{
+    std::shared_ptr<CRedisLock> pLock = Adopt(privdata);
+    if (CRedisScript::IsNoScript(static_cast<redisReply*>(reply)))
+        pLock->SendUnlock(true);
+}
+
+void* CRedisLock::Retain()
+{
+    return new std::shared_ptr<CRedisLock>(shared_from_this());
+}
+
+std::shared_ptr<CRedisLock> CRedisLock::Adopt(void* privdata)
+{
+    std::shared_ptr<CRedisLock>* pHolder = static_cast<std::shared_ptr<CRedisLock>*>(privdata);
+    std::shared_ptr<CRedisLock>  pLock = std::move(*pHolder);
+    delete pHolder;
+    return pLock;
+}
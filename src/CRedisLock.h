@@ -0,0 +1,112 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisLock;
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "Common.h"
+#include "CRedisHandler.h"
+#include "extra/CLuaFunctionRef.h"
+#include "hiredis.h"
+#include "async.h"
+
+class CRedisClient;
+class CRedisRequest;
+
+//
+// Lease based distributed lock (SET NX PX with a random token).
+//
+// Everything touching redis runs on the event loop: acquisition retries
+// with jittered backoff on loop timers, the lease is extended every third
+// of its ttl while held and released through a token checked script, so a
+// lease that expired and got taken by someone else is never deleted.
+//
+// The callback receives (true, id) once acquired, or (false, error) when
+// acquisition failed or a held lease was lost.
+//
+class CRedisLock : public CRedisHandler, public std::enable_shared_from_this<CRedisLock>
+{
+public:
+    enum eState
+    {
+        STATE_ACQUIRING,
+        STATE_HELD,
+        STATE_FAILED,
+        STATE_LOST,
+        STATE_RELEASED
+    };
+
+    CRedisLock(lua_State* luaVM, const std::shared_ptr<CRedisClient>& pClient, const std::string& strName, unsigned int uiTtlMs,
+               unsigned int uiWaitMs, unsigned int uiRetryMs, CLuaFunctionRef&& callback);
+
+    // Main thread
+    void Acquire();
+    bool Release();
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return m_bReleaseRequested; };
+    bool IsHeld() const { return m_eState == STATE_HELD; };
+    bool IsFinished() const { return m_eState > STATE_HELD && !m_Callback.IsValid(); };
+
+    void          SetId(unsigned int uiId) { m_uiId = uiId; };
+    unsigned int  GetId() const { return m_uiId; };
+    lua_State*    GetLuaVM() const { return m_luaVM; };
+    CRedisClient* GetClient() const { return m_pClient.get(); };
+
+private:
+    // I/O thread
+    void TryAcquire();
+    void RetryOrFail(const char* szError);
+    void Renew(bool bSource = false);            // bSource after NOSCRIPT
+    void Unlock();
+    void SendUnlock(bool bSource);
+    void Deliver(const char* szError);
+
+    static void OnAcquireReply(redisAsyncContext* ac, void* reply, void* privdata);
+    static void OnRenewReply(redisAsyncContext* ac, void* reply, void* privdata);
+    static void OnUnlockReply(redisAsyncContext* ac, void* reply, void* privdata);
+
+    // hiredis privdata, keeps us alive until the reply arrived
+    void*                              Retain();
+    static std::shared_ptr<CRedisLock> Adopt(void* privdata);
+
+    std::shared_ptr<CRedisClient> m_pClient;
+    lua_State*                    m_luaVM;
+    unsigned int                  m_uiId;
+    std::string                   m_strKey;
+    std::string                   m_strToken;
+    std::string                   m_strTtl;
+    unsigned int                  m_uiTtlMs;
+    unsigned int                  m_uiRenewMs;
+    unsigned int                  m_uiRetryMs;
+    std::atomic<eState>           m_eState;
+    std::atomic<bool>             m_bReleaseRequested;
+    CLuaFunctionRef               m_Callback;            // main thread only
+
+    // I/O thread only
+    std::chrono::steady_clock::time_point m_WaitDeadline;
+    std::chrono::steady_clock::time_point m_LeaseExpiry;            // as far as we know
+    unsigned int                          m_uiAttempt;
+    std::mt19937                          m_Random;
+};
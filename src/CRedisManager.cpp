@@ -0,0 +1,1054 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisManager.h"
+#include "Casts.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <strings.h>
+#include <thread>
+#include "extra/CLuaReply.h"
+#include "CRedisSchedulePoller.h"
+
+CRedisManager* pRedisManager = NULL;
+
+// Requests kept around for reuse, anything above is given back to the heap
+#define MAX_FREE_REQUESTS 4096
+
+// How often a command blocked by the limits checks for room
+#define LIMIT_BLOCK_POLL_US 200
+
+// Longest a LIMIT_BLOCK admission may hold up the main thread
+#define LIMIT_BLOCK_MAX_MS 50
+
+// Side effect free commands whose replies may be shared by identical requests
+static const char* szCoalescableCommands[] = {
+    "GET",    "MGET",   "GETRANGE", "STRLEN",   "EXISTS", "TYPE",      "TTL",    "PTTL",          "HGET",      "HMGET",     "HGETALL",
+    "HKEYS",  "HVALS",  "HLEN",     "HEXISTS",  "LRANGE", "LLEN",      "LINDEX", "SMEMBERS",      "SCARD",     "SISMEMBER", "ZRANGE",
+    "ZSCORE", "ZRANK",  "ZREVRANK", "ZCARD",    "ZCOUNT", "ZREVRANGE", "XLEN",   "ZRANGEBYSCORE", "XRANGE",    "XREVRANGE"};
+
+static bool IsCoalescable(const char* szCommand, int iLength)
+{
+    // Formatted as *<argc>\r\n$<len>\r\n<name>\r\n...
+    const char* szEnd = szCommand + iLength;
+    const char* szLength = static_cast<const char*>(memchr(szCommand, '$', iLength));
+    if (!szLength)
+        return false;
+
+    char*  szName = NULL;
+    size_t sizeName = strtoul(szLength + 1, &szName, 10);
+    szName += 2;
+    if (szName + sizeName > szEnd)
+        return false;
+
+    for (const char* szCandidate : szCoalescableCommands)
+    {
+        if (strlen(szCandidate) == sizeName && strncasecmp(szCandidate, szName, sizeName) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool IsOverInFlight(const SRedisLimits& limits, const SRedisUsage& usage)
+{
+    return limits.uiMaxInFlight && usage.uiInFlight >= limits.uiMaxInFlight;
+}
+
+static bool IsOverReplyBytes(const SRedisLimits& limits, const SRedisUsage& usage)
+{
+    return limits.ullMaxReplyBytes && usage.ullReplyBytes >= limits.ullMaxReplyBytes;
+}
+
+static bool IsOverLimits(const SRedisLimits& limits, const SRedisUsage& usage)
+{
+    return IsOverInFlight(limits, usage) || IsOverReplyBytes(limits, usage);
+}
+
+static size_t GetReplySize(const redisReply* pReply)
+{
+    // What the reply holds on to, close enough for a limit
+    if (!pReply)
+        return 0;
+
+    size_t sizeReply = sizeof(redisReply) + pReply->len + pReply->elements * sizeof(redisReply*);
+    for (size_t i = 0; i < pReply->elements; i++)
+        sizeReply += GetReplySize(pReply->element[i]);
+    return sizeReply;
+}
+
+static std::string GetReadKey(const CRedisRequest* pRequest)
+{
+    // Lanes don't share reads, an interactive one must not wait behind bulk traffic
+    std::string strKey(1, static_cast<char>('0' + pRequest->eLane));
+    strKey.append(pRequest->szCommand, pRequest->iCommandLength);
+    return strKey;
+}
+
+CRedisManager::CRedisManager()
+{
+    m_pEventLoop = NULL;
+    m_uiNextRequestId = 1;
+    m_uiNextWorkerId = 1;
+    m_uiNextLockId = 1;
+    m_uiNextLeaderboardId = 1;
+    m_uiNextGeoSetId = 1;
+    m_uiBudgetMicroseconds = 0;
+    m_uiBudgetMessages = 0;
+    memset(&m_DispatchStats, 0, sizeof(m_DispatchStats));
+    memset(&m_Limits, 0, sizeof(m_Limits));
+    memset(&m_Usage, 0, sizeof(m_Usage));
+    m_sizeMaxReaderBytes = 0;
+}
+
+CRedisManager::~CRedisManager()
+{
+    // Workers hold connections of their own, wait for them to let go
+    for (auto& pair : m_Workers)
+        pair.second->Stop();
+    for (auto& pair : m_Workers)
+        pair.second->Join();
+    m_Workers.clear();
+    m_BlockingWorkers.clear();
+
+    // Never handed to the loop, their leaders are dropped below
+    for (auto& pair : m_Followers)
+    {
+        for (CRedisRequest* pRequest : pair.second)
+            delete pRequest;
+    }
+    m_Followers.clear();
+    m_InFlightReads.clear();
+
+    // Lua callbacks have to go on this thread, the loop may still hold the locks
+    for (auto& pair : m_Locks)
+        pair.second->Release();
+    m_Locks.clear();
+    m_Leaderboards.clear();
+    m_GeoSets.clear();
+    m_Sequences.clear();
+
+    for (auto& pair : m_StreamBatches)
+    {
+        for (CRedisRequest* pRequest : pair.second.requests)
+            delete pRequest;
+    }
+    m_StreamBatches.clear();
+
+    // Let the loop close every async context first, clients must outlive them
+    for (auto& pair : m_Clients)
+        pair.second->Close();
+    m_Clients.clear();
+
+    if (m_pEventLoop)
+    {
+        m_pEventLoop->Shutdown();
+        delete m_pEventLoop;
+        m_pEventLoop = NULL;
+    }
+
+    // Nobody is left to consume them
+    while (CRedisRequest* pRequest = m_CompletedRequests.Pop())
+        delete pRequest;
+    for (auto& ready : m_ReadyRequests)
+    {
+        for (CRedisRequest* pRequest : ready)
+            delete pRequest;
+        ready.clear();
+    }
+    m_PendingRequests.clear();
+
+    for (CRedisRequest* pRequest : m_FreeRequests)
+        delete pRequest;
+    m_FreeRequests.clear();
+}
+
+CRedisEventLoop* CRedisManager::GetEventLoop()
+{
+    // Only spin up the I/O thread once something actually goes async
+    if (!m_pEventLoop)
+    {
+        m_pEventLoop = new CRedisEventLoop();
+        m_pEventLoop->SetReaderLimit(m_sizeMaxReaderBytes);
+        if (!m_pEventLoop->Startup())
+            pModuleManager->ErrorPrintf("Redis Module: can't start the event loop\n");
+    }
+    return m_pEventLoop;
+}
+
+CRedisClient* CRedisManager::CreateClient(lua_State* luaVM, redisContext* pContext, const std::string& strHost, int iPort)
+{
+    std::shared_ptr<CRedisClient> pClient = std::make_shared<CRedisClient>(luaVM, pContext, strHost, iPort);
+    m_Clients[pClient.get()] = pClient;
+    return pClient.get();
+}
+
+void CRedisManager::DestroyClient(CRedisClient* pClient)
+{
+    auto iter = m_Clients.find(pClient);
+    if (iter == m_Clients.end())
+        return;
+
+    // Whatever was queued for this tick still goes out
+    FlushStreamBatches();
+    FlushLeaderboards(pClient);
+    FlushGeoSets(pClient);
+    for (auto& pair : m_Workers)
+    {
+        if (pair.second->GetOwner() == pClient)
+        {
+            pair.second->Pulse();
+            pair.second->Stop();
+        }
+    }
+    for (auto& pair : m_Locks)
+    {
+        if (pair.second->GetClient() == pClient)
+            pair.second->Release();
+    }
+    for (auto iter = m_Leaderboards.begin(); iter != m_Leaderboards.end();)
+    {
+        if (iter->second->GetClient() == pClient)
+            iter = m_Leaderboards.erase(iter);
+        else
+            ++iter;
+    }
+    for (auto iter = m_GeoSets.begin(); iter != m_GeoSets.end();)
+    {
+        if (iter->second->GetClient() == pClient)
+            iter = m_GeoSets.erase(iter);
+        else
+            ++iter;
+    }
+
+    m_InFlightReads.erase(pClient);
+    m_Sequences.erase(pClient);
+    m_KeepAlive.RemoveClient(pClient);
+    iter->second->Close();
+    m_Clients.erase(iter);
+}
+
+bool CRedisManager::IsValidClient(CRedisClient* pClient) const
+{
+    return m_Clients.find(pClient) != m_Clients.end();
+}
+
+template <>
+CRedisClient* UserDataCast<CRedisClient>(CRedisClient*, void* ptr, lua_State*)
+{
+    CRedisClient* pClient = reinterpret_cast<CRedisClient*>(ptr);
+    if (pRedisManager && pRedisManager->IsValidClient(pClient))
+        return pClient;
+    return NULL;
+}
+
+CRedisRequest* CRedisManager::AcquireRequest()
+{
+    if (m_FreeRequests.empty())
+        return new CRedisRequest();
+
+    CRedisRequest* pRequest = m_FreeRequests.back();
+    m_FreeRequests.pop_back();
+    return pRequest;
+}
+
+void CRedisManager::ReleaseRequest(CRedisRequest* pRequest)
+{
+    if (m_FreeRequests.size() >= MAX_FREE_REQUESTS)
+    {
+        delete pRequest;
+        return;
+    }
+
+    pRequest->Reset();
+    m_FreeRequests.push_back(pRequest);
+}
+
+unsigned int CRedisManager::Send(CRedisClient* pClient, CRedisRequest* pRequest)
+{
+    if (!Admit(pClient))
+        return 0;
+    Track(pClient, pRequest);
+
+    // An identical read already in flight answers this one too. Anything
+    // else may change what a read returns, so reads sent after it start
+    // over to keep the order of the connection.
+    if (!pRequest->callback.IsValid() || !IsCoalescable(pRequest->szCommand, pRequest->iCommandLength))
+        m_InFlightReads.erase(pClient);
+    else
+    {
+        // The same goes for commands sent around Send(), see NoteCommand()
+        unsigned int uiEpoch = pClient->GetCommandEpoch();
+        auto         inserted = m_InFlightReads[pClient].emplace(GetReadKey(pRequest), SInFlightRead{pRequest->uiId, uiEpoch});
+        if (!inserted.second && inserted.first->second.uiEpoch == uiEpoch)
+        {
+            m_Followers[inserted.first->second.uiId].push_back(pRequest);
+            m_DispatchStats.ullCoalesced++;
+            return pRequest->uiId;
+        }
+        inserted.first->second = SInFlightRead{pRequest->uiId, uiEpoch};
+        m_Followers[pRequest->uiId];            // marks it as a leader for FanOut
+    }
+
+    pClient->Send(pRequest);
+    return pRequest->uiId;
+}
+
+void CRedisManager::SendBatch(CRedisClient* pClient, std::vector<CRedisRequest*>&& requests)
+{
+    if (requests.empty())
+        return;
+
+    m_InFlightReads.erase(pClient);
+
+    for (CRedisRequest* pRequest : requests)
+        Track(pClient, pRequest);
+    pClient->SendBatch(std::move(requests));
+}
+
+void CRedisManager::Track(CRedisClient* pClient, CRedisRequest* pRequest)
+{
+    if (m_uiNextRequestId == 0)
+        m_uiNextRequestId = 1;
+
+    pRequest->uiId = m_uiNextRequestId++;
+    pRequest->pClient = m_Clients[pClient];
+    m_PendingRequests[pRequest->uiId] = pRequest;
+
+    pRequest->bCounted = true;
+    pClient->GetUsage().uiInFlight++;
+    m_Usage.uiInFlight++;
+    if (pRequest->ePriority == PRIORITY_BULK || pRequest->eLane == LANE_BULK)
+        m_BulkOrder.push_back(pRequest->uiId);
+
+    if (pRequest->deadline != std::chrono::steady_clock::time_point())
+    {
+        m_Deadlines.emplace_back(pRequest->deadline, pRequest->uiId);
+        std::push_heap(m_Deadlines.begin(), m_Deadlines.end(), std::greater<>());
+    }
+}
+
+bool CRedisManager::QueueStreamEntry(CRedisClient* pClient, CRedisRequest* pRequest, const std::string& strStream, unsigned int uiMaxLen)
+{
+    if (!Admit(pClient))
+        return false;
+
+    SStreamBatch& batch = m_StreamBatches[pClient];
+    batch.requests.push_back(pRequest);
+    if (uiMaxLen)
+        batch.trims[strStream] = uiMaxLen;
+    return true;
+}
+
+void CRedisManager::FlushStreamBatches()
+{
+    for (auto& pair : m_StreamBatches)
+    {
+        CRedisClient* pClient = pair.first;
+        SStreamBatch& batch = pair.second;
+
+        // Trim once per stream and pulse instead of on every XADD, "~" lets
+        // the server cut whole macro nodes only
+        for (const auto& trim : batch.trims)
+        {
+            std::string strMaxLen = std::to_string(trim.second);
+            const char* argv[] = {"XTRIM", trim.first.c_str(), "MAXLEN", "~", strMaxLen.c_str()};
+            size_t      argvlen[] = {5, trim.first.length(), 6, 1, strMaxLen.length()};
+
+            CRedisRequest* pRequest = AcquireRequest();
+            if (pRequest->SetCommand(5, argv, argvlen))
+                batch.requests.push_back(pRequest);
+            else
+                ReleaseRequest(pRequest);
+        }
+
+        SendBatch(pClient, std::move(batch.requests));
+    }
+    m_StreamBatches.clear();
+}
+
+unsigned int CRedisManager::SendBlocking(CRedisClient* pClient, CRedisRequest* pRequest)
+{
+    if (!Admit(pClient))
+        return 0;
+
+    // One blocking connection per client, started with the first command
+    std::shared_ptr<CRedisBlockingWorker>& pWorker = m_BlockingWorkers[pClient];
+    if (!pWorker || pWorker->IsStopping())
+    {
+        pWorker = std::make_shared<CRedisBlockingWorker>(pClient->GetLuaVM(), pClient);
+        if (!AddWorker(pWorker))
+        {
+            m_BlockingWorkers.erase(pClient);
+            return 0;
+        }
+    }
+
+    Track(pClient, pRequest);
+    pWorker->Queue(pRequest);
+    return pRequest->uiId;
+}
+
+unsigned int CRedisManager::AddWorker(const std::shared_ptr<CRedisWorker>& pWorker)
+{
+    if (m_uiNextWorkerId == 0)
+        m_uiNextWorkerId = 1;
+
+    pWorker->SetId(m_uiNextWorkerId++);
+    if (!pWorker->Startup())
+        return 0;
+
+    m_Workers[pWorker->GetId()] = pWorker;
+    return pWorker->GetId();
+}
+
+std::shared_ptr<CRedisWorker> CRedisManager::GetWorker(lua_State* luaVM, unsigned int uiId) const
+{
+    // Ids are sequential, resources only see their own workers
+    auto iter = m_Workers.find(uiId);
+    if (iter == m_Workers.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return NULL;
+    return iter->second;
+}
+
+bool CRedisManager::StopWorker(lua_State* luaVM, unsigned int uiId)
+{
+    auto iter = m_Workers.find(uiId);
+    if (iter == m_Workers.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM) || iter->second->IsStopping())
+        return false;
+
+    iter->second->Stop();
+    return true;
+}
+
+bool CRedisManager::Cancel(lua_State* luaVM, unsigned int uiId)
+{
+    // Ids are sequential, don't let a resource cancel another one's requests
+    auto iter = m_PendingRequests.find(uiId);
+    if (iter == m_PendingRequests.end() || iter->second->bCancelled || iter->second->luaVM != CLuaFunctionRef::GetMainState(luaVM))
+        return false;
+
+    // Still owned by the loop, the reply is dropped once it arrives
+    iter->second->bCancelled = true;
+    iter->second->callback.Release();
+    return true;
+}
+
+void CRedisManager::NudgeSchedulePollers(const std::string& strQueue, long long llDueMs)
+{
+    for (auto& pair : m_Workers)
+    {
+        CRedisSchedulePoller* pPoller = dynamic_cast<CRedisSchedulePoller*>(pair.second.get());
+        if (pPoller && pPoller->GetQueue() == strQueue)
+            pPoller->Nudge(llDueMs);
+    }
+}
+
+void CRedisManager::ReapWorkers()
+{
+    for (auto iter = m_Workers.begin(); iter != m_Workers.end();)
+    {
+        if (iter->second->IsFinished())
+        {
+            auto blocking = m_BlockingWorkers.find(iter->second->GetOwner());
+            if (blocking != m_BlockingWorkers.end() && blocking->second == iter->second)
+                m_BlockingWorkers.erase(blocking);
+
+            iter->second->Join();
+            iter = m_Workers.erase(iter);
+        }
+        else
+            ++iter;
+    }
+}
+
+unsigned int CRedisManager::CreateLock(lua_State* luaVM, CRedisClient* pClient, const std::string& strName, unsigned int uiTtlMs, unsigned int uiWaitMs,
+                                       unsigned int uiRetryMs, CLuaFunctionRef&& callback)
+{
+    auto iter = m_Clients.find(pClient);
+    if (iter == m_Clients.end() || !GetEventLoop())
+        return 0;
+
+    std::shared_ptr<CRedisLock> pLock = std::make_shared<CRedisLock>(luaVM, iter->second, strName, uiTtlMs, uiWaitMs, uiRetryMs, std::move(callback));
+    pLock->SetId(m_uiNextLockId++);
+    m_Locks[pLock->GetId()] = pLock;
+    pLock->Acquire();
+    return pLock->GetId();
+}
+
+bool CRedisManager::ReleaseLock(lua_State* luaVM, unsigned int uiId)
+{
+    // Only the resource that took the lock may give it up
+    auto iter = m_Locks.find(uiId);
+    if (iter == m_Locks.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return false;
+
+    return iter->second->Release();
+}
+
+bool CRedisManager::IsLockHeld(lua_State* luaVM, unsigned int uiId) const
+{
+    auto iter = m_Locks.find(uiId);
+    return iter != m_Locks.end() && iter->second->GetLuaVM() == CLuaFunctionRef::GetMainState(luaVM) && iter->second->IsHeld();
+}
+
+void CRedisManager::DefineSchema(lua_State* luaVM, const std::string& strName, const std::shared_ptr<CRedisSchema>& pSchema)
+{
+    // Loads still in flight keep the schema they were sent with
+    m_Schemas[CLuaFunctionRef::GetMainState(luaVM)][strName] = pSchema;
+}
+
+std::shared_ptr<CRedisSchema> CRedisManager::GetSchema(lua_State* luaVM, const std::string& strName) const
+{
+    auto iter = m_Schemas.find(CLuaFunctionRef::GetMainState(luaVM));
+    if (iter == m_Schemas.end())
+        return NULL;
+
+    auto schema = iter->second.find(strName);
+    return schema != iter->second.end() ? schema->second : NULL;
+}
+
+unsigned int CRedisManager::CreateLeaderboard(lua_State* luaVM, CRedisClient* pClient, const std::string& strKey, unsigned int uiCacheMs)
+{
+    auto pLeaderboard = std::make_unique<CRedisLeaderboard>(luaVM, m_Clients[pClient], strKey, uiCacheMs);
+    pLeaderboard->SetId(m_uiNextLeaderboardId++);
+
+    unsigned int uiId = pLeaderboard->GetId();
+    m_Leaderboards[uiId] = std::move(pLeaderboard);
+    return uiId;
+}
+
+CRedisLeaderboard* CRedisManager::GetLeaderboard(lua_State* luaVM, unsigned int uiId) const
+{
+    // Ids are sequential, resources only see their own leaderboards
+    auto iter = m_Leaderboards.find(uiId);
+    if (iter == m_Leaderboards.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return NULL;
+    return iter->second.get();
+}
+
+bool CRedisManager::DestroyLeaderboard(lua_State* luaVM, unsigned int uiId)
+{
+    auto iter = m_Leaderboards.find(uiId);
+    if (iter == m_Leaderboards.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return false;
+
+    iter->second->Flush();
+    m_Leaderboards.erase(iter);
+    return true;
+}
+
+void CRedisManager::FlushLeaderboards(CRedisClient* pScope)
+{
+    for (auto& pair : m_Leaderboards)
+    {
+        if (!pScope || pair.second->GetClient() == pScope)
+            pair.second->Flush();
+    }
+}
+
+unsigned int CRedisManager::CreateGeoSet(lua_State* luaVM, CRedisClient* pClient, const std::string& strKey, const SGeoTransform& transform,
+                                         double dThreshold)
+{
+    auto pGeoSet = std::make_shared<CRedisGeoSet>(luaVM, m_Clients[pClient], strKey, transform, dThreshold);
+    pGeoSet->SetId(m_uiNextGeoSetId++);
+    m_GeoSets[pGeoSet->GetId()] = pGeoSet;
+    return pGeoSet->GetId();
+}
+
+std::shared_ptr<CRedisGeoSet> CRedisManager::GetGeoSet(lua_State* luaVM, unsigned int uiId) const
+{
+    // Ids are sequential, resources only see their own geo sets
+    auto iter = m_GeoSets.find(uiId);
+    if (iter == m_GeoSets.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return NULL;
+    return iter->second;
+}
+
+bool CRedisManager::DestroyGeoSet(lua_State* luaVM, unsigned int uiId)
+{
+    auto iter = m_GeoSets.find(uiId);
+    if (iter == m_GeoSets.end() || iter->second->GetLuaVM() != CLuaFunctionRef::GetMainState(luaVM))
+        return false;
+
+    // Searches in flight keep their own reference
+    iter->second->Flush();
+    m_GeoSets.erase(iter);
+    return true;
+}
+
+void CRedisManager::FlushGeoSets(CRedisClient* pScope)
+{
+    for (auto& pair : m_GeoSets)
+    {
+        if (!pScope || pair.second->GetClient() == pScope)
+            pair.second->Flush();
+    }
+}
+
+std::shared_ptr<CRedisSequence> CRedisManager::GetSequence(CRedisClient* pClient, const std::string& strKey)
+{
+    // Created on first use, reserved blocks are per client
+    std::shared_ptr<CRedisSequence>& pSequence = m_Sequences[pClient][strKey];
+    if (!pSequence)
+        pSequence = std::make_shared<CRedisSequence>(m_Clients[pClient], strKey);
+    return pSequence;
+}
+
+void CRedisManager::ReapLocks()
+{
+    // Renewal timers and replies in flight keep their own reference
+    for (auto iter = m_Locks.begin(); iter != m_Locks.end();)
+    {
+        if (iter->second->IsFinished())
+            iter = m_Locks.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+bool CRedisManager::IsCancelled(const CRedisRequest* pRequest) const
+{
+    return pRequest->bCancelled || (pRequest->pHandler && pRequest->pHandler->IsCancelled());
+}
+
+void CRedisManager::FanOut(CRedisRequest* pRequest)
+{
+    auto iter = m_Followers.find(pRequest->uiId);
+    if (iter == m_Followers.end())
+        return;
+
+    // Later reads go out on their own again
+    auto reads = m_InFlightReads.find(pRequest->pClient.get());
+    if (reads != m_InFlightReads.end())
+    {
+        auto read = reads->second.find(GetReadKey(pRequest));
+        if (read != reads->second.end() && read->second.uiId == pRequest->uiId)
+            reads->second.erase(read);
+    }
+
+    for (CRedisRequest* pFollower : iter->second)
+    {
+        Uncount(pFollower);
+        if (IsCancelled(pFollower))
+        {
+            m_PendingRequests.erase(pFollower->uiId);
+            ReleaseRequest(pFollower);
+            continue;
+        }
+        // Answered now, a deferred dispatch must not expire it
+        pFollower->CopyResult(pRequest);
+        pFollower->deadline = std::chrono::steady_clock::time_point();
+        MakeReady(pFollower);
+    }
+    m_Followers.erase(iter);
+}
+
+void CRedisManager::ExpireRequests()
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!m_Deadlines.empty() && m_Deadlines.front().first <= now)
+    {
+        std::pop_heap(m_Deadlines.begin(), m_Deadlines.end(), std::greater<>());
+        unsigned int uiId = m_Deadlines.back().second;
+        m_Deadlines.pop_back();
+
+        // Answered, cancelled or expired already, or the id got reused
+        auto iter = m_PendingRequests.find(uiId);
+        if (iter == m_PendingRequests.end())
+            continue;
+        CRedisRequest* pRequest = iter->second;
+        if (pRequest->bCancelled || pRequest->deadline == std::chrono::steady_clock::time_point() || pRequest->deadline > now)
+            continue;
+
+        // The request stays with the loop until the late reply, which is dropped
+        Abandon(pRequest, "Timeout");
+        m_DispatchStats.ullTimedOut++;
+    }
+}
+
+void CRedisManager::Abandon(CRedisRequest* pRequest, const char* szReason)
+{
+    lua_State* luaVM = pRequest->callback.GetLuaVM();
+    if (luaVM)
+    {
+        int iTop = lua_gettop(luaVM);
+        if (pRequest->callback.Push())
+        {
+            lua_pushboolean(luaVM, 0);
+            lua_pushstring(luaVM, szReason);
+            CLuaFunctionRef::Call(luaVM, 2);
+        }
+        lua_settop(luaVM, iTop);
+    }
+    pRequest->callback.Release();
+    pRequest->bCancelled = true;
+}
+
+void CRedisManager::Drain()
+{
+    while (CRedisRequest* pRequest = m_CompletedRequests.Pop())
+    {
+        if (pRequest->pClient)
+            pRequest->pClient->OnCompleted(pRequest);
+        Uncount(pRequest);
+
+        if (IsCancelled(pRequest))
+        {
+            FanOut(pRequest);
+            m_PendingRequests.erase(pRequest->uiId);
+            Restore(pRequest);
+            ReleaseRequest(pRequest);
+            continue;
+        }
+        pRequest->deadline = std::chrono::steady_clock::time_point();
+        MakeReady(pRequest);
+        FanOut(pRequest);
+    }
+
+    while (!m_BulkOrder.empty())
+    {
+        auto iter = m_PendingRequests.find(m_BulkOrder.front());
+        if (iter != m_PendingRequests.end() && iter->second->bCounted && !iter->second->bCancelled)
+            break;
+        m_BulkOrder.pop_front();
+    }
+}
+
+void CRedisManager::Restore(CRedisRequest* pRequest)
+{
+    // A blocking pop that got cancelled or timed out after the server handed
+    // it an element. Pushed back where it came from so it isn't lost, on the
+    // client's normal connection since the blocking one may be busy again.
+    redisReply* pReply = pRequest->pReply;
+    if (pRequest->eRestore == RESTORE_NONE || !pReply || pReply->type != REDIS_REPLY_ARRAY || pReply->elements != 2 ||
+        pReply->element[0]->type != REDIS_REPLY_STRING || pReply->element[1]->type != REDIS_REPLY_STRING)
+        return;
+
+    // Destroyed clients took their blocking connection down with them
+    CRedisClient* pClient = pRequest->pClient.get();
+    if (!IsValidClient(pClient))
+        return;
+
+    const char* szCommand = pRequest->eRestore == RESTORE_HEAD ? "LPUSH" : "RPUSH";
+    const char* argv[] = {szCommand, pReply->element[0]->str, pReply->element[1]->str};
+    size_t      argvlen[] = {5, pReply->element[0]->len, pReply->element[1]->len};
+
+    CRedisRequest* pRestore = AcquireRequest();
+    if (!pRestore->SetCommand(3, argv, argvlen))
+    {
+        ReleaseRequest(pRestore);
+        return;
+    }
+    SendBatch(pClient, {pRestore});
+}
+
+void CRedisManager::MakeReady(CRedisRequest* pRequest)
+{
+    pRequest->sizeReplyBytes = GetReplySize(pRequest->pReply);
+    m_Usage.ullReplyBytes += pRequest->sizeReplyBytes;
+    if (pRequest->pClient)
+        pRequest->pClient->GetUsage().ullReplyBytes += pRequest->sizeReplyBytes;
+    m_ReadyRequests[pRequest->ePriority].push_back(pRequest);
+}
+
+void CRedisManager::Uncount(CRedisRequest* pRequest)
+{
+    if (!pRequest->bCounted)
+        return;
+
+    pRequest->bCounted = false;
+    pRequest->pClient->GetUsage().uiInFlight--;
+    m_Usage.uiInFlight--;
+}
+
+void CRedisManager::SetLimits(const SRedisLimits& limits, size_t sizeMaxReaderBytes)
+{
+    m_Limits = limits;
+    m_sizeMaxReaderBytes = sizeMaxReaderBytes;
+    if (m_pEventLoop)
+        m_pEventLoop->SetReaderLimit(sizeMaxReaderBytes);
+}
+
+bool CRedisManager::Admit(CRedisClient* pClient)
+{
+    if (!IsOverLimits(pClient->GetLimits(), pClient->GetUsage()) && !IsOverLimits(m_Limits, m_Usage))
+        return true;
+
+    // The client's own limit decides first, dropping only its own requests
+    bool                bClientLimit = IsOverLimits(pClient->GetLimits(), pClient->GetUsage());
+    const SRedisLimits& limits = bClientLimit ? pClient->GetLimits() : m_Limits;
+    auto                IsOver = [&]() { return IsOverLimits(pClient->GetLimits(), pClient->GetUsage()) || IsOverLimits(m_Limits, m_Usage); };
+
+    if (limits.ePolicy == LIMIT_DROP_OLDEST_BULK)
+    {
+        while (IsOver() && DropOldestBulk(bClientLimit ? pClient : NULL))
+            m_DispatchStats.ullDropped++;
+    }
+    else if (limits.ePolicy == LIMIT_BLOCK && limits.uiBlockMs && !IsOverReplyBytes(pClient->GetLimits(), pClient->GetUsage()) &&
+             !IsOverReplyBytes(m_Limits, m_Usage))
+    {
+        // Only replies arriving can make room here, callbacks run with the
+        // next pulse. Waiting is no use against the reply bytes then, those
+        // are only freed by dispatching.
+        m_DispatchStats.ullBlocked++;
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min(limits.uiBlockMs, (unsigned int)LIMIT_BLOCK_MAX_MS));
+        while (IsOver() && std::chrono::steady_clock::now() < until)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(LIMIT_BLOCK_POLL_US));
+            Drain();
+        }
+    }
+
+    if (!IsOver())
+        return true;
+
+    m_DispatchStats.ullRejected++;
+    return false;
+}
+
+bool CRedisManager::DropOldestBulk(CRedisClient* pScope)
+{
+    // Called from inside a script function, so nothing is dispatched here.
+    // A dropped request fails with the next pulse, through its handler if
+    // it has one.
+
+    // Answered ones first, giving those up frees their reply right away
+    for (CRedisRequest* pRequest : m_ReadyRequests[PRIORITY_BULK])
+    {
+        if (!pRequest->sizeReplyBytes || (pScope && pRequest->pClient.get() != pScope))
+            continue;
+
+        m_Usage.ullReplyBytes -= pRequest->sizeReplyBytes;
+        if (pRequest->pClient)
+            pRequest->pClient->GetUsage().ullReplyBytes -= pRequest->sizeReplyBytes;
+        pRequest->sizeReplyBytes = 0;
+        freeReplyObject(pRequest->pReply);
+        pRequest->pReply = NULL;
+        pRequest->SetError("Dropped");
+        return true;
+    }
+
+    // Then the oldest one auto batching still holds back, what is on the
+    // wire can't be taken back anymore
+    for (unsigned int uiId : m_BulkOrder)
+    {
+        auto iter = m_PendingRequests.find(uiId);
+        if (iter == m_PendingRequests.end() || !iter->second->bCounted || iter->second->bCancelled)
+            continue;
+
+        CRedisRequest* pRequest = iter->second;
+        if ((pScope && pRequest->pClient.get() != pScope) || !pRequest->pClient->Unqueue(pRequest))
+            continue;
+
+        Uncount(pRequest);
+        pRequest->SetError("Dropped");
+        pRequest->deadline = std::chrono::steady_clock::time_point();
+        MakeReady(pRequest);
+        FanOut(pRequest);
+        return true;
+    }
+    return false;
+}
+
+void CRedisManager::Complete(CRedisRequest* pRequest)
+{
+    m_CompletedRequests.Push(pRequest);
+}
+
+void CRedisManager::DoPulse()
+{
+    // Sort everything that is ready by priority, the queue itself is cheap
+    // to drain, running the callbacks is what costs frame time
+    FlushStreamBatches();
+    FlushLeaderboards();
+    FlushGeoSets();
+    m_KeepAlive.Pulse();
+    for (auto& pair : m_Clients)
+        pair.second->Flush();
+
+    size_t sizeBacklog = 0;
+    Drain();
+    ExpireRequests();
+
+    for (const auto& ready : m_ReadyRequests)
+        sizeBacklog += ready.size();
+    m_DispatchStats.sizeMaxBacklog = std::max(m_DispatchStats.sizeMaxBacklog, sizeBacklog);
+
+    auto         start = std::chrono::steady_clock::now();
+    unsigned int uiMessages = 0;
+    bool         bOutOfBudget = false;
+
+    for (int i = 0; i < PRIORITY_MAX && !bOutOfBudget; i++)
+    {
+        std::deque<CRedisRequest*>& ready = m_ReadyRequests[i];
+        while (!ready.empty())
+        {
+            if ((m_uiBudgetMessages && uiMessages >= m_uiBudgetMessages) ||
+                (m_uiBudgetMicroseconds &&
+                 std::chrono::steady_clock::now() - start >= std::chrono::microseconds(m_uiBudgetMicroseconds)))
+            {
+                bOutOfBudget = true;
+                break;
+            }
+
+            CRedisRequest* pRequest = ready.front();
+            ready.pop_front();
+            m_PendingRequests.erase(pRequest->uiId);
+            m_Usage.ullReplyBytes -= pRequest->sizeReplyBytes;
+            if (pRequest->pClient)
+                pRequest->pClient->GetUsage().ullReplyBytes -= pRequest->sizeReplyBytes;
+
+            // May have been cancelled while it was waiting for budget
+            if (!IsCancelled(pRequest))
+            {
+                Dispatch(pRequest);
+                m_DispatchStats.ullDispatched[i]++;
+                uiMessages++;
+            }
+            else
+                Restore(pRequest);
+
+            ReleaseRequest(pRequest);
+        }
+    }
+
+    if (bOutOfBudget)
+    {
+        // Count every request once, the ones left over from earlier pulses
+        // are at the front of their queue
+        m_DispatchStats.ullDeferredPulses++;
+        for (int i = 0; i < PRIORITY_MAX; i++)
+        {
+            for (auto iter = m_ReadyRequests[i].rbegin(); iter != m_ReadyRequests[i].rend() && !(*iter)->bDeferred; ++iter)
+            {
+                (*iter)->bDeferred = true;
+                m_DispatchStats.ullDeferred[i]++;
+            }
+        }
+    }
+
+    for (auto& pair : m_Workers)
+        pair.second->Pulse();
+    ReapWorkers();
+    ReapLocks();
+}
+
+void CRedisManager::SetDispatchBudget(unsigned int uiMaxMicroseconds, unsigned int uiMaxMessages)
+{
+    m_uiBudgetMicroseconds = uiMaxMicroseconds;
+    m_uiBudgetMessages = uiMaxMessages;
+}
+
+void CRedisManager::ResourceStopping(lua_State* luaVM)
+{
+    // Replies arriving after this point must not touch the dying lua state
+    for (auto& pair : m_PendingRequests)
+    {
+        if (pair.second->luaVM == luaVM)
+        {
+            pair.second->bCancelled = true;
+            pair.second->callback.Release();
+            pair.second->pHandler.reset();
+        }
+    }
+
+    for (auto& pair : m_Workers)
+    {
+        if (pair.second->GetLuaVM() == luaVM)
+        {
+            pair.second->Pulse();
+            pair.second->Stop();
+        }
+    }
+
+    for (auto& pair : m_Locks)
+    {
+        if (pair.second->GetLuaVM() == luaVM)
+            pair.second->Release();
+    }
+}
+
+void CRedisManager::ResourceStopped(lua_State* luaVM)
+{
+    FlushStreamBatches();
+    m_Schemas.erase(luaVM);
+
+    for (auto iter = m_Leaderboards.begin(); iter != m_Leaderboards.end();)
+    {
+        if (iter->second->GetLuaVM() == luaVM)
+        {
+            iter->second->Flush();
+            iter = m_Leaderboards.erase(iter);
+        }
+        else
+            ++iter;
+    }
+    for (auto iter = m_GeoSets.begin(); iter != m_GeoSets.end();)
+    {
+        if (iter->second->GetLuaVM() == luaVM)
+        {
+            iter->second->Flush();
+            iter = m_GeoSets.erase(iter);
+        }
+        else
+            ++iter;
+    }
+
+    for (auto iter = m_Clients.begin(); iter != m_Clients.end();)
+    {
+        if (iter->second->GetLuaVM() == luaVM)
+        {
+            m_InFlightReads.erase(iter->first);
+            m_Sequences.erase(iter->first);
+            m_KeepAlive.RemoveClient(iter->first);
+            iter->second->Close();
+            iter = m_Clients.erase(iter);
+        }
+        else
+            ++iter;
+    }
+}
+
+void CRedisManager::Dispatch(CRedisRequest* pRequest)
+{
+    if (pRequest->pHandler)
+    {
+        pRequest->pHandler->Dispatch(pRequest);
+        return;
+    }
+
+    lua_State* luaVM = pRequest->callback.GetLuaVM();
+    if (!luaVM)
+    {
+        // Fire and forget, nobody else would hear about a failure
+        if (!pRequest->pReply || pRequest->pReply->type == REDIS_REPLY_ERROR)
+            pModuleManager->ErrorPrintf("Redis Module: %s\n", pRequest->pReply ? pRequest->pReply->str : pRequest->strError.c_str());
+        return;
+    }
+
+    int iTop = lua_gettop(luaVM);
+    if (pRequest->callback.Push())
+    {
+        int iArguments = CLuaReply::PushResult(luaVM, pRequest->pReply, pRequest->strError.c_str(), pRequest->uiReplyFlags);
+        CLuaFunctionRef::Call(luaVM, iArguments);
+    }
+    lua_settop(luaVM, iTop);
+
+    pRequest->callback.Release();
+}
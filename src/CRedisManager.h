@@ -0,0 +1,191 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisManager;
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+#include "include/ILuaModuleManager.h"
+#include "CCompletionQueue.h"
+#include "CRedisEventLoop.h"
+#include "CRedisClient.h"
+#include "CRedisRequest.h"
+#include "CRedisWorker.h"
+#include "CRedisBlockingWorker.h"
+#include "CRedisGeoSet.h"
+#include "CRedisKeepAlive.h"
+#include "CRedisLeaderboard.h"
+#include "CRedisLock.h"
+#include "CRedisSchema.h"
+#include "CRedisSequence.h"
+
+struct SInFlightRead
+{
+    unsigned int uiId;
+    unsigned int uiEpoch;            // CRedisClient::GetCommandEpoch() when it was sent
+};
+
+struct SDispatchStats
+{
+    unsigned long long ullDispatched[PRIORITY_MAX];
+    unsigned long long ullDeferred[PRIORITY_MAX];            // completions that had to wait for a later pulse
+    unsigned long long ullDeferredPulses;                    // pulses that ran out of budget
+    size_t             sizeMaxBacklog;
+    unsigned long long ullCoalesced;            // reads answered by an identical one already in flight
+    unsigned long long ullTimedOut;
+    unsigned long long ullRejected;             // refused by the limits
+    unsigned long long ullDropped;              // bulk requests given up for newer ones
+    unsigned long long ullBlocked;              // commands that had to wait for room
+};
+
+// Fire-and-forget stream entries of one client, flushed once per pulse
+struct SStreamBatch
+{
+    std::vector<CRedisRequest*>         requests;
+    std::map<std::string, unsigned int> trims;            // stream -> approximate MAXLEN
+};
+
+//
+// Owns the clients, the event loop and every async request in flight.
+// Completed requests are handed back to the main thread and dispatched
+// to their scripts from DoPulse().
+//
+class CRedisManager
+{
+public:
+    CRedisManager();
+    ~CRedisManager();
+
+    CRedisEventLoop* GetEventLoop();
+    CRedisKeepAlive& GetKeepAlive() { return m_KeepAlive; };
+
+    CRedisClient* CreateClient(lua_State* luaVM, redisContext* pContext, const std::string& strHost, int iPort);
+    void          DestroyClient(CRedisClient* pClient);
+    bool          IsValidClient(CRedisClient* pClient) const;
+
+    // Main thread
+    CRedisRequest* AcquireRequest();
+    void           ReleaseRequest(CRedisRequest* pRequest);
+    unsigned int   Send(CRedisClient* pClient, CRedisRequest* pRequest);
+    bool           QueueStreamEntry(CRedisClient* pClient, CRedisRequest* pRequest, const std::string& strStream, unsigned int uiMaxLen);
+    void           SendBatch(CRedisClient* pClient, std::vector<CRedisRequest*>&& requests);            // not admitted, see below
+    unsigned int   SendBlocking(CRedisClient* pClient, CRedisRequest* pRequest);
+    unsigned int   AddWorker(const std::shared_ptr<CRedisWorker>& pWorker);
+    std::shared_ptr<CRedisWorker> GetWorker(lua_State* luaVM, unsigned int uiId) const;
+    bool           StopWorker(lua_State* luaVM, unsigned int uiId);
+    bool           Cancel(lua_State* luaVM, unsigned int uiId);
+    void           NudgeSchedulePollers(const std::string& strQueue, long long llDueMs);
+    unsigned int   CreateLock(lua_State* luaVM, CRedisClient* pClient, const std::string& strName, unsigned int uiTtlMs, unsigned int uiWaitMs,
+                              unsigned int uiRetryMs, CLuaFunctionRef&& callback);
+    bool           ReleaseLock(lua_State* luaVM, unsigned int uiId);
+    bool           IsLockHeld(lua_State* luaVM, unsigned int uiId) const;
+    void           DefineSchema(lua_State* luaVM, const std::string& strName, const std::shared_ptr<CRedisSchema>& pSchema);
+    std::shared_ptr<CRedisSchema> GetSchema(lua_State* luaVM, const std::string& strName) const;
+    unsigned int       CreateLeaderboard(lua_State* luaVM, CRedisClient* pClient, const std::string& strKey, unsigned int uiCacheMs);
+    CRedisLeaderboard* GetLeaderboard(lua_State* luaVM, unsigned int uiId) const;
+    bool               DestroyLeaderboard(lua_State* luaVM, unsigned int uiId);
+    unsigned int       CreateGeoSet(lua_State* luaVM, CRedisClient* pClient, const std::string& strKey, const SGeoTransform& transform, double dThreshold);
+    std::shared_ptr<CRedisGeoSet> GetGeoSet(lua_State* luaVM, unsigned int uiId) const;
+    bool                          DestroyGeoSet(lua_State* luaVM, unsigned int uiId);
+    std::shared_ptr<CRedisSequence> GetSequence(CRedisClient* pClient, const std::string& strKey);
+    void         DoPulse();
+    void         SetDispatchBudget(unsigned int uiMaxMicroseconds, unsigned int uiMaxMessages);
+    size_t       GetBacklog(eRequestPriority ePriority) const { return m_ReadyRequests[ePriority].size(); };
+
+    const SDispatchStats& GetDispatchStats() const { return m_DispatchStats; };
+    const SRedisUsage&    GetUsage() const { return m_Usage; };
+    const SRedisLimits&   GetLimits() const { return m_Limits; };
+    void                  SetLimits(const SRedisLimits& limits, size_t sizeMaxReaderBytes);
+    void         ResourceStopping(lua_State* luaVM);
+    void         ResourceStopped(lua_State* luaVM);
+
+    // Any thread
+    void Complete(CRedisRequest* pRequest);
+
+private:
+    void Dispatch(CRedisRequest* pRequest);
+    void Track(CRedisClient* pClient, CRedisRequest* pRequest);
+    void FlushStreamBatches();
+    void FlushLeaderboards(CRedisClient* pScope = NULL);
+    void FlushGeoSets(CRedisClient* pScope = NULL);
+    void ReapWorkers();
+    void ReapLocks();
+    void FanOut(CRedisRequest* pRequest);
+    void ExpireRequests();
+    void Drain();
+    void MakeReady(CRedisRequest* pRequest);
+    void Uncount(CRedisRequest* pRequest);
+    void Abandon(CRedisRequest* pRequest, const char* szReason);
+    void Restore(CRedisRequest* pRequest);
+    // Applies the limits to Send, QueueStreamEntry and SendBlocking. SendBatch
+    // is exempt, it only carries follow-up traffic of work admitted already
+    // (stream flushes, acks, keepalive pings, buffered writes) that would be
+    // lost otherwise. The sync functions don't take part either.
+    bool Admit(CRedisClient* pClient);
+    bool DropOldestBulk(CRedisClient* pScope);
+    bool IsCancelled(const CRedisRequest* pRequest) const;
+
+    CRedisEventLoop*                                       m_pEventLoop;
+    std::map<CRedisClient*, std::shared_ptr<CRedisClient>> m_Clients;
+    std::unordered_map<unsigned int, CRedisRequest*>       m_PendingRequests;
+    std::vector<std::pair<std::chrono::steady_clock::time_point, unsigned int>> m_Deadlines;            // min heap of request ids
+    std::deque<unsigned int>                                                    m_BulkOrder;            // bulk request ids, oldest first, may be stale
+    SRedisLimits                                                                m_Limits;
+    SRedisUsage                                                                 m_Usage;
+    size_t                                                                      m_sizeMaxReaderBytes;
+    unsigned int                                           m_uiNextRequestId;
+    std::map<CRedisClient*, SStreamBatch>                  m_StreamBatches;
+
+    // Identical reads in flight: formatted command -> leading request,
+    // and the requests waiting on each leader for a copy of its reply
+    std::map<CRedisClient*, std::unordered_map<std::string, SInFlightRead>> m_InFlightReads;
+    std::unordered_map<unsigned int, std::vector<CRedisRequest*>>           m_Followers;
+
+    std::map<unsigned int, std::shared_ptr<CRedisWorker>>          m_Workers;
+    std::map<CRedisClient*, std::shared_ptr<CRedisBlockingWorker>> m_BlockingWorkers;
+    unsigned int                                                   m_uiNextWorkerId;
+    std::map<unsigned int, std::shared_ptr<CRedisLock>>            m_Locks;
+    unsigned int                                                   m_uiNextLockId;
+    std::map<lua_State*, std::map<std::string, std::shared_ptr<CRedisSchema>>> m_Schemas;
+    std::map<unsigned int, std::unique_ptr<CRedisLeaderboard>>                  m_Leaderboards;
+    unsigned int                                                                m_uiNextLeaderboardId;
+    std::map<unsigned int, std::shared_ptr<CRedisGeoSet>>                       m_GeoSets;
+    unsigned int                                                                m_uiNextGeoSetId;
+    std::map<CRedisClient*, std::unordered_map<std::string, std::shared_ptr<CRedisSequence>>> m_Sequences;
+    CRedisKeepAlive                                                                           m_KeepAlive;
+
+    CCompletionQueue<CRedisRequest> m_CompletedRequests;
+    std::deque<CRedisRequest*>      m_ReadyRequests[PRIORITY_MAX];            // drained, waiting for budget
+    std::vector<CRedisRequest*>     m_FreeRequests;
+
+    unsigned int   m_uiBudgetMicroseconds;            // 0 = unlimited
+    unsigned int   m_uiBudgetMessages;                // 0 = unlimited
+    SDispatchStats m_DispatchStats;
+};
+
+extern ILuaModuleManager10* pModuleManager;
+extern CRedisManager*       pRedisManager;
@@ -0,0 +1,276 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisQueueConsumer.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Longest a BLMOVE may block, the reaper runs in between
+#define QUEUE_MAX_BLOCK 1000
+
+// Expired leases requeued per reaper run
+#define QUEUE_REAP_LIMIT "100"
+
+//
+// A lease member is "<16 hex id>:<job>", so two copies of the same job each
+// get their own lease. <queue>:leased counts the live leases per job, which
+// tells the reaper how many copies in processing are accounted for.
+//
+
+// KEYS: leases, leased  ARGV: deadline, member, job
+static const char* szLeaseScript =
+    "redis.call('ZADD', KEYS[1], ARGV[1], ARGV[2])\n"
+    "redis.call('HINCRBY', KEYS[2], ARGV[3], 1)\n"
+    "return ARGV[2]\n";
+
+// KEYS: queue, processing, leases, leased  ARGV: now, visibility, limit, id prefix
+static const char* szReaperScript =
+    "local function release(job)\n"
+    "  if redis.call('HINCRBY', KEYS[4], job, -1) <= 0 then redis.call('HDEL', KEYS[4], job) end\n"
+    "end\n"
+    "local expired = redis.call('ZRANGEBYSCORE', KEYS[3], '-inf', ARGV[1], 'LIMIT', 0, ARGV[3])\n"
+    "for _, lease in ipairs(expired) do\n"
+    "  local job = string.sub(lease, 18)\n"
+    "  redis.call('ZREM', KEYS[3], lease)\n"
+    "  release(job)\n"
+    "  if redis.call('LREM', KEYS[2], 1, job) > 0 then redis.call('RPUSH', KEYS[1], job) end\n"
+    "end\n"
+    "-- copies taken by a consumer that died before it could lease them\n"
+    "local copies, n = {}, 0\n"
+    "for _, job in ipairs(redis.call('LRANGE', KEYS[2], 0, ARGV[3] - 1)) do\n"
+    "  copies[job] = (copies[job] or 0) + 1\n"
+    "  if copies[job] > tonumber(redis.call('HGET', KEYS[4], job) or 0) then\n"
+    "    n = n + 1\n"
+    "    redis.call('ZADD', KEYS[3], ARGV[1] + ARGV[2], ARGV[4] .. string.format('%08x', n) .. ':' .. job)\n"
+    "    redis.call('HINCRBY', KEYS[4], job, 1)\n"
+    "  end\n"
+    "end\n"
+    "return #expired\n";
+
+// KEYS: queue, processing, leases, leased  ARGV: member, requeue, member, requeue, ...
+static const CRedisScript ackScript(
+    "for i = 1, #ARGV, 2 do\n"
+    "  if redis.call('ZREM', KEYS[3], ARGV[i]) == 1 then\n"
+    "    local job = string.sub(ARGV[i], 18)\n"
+    "    if redis.call('HINCRBY', KEYS[4], job, -1) <= 0 then redis.call('HDEL', KEYS[4], job) end\n"
+    "    if redis.call('LREM', KEYS[2], 1, job) > 0 and ARGV[i + 1] == '1' then redis.call('RPUSH', KEYS[1], job) end\n"
+    "  end\n"
+    "end\n"
+    "return 0\n");
+
+static long long GetWallTimeMs()
+{
+    // Shared with other servers through the lease scores, so not steady_clock
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CRedisQueueConsumer::CRedisQueueConsumer(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strQueue,
+                                         unsigned int uiConcurrency, unsigned int uiVisibilityMs)
+    : CRedisWorker(luaVM, pOwner, std::move(callback)), m_LeaseScript(szLeaseScript), m_ReaperScript(szReaperScript), m_Random(std::random_device()())
+{
+    m_strQueue = strQueue;
+    m_strProcessing = strQueue + ":processing";
+    m_strLeases = strQueue + ":leases";
+    m_strLeased = strQueue + ":leased";
+    m_uiConcurrency = std::max(uiConcurrency, 1u);
+    m_uiVisibilityMs = uiVisibilityMs;
+    m_uiReapIntervalMs = std::min(std::max(uiVisibilityMs / 2, 250u), 5000u);
+    m_llNextReap = 0;
+    m_uiLeaseId = 0;
+    m_uiInFlight = 0;
+
+    // Lease ids are <consumer>.<counter>, consumers on other servers pick their own
+    snprintf(m_szLeasePrefix, sizeof(m_szLeasePrefix), "%08x", static_cast<unsigned int>(m_Random()));
+}
+
+bool CRedisQueueConsumer::Reap(redisContext* c)
+{
+    std::string strNow = std::to_string(GetWallTimeMs());
+    std::string strVisibility = std::to_string(m_uiVisibilityMs);
+    char        szOrphanPrefix[9];
+    snprintf(szOrphanPrefix, sizeof(szOrphanPrefix), "%08x", static_cast<unsigned int>(m_Random()));
+    const char* argv[] = {m_strQueue.c_str(), m_strProcessing.c_str(), m_strLeases.c_str(), m_strLeased.c_str(),
+                          strNow.c_str(),     strVisibility.c_str(),   QUEUE_REAP_LIMIT,    szOrphanPrefix};
+
+    redisReply* reply = m_ReaperScript.Call(c, 4, 8, argv, NULL);
+    if (!reply)
+        return false;
+
+    freeReplyObject(reply);
+    return true;
+}
+
+bool CRedisQueueConsumer::Work(redisContext* c)
+{
+    long long llNow = GetWallTimeMs();
+    if (llNow >= m_llNextReap)
+    {
+        if (!Reap(c))
+            return false;
+        m_llNextReap = llNow + m_uiReapIntervalMs;
+    }
+
+    // Don't take more jobs than we are allowed to have in flight
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Condition.wait_for(lock, std::chrono::milliseconds(m_uiReapIntervalMs),
+                             [this]() { return m_uiInFlight < m_uiConcurrency || IsStopping(); });
+        if (IsStopping())
+            return false;
+        if (m_uiInFlight >= m_uiConcurrency)
+            return true;
+    }
+
+    char szTimeout[16];
+    snprintf(szTimeout, sizeof(szTimeout), "%.3f", std::min(m_uiReapIntervalMs, (unsigned int)QUEUE_MAX_BLOCK) / 1000.0);
+    const char* argv[] = {"BLMOVE", m_strQueue.c_str(), m_strProcessing.c_str(), "LEFT", "RIGHT", szTimeout};
+    redisReply* reply = static_cast<redisReply*>(redisCommandArgv(c, 6, argv, NULL));
+    if (!reply)
+        return false;
+
+    if (reply->type != REDIS_REPLY_STRING)
+    {
+        // Timeout, or an error that the next round reports again
+        bool bTimeout = reply->type == REDIS_REPLY_NIL;
+        freeReplyObject(reply);
+        return bTimeout || Sleep(QUEUE_MAX_BLOCK);
+    }
+
+    char szId[18];
+    snprintf(szId, sizeof(szId), "%s%08x:", m_szLeasePrefix, m_uiLeaseId++);
+    std::string strMember = std::string(szId, 17) + std::string(reply->str, reply->len);
+    std::string strDeadline = std::to_string(GetWallTimeMs() + m_uiVisibilityMs);
+    const char* leaseArgv[] = {m_strLeases.c_str(), m_strLeased.c_str(), strDeadline.c_str(), strMember.data(), reply->str};
+    size_t      leaseArgvLen[] = {m_strLeases.length(), m_strLeased.length(), strDeadline.length(), strMember.length(), reply->len};
+    redisReply* leaseReply = m_LeaseScript.Call(c, 2, 5, leaseArgv, leaseArgvLen);
+    freeReplyObject(reply);
+    if (!leaseReply)
+        return false;
+
+    if (leaseReply->type != REDIS_REPLY_STRING)
+    {
+        // Not leased, the reaper finds the job in processing and leases it
+        freeReplyObject(leaseReply);
+        return Sleep(QUEUE_MAX_BLOCK);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_uiInFlight++;
+    }
+
+    // The lease script echoes the member, that is what gets acked
+    Deliver(leaseReply);
+    return true;
+}
+
+void CRedisQueueConsumer::Dispatch(CRedisRequest* pRequest)
+{
+    lua_State*  luaVM = GetLuaVM();
+    redisReply* lease = pRequest->pReply;
+    int         iTop = lua_gettop(luaVM);
+
+    if (m_Callback.Push())
+    {
+        lua_pushlstring(luaVM, lease->str + 17, lease->len - 17);
+
+        // false puts the job back right away, an error leaves it to the
+        // reaper once the lease runs out
+        if (CLuaFunctionRef::Call(luaVM, 1, 1))
+        {
+            bool bRequeue = lua_isboolean(luaVM, -1) && !lua_toboolean(luaVM, -1);
+            m_Acks.emplace_back(std::string(lease->str, lease->len), bRequeue);
+        }
+    }
+    lua_settop(luaVM, iTop);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_uiInFlight--;
+    m_Condition.notify_all();
+}
+
+void CRedisQueueConsumer::Pulse()
+{
+    if (m_Acks.empty() || !pRedisManager->IsValidClient(GetOwner()))
+        return;
+
+    // One script for the whole pulse, leases that are already gone (reaped
+    // meanwhile) are skipped so a job is never removed twice
+    std::vector<std::string> args = {m_strQueue, m_strProcessing, m_strLeases, m_strLeased};
+    for (const auto& ack : m_Acks)
+    {
+        args.push_back(ack.first);
+        args.push_back(ack.second ? "1" : "0");
+    }
+
+    m_Acks.clear();
+    std::make_shared<CRedisQueueAck>(std::move(args))->Send(GetOwner(), false);
+}
+
+CRedisQueueAck::CRedisQueueAck(std::vector<std::string>&& args) : m_Args(std::move(args))
+{
+    m_bSource = false;
+}
+
+void CRedisQueueAck::Send(CRedisClient* pClient, bool bSource)
+{
+    std::vector<const char*> argv;
+    std::vector<size_t>      argvlen;
+    for (const std::string& strArg : m_Args)
+    {
+        argv.push_back(strArg.data());
+        argvlen.push_back(strArg.length());
+    }
+
+    std::string              strKeys = "4";
+    std::vector<const char*> commandArgv;
+    std::vector<size_t>      commandArgvLen;
+    ackScript.FormatArguments(commandArgv, commandArgvLen, strKeys, static_cast<int>(argv.size()), argv.data(), argvlen.data(), bSource);
+
+    std::vector<CRedisRequest*> requests;
+    CRedisRequest*              pRequest = pRedisManager->AcquireRequest();
+    if (pRequest->SetCommand(static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data()))
+    {
+        m_bSource = bSource;
+        pRequest->pHandler = shared_from_this();
+        requests.push_back(pRequest);
+    }
+    else
+        pRedisManager->ReleaseRequest(pRequest);
+
+    pRedisManager->SendBatch(pClient, std::move(requests));
+}
+
+void CRedisQueueAck::Dispatch(CRedisRequest* pRequest)
+{
+    // First ack since the server started or flushed its scripts. Nothing
+    // ran, so sending it again with the source can't ack anything twice.
+    CRedisClient* pClient = pRequest->pClient.get();
+    if (!m_bSource && CRedisScript::IsNoScript(pRequest->pReply) && pRedisManager->IsValidClient(pClient))
+    {
+        Send(pClient, true);
+        return;
+    }
+
+    if (!pRequest->pReply || pRequest->pReply->type == REDIS_REPLY_ERROR)
+        pModuleManager->ErrorPrintf("Redis Module: %s\n", pRequest->pReply ? pRequest->pReply->str : pRequest->strError.c_str());
+}
@@ -0,0 +1,98 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisQueueConsumer;
+
+#pragma once
+
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CRedisWorker.h"
+#include "CRedisHandler.h"
+#include "CRedisScript.h"
+
+//
+// At-least-once consumer of a list based job queue.
+//
+// Jobs are moved atomically into <queue>:processing with BLMOVE and leased
+// in the <queue>:leases sorted set (score = deadline in ms). Every delivery
+// gets its own lease id, duplicate payloads are acked one by one. The script
+// callback runs from DoPulse; its acks leave through the async connection
+// in one batch per pulse. Leases that ran out, because a server died or a
+// handler failed, are put back into the queue by a reaper script.
+//
+class CRedisQueueConsumer : public CRedisWorker
+{
+public:
+    CRedisQueueConsumer(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strQueue, unsigned int uiConcurrency,
+                        unsigned int uiVisibilityMs);
+
+    // Main thread
+    void Dispatch(CRedisRequest* pRequest);
+    void Pulse();
+
+protected:
+    bool Work(redisContext* c);
+
+private:
+    bool Reap(redisContext* c);
+
+    std::string  m_strQueue;
+    std::string  m_strProcessing;
+    std::string  m_strLeases;
+    std::string  m_strLeased;
+    unsigned int m_uiConcurrency;
+    unsigned int m_uiVisibilityMs;
+    unsigned int m_uiReapIntervalMs;
+
+    // Worker thread
+    CRedisScript m_LeaseScript;
+    CRedisScript m_ReaperScript;
+    std::mt19937 m_Random;
+    char         m_szLeasePrefix[9];
+    unsigned int m_uiLeaseId;
+    long long    m_llNextReap;
+
+    // Guarded by m_Mutex
+    unsigned int m_uiInFlight;
+
+    // Main thread
+    std::vector<std::pair<std::string, bool>> m_Acks;            // lease member, requeue (handler returned false)
+};
+
+//
+// One pulse worth of acks on the async connection. Sent as EVALSHA, the
+// reply handler repeats it with the script source on NOSCRIPT.
+//
+class CRedisQueueAck : public CRedisHandler, public std::enable_shared_from_this<CRedisQueueAck>
+{
+public:
+    CRedisQueueAck(std::vector<std::string>&& args);
+
+    void Send(CRedisClient* pClient, bool bSource);
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return false; };
+
+private:
+    std::vector<std::string> m_Args;            // queue, processing, leases, leased, then member, requeue pairs
+    bool                     m_bSource;
+};
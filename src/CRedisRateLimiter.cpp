@@ -0,0 +1,148 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisRateLimiter.h"
+#include "CRedisScript.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Buckets kept before full ones are pruned, doubles with what remains
+#define RATE_LIMIT_PRUNE_THRESHOLD 1024
+
+// KEYS: bucket  ARGV: limit, window ms
+// Returns allowed, tokens left (rounded down), ms until the next token
+static const CRedisScript rateLimitScript(
+    "redis.replicate_commands()\n"
+    "local limit = tonumber(ARGV[1])\n"
+    "local window = tonumber(ARGV[2])\n"
+    "local time = redis.call('TIME')\n"
+    "local now = time[1] * 1000 + math.floor(time[2] / 1000)\n"
+    "local state = redis.call('HMGET', KEYS[1], 'tokens', 'ts')\n"
+    "local tokens = tonumber(state[1]) or limit\n"
+    "local last = tonumber(state[2]) or now\n"
+    "tokens = math.min(limit, tokens + math.max(0, now - last) * limit / window)\n"
+    "local allowed = 0\n"
+    "if tokens >= 1 then\n"
+    "    tokens = tokens - 1\n"
+    "    allowed = 1\n"
+    "end\n"
+    "redis.call('HMSET', KEYS[1], 'tokens', tostring(tokens), 'ts', now)\n"
+    "redis.call('PEXPIRE', KEYS[1], window)\n"
+    "local retry = 0\n"
+    "if allowed == 0 then retry = math.ceil((1 - tokens) * window / limit) end\n"
+    "return {allowed, math.floor(tokens), retry}\n");
+
+CRedisRateLimiter::CRedisRateLimiter()
+{
+    m_sizePruneAt = RATE_LIMIT_PRUNE_THRESHOLD;
+}
+
+bool CRedisRateLimiter::Consume(redisContext* c, const std::string& strKey, unsigned int uiLimit, unsigned int uiWindowMs,
+                                SRateLimitResult& outResult, std::string& strError)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    auto iter = m_Buckets.find(strKey);
+    if (iter != m_Buckets.end() && (iter->second.uiLimit != uiLimit || iter->second.uiWindowMs != uiWindowMs))
+    {
+        // Parameters changed, the mirror means nothing anymore
+        m_Buckets.erase(iter);
+        iter = m_Buckets.end();
+    }
+
+    if (iter == m_Buckets.end())
+    {
+        if (m_Buckets.size() >= m_sizePruneAt)
+            Prune(now);
+
+        SLocalBucket bucket;
+        bucket.dTokens = uiLimit;
+        bucket.lastRefill = now;
+        bucket.blockedUntil = now;
+        bucket.uiLimit = uiLimit;
+        bucket.uiWindowMs = uiWindowMs;
+        iter = m_Buckets.emplace(strKey, bucket).first;
+    }
+
+    SLocalBucket& bucket = iter->second;
+    Refill(bucket, now);
+
+    if (bucket.dTokens < 1 || now < bucket.blockedUntil)
+    {
+        auto tokenDue = std::chrono::milliseconds(static_cast<long long>(std::ceil((1 - bucket.dTokens) * uiWindowMs / uiLimit)));
+        auto blockedFor = std::chrono::duration_cast<std::chrono::milliseconds>(bucket.blockedUntil - now);
+
+        outResult.bAllowed = false;
+        outResult.uiRemaining = 0;
+        outResult.uiRetryAfterMs = static_cast<unsigned int>(std::max<long long>({tokenDue.count(), blockedFor.count(), 1}));
+        return true;
+    }
+
+    std::string strLimit = std::to_string(uiLimit);
+    std::string strWindow = std::to_string(uiWindowMs);
+    const char* argv[] = {strKey.c_str(), strLimit.c_str(), strWindow.c_str()};
+    size_t      argvlen[] = {strKey.length(), strLimit.length(), strWindow.length()};
+
+    redisReply* reply = rateLimitScript.Call(c, 1, 3, argv, argvlen);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 3)
+    {
+        if (reply && reply->type == REDIS_REPLY_ERROR)
+            strError.assign(reply->str, reply->len);
+        else
+            strError = c->errstr[0] ? c->errstr : "Unexpected reply";
+        if (reply)
+            freeReplyObject(reply);
+        return false;
+    }
+
+    outResult.bAllowed = reply->element[0]->integer == 1;
+    outResult.uiRemaining = static_cast<unsigned int>(reply->element[1]->integer);
+    outResult.uiRetryAfterMs = static_cast<unsigned int>(reply->element[2]->integer);
+    freeReplyObject(reply);
+
+    // The shared bucket holds less than remaining + 1, syncing down to that
+    // keeps the mirror at or above it and catches up with the other servers
+    if (outResult.bAllowed)
+        bucket.dTokens -= 1;
+    else
+        bucket.blockedUntil = now + std::chrono::milliseconds(outResult.uiRetryAfterMs);
+    bucket.dTokens = std::min(bucket.dTokens, static_cast<double>(outResult.uiRemaining) + 1);
+    return true;
+}
+
+void CRedisRateLimiter::Refill(SLocalBucket& bucket, std::chrono::steady_clock::time_point now) const
+{
+    double dElapsedMs = std::chrono::duration<double, std::milli>(now - bucket.lastRefill).count();
+    bucket.dTokens = std::min(static_cast<double>(bucket.uiLimit), bucket.dTokens + dElapsedMs * bucket.uiLimit / bucket.uiWindowMs);
+    bucket.lastRefill = now;
+}
+
+void CRedisRateLimiter::Prune(std::chrono::steady_clock::time_point now)
+{
+    // A full bucket is indistinguishable from a fresh one
+    for (auto iter = m_Buckets.begin(); iter != m_Buckets.end();)
+    {
+        Refill(iter->second, now);
+        if (iter->second.dTokens >= iter->second.uiLimit && now >= iter->second.blockedUntil)
+            iter = m_Buckets.erase(iter);
+        else
+            ++iter;
+    }
+    m_sizePruneAt = std::max(m_Buckets.size() * 2, static_cast<size_t>(RATE_LIMIT_PRUNE_THRESHOLD));
+}
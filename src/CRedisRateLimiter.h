@@ -0,0 +1,71 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisRateLimiter;
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include "hiredis.h"
+
+struct SRateLimitResult
+{
+    bool         bAllowed;
+    unsigned int uiRemaining;
+    unsigned int uiRetryAfterMs;
+};
+
+//
+// Token bucket rate limiter shared by every server through one script.
+// The bucket holds `limit` tokens and refills at limit per window.
+//
+// Each client keeps a local mirror of the buckets it used. Other servers
+// only ever take tokens out of the shared bucket, so when the mirror is
+// empty the shared one is too and the call is rejected without asking
+// the server.
+//
+// Main thread only.
+//
+class CRedisRateLimiter
+{
+public:
+    CRedisRateLimiter();
+
+    // False with strError set when the server couldn't be asked
+    bool Consume(redisContext* c, const std::string& strKey, unsigned int uiLimit, unsigned int uiWindowMs, SRateLimitResult& outResult,
+                 std::string& strError);
+
+private:
+    struct SLocalBucket
+    {
+        double                                dTokens;
+        std::chrono::steady_clock::time_point lastRefill;
+        std::chrono::steady_clock::time_point blockedUntil;            // server said no until then
+        unsigned int                          uiLimit;
+        unsigned int                          uiWindowMs;
+    };
+
+    void Refill(SLocalBucket& bucket, std::chrono::steady_clock::time_point now) const;
+    void Prune(std::chrono::steady_clock::time_point now);
+
+    std::unordered_map<std::string, SLocalBucket> m_Buckets;
+    size_t                                        m_sizePruneAt;
+};
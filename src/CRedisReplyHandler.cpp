@@ -0,0 +1,44 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisReplyHandler.h"
+#include "CRedisRequest.h"
+#include "include/ILuaModuleManager.h"
+
+extern ILuaModuleManager10* pModuleManager;
+
+void CRedisReplyHandler::Dispatch(CRedisRequest* pRequest)
+{
+    lua_State* luaVM = pRequest->callback.GetLuaVM();
+    if (!luaVM)
+    {
+        if (!pRequest->pReply || pRequest->pReply->type == REDIS_REPLY_ERROR)
+            pModuleManager->ErrorPrintf("Redis Module: %s\n", pRequest->pReply ? pRequest->pReply->str : pRequest->strError.c_str());
+        return;
+    }
+
+    int iTop = lua_gettop(luaVM);
+    if (pRequest->callback.Push())
+    {
+        int iArguments = PushResult(luaVM, pRequest->pReply, pRequest->strError.c_str());
+        CLuaFunctionRef::Call(luaVM, iArguments);
+    }
+    lua_settop(luaVM, iTop);
+
+    pRequest->callback.Release();
+}
@@ -0,0 +1,39 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisReplyHandler;
+
+#pragma once
+
+#include "Common.h"
+#include "CRedisHandler.h"
+#include "hiredis.h"
+
+//
+// Handler that hands the reply of a request to its callback, formatted by
+// PushResult. Requests without a callback only report failures.
+//
+class CRedisReplyHandler : public CRedisHandler
+{
+public:
+    // Main thread. Pushes what the callback receives and returns how many values.
+    virtual int PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const = 0;
+
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return false; };
+};
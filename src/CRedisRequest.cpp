@@ -0,0 +1,185 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisRequest.h"
+#include "CRedisClient.h"
+#include "CRedisHandler.h"
+
+#include <cstdlib>
+#include <cstring>
+
+static redisReply* CopyReply(const redisReply* pSource)
+{
+    // Same allocator as hiredis, freeReplyObject releases the copy
+    redisReply* pCopy = static_cast<redisReply*>(calloc(1, sizeof(redisReply)));
+    if (!pCopy)
+        return NULL;
+
+    pCopy->type = pSource->type;
+    pCopy->integer = pSource->integer;
+    if (pSource->str)
+    {
+        pCopy->str = static_cast<char*>(malloc(pSource->len + 1));
+        if (!pCopy->str)
+        {
+            free(pCopy);
+            return NULL;
+        }
+        memcpy(pCopy->str, pSource->str, pSource->len);
+        pCopy->str[pSource->len] = '\0';
+        pCopy->len = pSource->len;
+    }
+
+    if (pSource->element)
+    {
+        pCopy->element = static_cast<redisReply**>(calloc(pSource->elements, sizeof(redisReply*)));
+        if (!pCopy->element)
+        {
+            freeReplyObject(pCopy);
+            return NULL;
+        }
+        pCopy->elements = pSource->elements;
+        for (size_t i = 0; i < pSource->elements; i++)
+        {
+            pCopy->element[i] = CopyReply(pSource->element[i]);
+            if (!pCopy->element[i])
+            {
+                freeReplyObject(pCopy);
+                return NULL;
+            }
+        }
+    }
+    return pCopy;
+}
+
+CRedisRequest::CRedisRequest()
+{
+    uiId = 0;
+    luaVM = NULL;
+    ePriority = PRIORITY_NORMAL;
+    eLane = LANE_INTERACTIVE;
+    szCommand = NULL;
+    iCommandLength = 0;
+    pReply = NULL;
+    bCancelled = false;
+    uiReplyFlags = 0;
+    bCounted = false;
+    sizeReplyBytes = 0;
+    bDeferred = false;
+    eRestore = RESTORE_NONE;
+    uiLatencyUs = 0;
+}
+
+CRedisRequest::~CRedisRequest()
+{
+    Reset();
+}
+
+void CRedisRequest::Reset()
+{
+    if (szCommand)
+        redisFreeCommand(szCommand);
+
+    if (pReply)
+        freeReplyObject(pReply);
+
+    uiId = 0;
+    pClient.reset();
+    pHandler.reset();
+    luaVM = NULL;
+    ePriority = PRIORITY_NORMAL;
+    eLane = LANE_INTERACTIVE;
+    callback.Release();
+    szCommand = NULL;
+    iCommandLength = 0;
+    pReply = NULL;
+    strError.clear();
+    bCancelled = false;
+    uiReplyFlags = 0;
+    bCounted = false;
+    sizeReplyBytes = 0;
+    bDeferred = false;
+    eRestore = RESTORE_NONE;
+    deadline = std::chrono::steady_clock::time_point();
+    sentAt = std::chrono::steady_clock::time_point();
+    uiLatencyUs = 0;
+}
+
+bool CRedisRequest::SetCommand(int argc, const char** argv, const size_t* argvlen)
+{
+    if (szCommand)
+        redisFreeCommand(szCommand);
+
+    szCommand = NULL;
+    iCommandLength = redisFormatCommandArgv(&szCommand, argc, argv, argvlen);
+    return iCommandLength > 0;
+}
+
+bool CRedisRequest::SetCommand(const char* szFormatted, size_t sizeFormatted)
+{
+    // Freed with redisFreeCommand like the ones hiredis formats
+    if (szCommand)
+        redisFreeCommand(szCommand);
+
+    iCommandLength = 0;
+    szCommand = static_cast<char*>(malloc(sizeFormatted + 1));
+    if (!szCommand)
+        return false;
+
+    memcpy(szCommand, szFormatted, sizeFormatted);
+    szCommand[sizeFormatted] = '\0';
+    iCommandLength = static_cast<int>(sizeFormatted);
+    return true;
+}
+
+void CRedisRequest::SetReply(redisReply* pSource)
+{
+    // hiredis frees the reply as soon as the callback returns. Steal the
+    // payload into our own shell and leave an empty one behind for it.
+    pReply = static_cast<redisReply*>(calloc(1, sizeof(redisReply)));
+    if (!pReply)
+    {
+        SetError("Can't allocate redis reply");
+        return;
+    }
+
+    *pReply = *pSource;
+    pSource->type = REDIS_REPLY_NIL;
+    pSource->str = NULL;
+    pSource->len = 0;
+    pSource->element = NULL;
+    pSource->elements = 0;
+}
+
+void CRedisRequest::SetError(const char* szError)
+{
+    strError = szError ? szError : "Unknown error";
+}
+
+void CRedisRequest::CopyResult(const CRedisRequest* pSource)
+{
+    if (!pSource->pReply)
+    {
+        strError = pSource->strError;
+        return;
+    }
+
+    pReply = CopyReply(pSource->pReply);
+    if (!pReply)
+        SetError("Can't allocate redis reply");
+}
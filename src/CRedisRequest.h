@@ -0,0 +1,102 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisRequest;
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "Common.h"
+#include "CCompletionQueue.h"
+#include "extra/CLuaFunctionRef.h"
+#include "hiredis.h"
+
+class CRedisClient;
+class CRedisHandler;
+
+// Dispatch order of completions within a pulse
+enum eRequestPriority
+{
+    PRIORITY_HIGH,
+    PRIORITY_NORMAL,
+    PRIORITY_BULK,
+    PRIORITY_MAX
+};
+
+// Connection of the client a request travels on
+enum eRequestLane
+{
+    LANE_INTERACTIVE,
+    LANE_BULK,
+    LANE_MAX
+};
+
+// Where a blocking pop puts its element back when nobody takes the reply
+enum eRequestRestore
+{
+    RESTORE_NONE,
+    RESTORE_HEAD,            // BLPOP
+    RESTORE_TAIL,            // BRPOP
+};
+
+//
+// One async command travelling main thread -> I/O thread -> main thread.
+// The I/O thread owns it while in flight, bCancelled is only ever touched
+// by the main thread, as is the callback. Requests are pooled by CRedisManager and double as
+// their own completion queue node. Requests delivered by a worker or another
+// handler carry it in pHandler and are dispatched by it.
+//
+class CRedisRequest : public CCompletionNode
+{
+public:
+    CRedisRequest();
+    ~CRedisRequest();
+
+    void Reset();
+
+    bool SetCommand(int argc, const char** argv, const size_t* argvlen);
+    bool SetCommand(const char* szCommand, size_t sizeCommand);            // RESP encoded already
+    void SetReply(redisReply* pReply);
+    void SetError(const char* szError);
+    void CopyResult(const CRedisRequest* pSource);
+
+    unsigned int                   uiId;
+    std::shared_ptr<CRedisClient>  pClient;
+    std::shared_ptr<CRedisHandler> pHandler;
+    lua_State*                     luaVM;
+    eRequestPriority               ePriority;
+    eRequestLane                   eLane;
+    CLuaFunctionRef                callback;
+    char*                          szCommand;
+    int                            iCommandLength;
+    redisReply*                    pReply;
+    std::string                    strError;
+    bool                           bCancelled;
+    unsigned int                   uiReplyFlags;              // eReplyFlags
+    bool                           bCounted;                  // counts against the in-flight limits
+    size_t                         sizeReplyBytes;            // counts against the reply limits while ready
+    bool                           bDeferred;                 // already counted as deferred by DoPulse
+    eRequestRestore                eRestore;                  // pushes a popped element back if cancelled
+
+    std::chrono::steady_clock::time_point deadline;            // main thread only, unset = none
+    std::chrono::steady_clock::time_point sentAt;              // set by CRedisClient::Send, unset for other paths
+    unsigned int                          uiLatencyUs;         // sent to reply, set on completion
+};
@@ -0,0 +1,185 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisSchedulePoller.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+// Bounds of the adaptive poll interval
+#define SCHEDULE_MIN_INTERVAL 10
+#define SCHEDULE_MAX_INTERVAL 1000
+
+// How long a claimed job may go unacknowledged before it is due again
+#define SCHEDULE_CLAIM_TIMEOUT "30000"
+
+// KEYS: queue, claimed  ARGV: now, batch, claim timeout
+// Returns {claimed members, score of the next job or nothing}
+static const char* szClaimScript =
+    "for _, member in ipairs(redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', ARGV[1], 'LIMIT', 0, ARGV[2])) do\n"
+    "  redis.call('ZREM', KEYS[2], member)\n"
+    "  redis.call('ZADD', KEYS[1], ARGV[1], member)\n"
+    "end\n"
+    "local due = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', ARGV[1], 'LIMIT', 0, ARGV[2])\n"
+    "for _, member in ipairs(due) do\n"
+    "  redis.call('ZREM', KEYS[1], member)\n"
+    "  redis.call('ZADD', KEYS[2], ARGV[1] + ARGV[3], member)\n"
+    "end\n"
+    "local nextJob = redis.call('ZRANGE', KEYS[1], 0, 0, 'WITHSCORES')\n"
+    "return {due, nextJob[2]}\n";
+
+static long long GetWallTimeMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CRedisSchedulePoller::CRedisSchedulePoller(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strQueue,
+                                           unsigned int uiBatch)
+    : CRedisWorker(luaVM, pOwner, std::move(callback)), m_ClaimScript(szClaimScript)
+{
+    m_strQueue = strQueue;
+    m_strClaimed = strQueue + ":claimed";
+    m_uiBatch = std::max(uiBatch, 1u);
+    m_llNextPoll = 0;
+}
+
+void CRedisSchedulePoller::Nudge(long long llDueMs)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (llDueMs < m_llNextPoll)
+    {
+        m_llNextPoll = llDueMs;
+        m_Condition.notify_all();
+    }
+}
+
+bool CRedisSchedulePoller::Work(redisContext* c)
+{
+    {
+        // Sleep until the next job is due, a nudge or a stop
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        while (!IsStopping())
+        {
+            long long llWait = m_llNextPoll - GetWallTimeMs();
+            if (llWait <= 0)
+                break;
+            m_Condition.wait_for(lock, std::chrono::milliseconds(llWait));
+        }
+        if (IsStopping())
+            return false;
+    }
+
+    long long   llNow = GetWallTimeMs();
+    std::string strNow = std::to_string(llNow);
+    std::string strBatch = std::to_string(m_uiBatch);
+    const char* argv[] = {m_strQueue.c_str(), m_strClaimed.c_str(), strNow.c_str(), strBatch.c_str(), SCHEDULE_CLAIM_TIMEOUT};
+    redisReply* reply = m_ClaimScript.Call(c, 2, 5, argv, NULL);
+    if (!reply)
+        return false;
+
+    long long llNextPoll = llNow + SCHEDULE_MAX_INTERVAL;
+    bool      bDelivered = false;
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 1 && reply->element[0]->type == REDIS_REPLY_ARRAY)
+    {
+        size_t sizeClaimed = reply->element[0]->elements;
+
+        // A full batch means there is probably more waiting right now
+        if (sizeClaimed >= m_uiBatch)
+            llNextPoll = llNow;
+        else if (reply->elements >= 2 && reply->element[1]->type == REDIS_REPLY_STRING)
+            llNextPoll = std::min(llNextPoll, std::max(static_cast<long long>(strtod(reply->element[1]->str, NULL)), llNow + SCHEDULE_MIN_INTERVAL));
+
+        if (sizeClaimed > 0)
+        {
+            Deliver(reply);
+            bDelivered = true;
+        }
+    }
+    else if (reply->type == REDIS_REPLY_ERROR)
+        llNextPoll = llNow + SCHEDULE_MAX_INTERVAL;
+
+    if (!bDelivered)
+        freeReplyObject(reply);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_llNextPoll = llNextPoll;
+    return true;
+}
+
+void CRedisSchedulePoller::Dispatch(CRedisRequest* pRequest)
+{
+    lua_State*  luaVM = GetLuaVM();
+    redisReply* claimed = pRequest->pReply->element[0];
+
+    for (size_t i = 0; i < claimed->elements; i++)
+    {
+        redisReply* member = claimed->element[i];
+        const char* szSeparator = static_cast<const char*>(memchr(member->str, ':', member->len));
+        size_t      sizeId = szSeparator ? szSeparator - member->str : 0;
+        size_t      sizeSkip = szSeparator ? sizeId + 1 : 0;
+
+        // The rest stays claimed and is due again once the claim times out
+        int iTop = lua_gettop(luaVM);
+        if (!m_Callback.Push())
+            break;
+
+        // callback(payload, id), an error leaves the job to be claimed again
+        lua_pushlstring(luaVM, member->str + sizeSkip, member->len - sizeSkip);
+        lua_pushlstring(luaVM, member->str, sizeId);
+        if (CLuaFunctionRef::Call(luaVM, 2))
+            m_Done.emplace_back(member->str, member->len);
+        lua_settop(luaVM, iTop);
+    }
+}
+
+void CRedisSchedulePoller::Pulse()
+{
+    if (m_Done.empty() || !pRedisManager->IsValidClient(GetOwner()))
+        return;
+
+    std::vector<const char*> argv = {"ZREM", m_strClaimed.c_str()};
+    std::vector<size_t>      argvlen = {4, m_strClaimed.length()};
+    for (const std::string& strMember : m_Done)
+    {
+        argv.push_back(strMember.data());
+        argvlen.push_back(strMember.length());
+    }
+
+    std::vector<CRedisRequest*> requests;
+    CRedisRequest*              pRequest = pRedisManager->AcquireRequest();
+    if (pRequest->SetCommand(static_cast<int>(argv.size()), argv.data(), argvlen.data()))
+        requests.push_back(pRequest);
+    else
+        pRedisManager->ReleaseRequest(pRequest);
+
+    m_Done.clear();
+    pRedisManager->SendBatch(GetOwner(), std::move(requests));
+}
+
+void CRedisScheduleNudge::Dispatch(CRedisRequest* pRequest)
+{
+    // Only once the job is really there, a poller woken earlier would miss it
+    if (pRequest->pReply && pRequest->pReply->type != REDIS_REPLY_ERROR)
+        pRedisManager->NudgeSchedulePollers(m_strQueue, m_llDueMs);
+    else
+        pModuleManager->ErrorPrintf("Redis Module: %s\n", pRequest->pReply ? pRequest->pReply->str : pRequest->strError.c_str());
+}
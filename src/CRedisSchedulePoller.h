@@ -0,0 +1,87 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisSchedulePoller;
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "CRedisHandler.h"
+#include "CRedisWorker.h"
+#include "CRedisScript.h"
+
+//
+// Claims due jobs from a sorted set scored by due time (ms). A script
+// removes a batch of due jobs atomically, so each job is handed to
+// exactly one server, and reports when the next one is due. The poller
+// sleeps until then, bounded so jobs scheduled by other servers are not
+// missed for long; Nudge() wakes it early for jobs scheduled here.
+//
+// Members are "<id>:<payload>" so equal payloads don't collapse. Claimed
+// jobs wait in <queue>:claimed until their callback returned; a stop, a
+// crash or a failed callback leaves them there to become due again.
+//
+class CRedisSchedulePoller : public CRedisWorker
+{
+public:
+    CRedisSchedulePoller(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strQueue, unsigned int uiBatch);
+
+    const std::string& GetQueue() const { return m_strQueue; };
+
+    // Main thread
+    void Dispatch(CRedisRequest* pRequest);
+    void Pulse();
+    void Nudge(long long llDueMs);
+
+protected:
+    bool Work(redisContext* c);
+
+private:
+    std::string  m_strQueue;
+    std::string  m_strClaimed;
+    unsigned int m_uiBatch;
+
+    // Worker thread
+    CRedisScript m_ClaimScript;
+
+    // Guarded by m_Mutex
+    long long m_llNextPoll;
+
+    // Main thread
+    std::vector<std::string> m_Done;
+};
+
+//
+// Reply of the ZADD behind redisSchedule, wakes the pollers of this server
+// once the job can actually be claimed.
+//
+class CRedisScheduleNudge : public CRedisHandler
+{
+public:
+    CRedisScheduleNudge(const std::string& strQueue, long long llDueMs) : m_strQueue(strQueue), m_llDueMs(llDueMs){};
+
+    // Main thread
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return false; };
+
+private:
+    std::string m_strQueue;
+    long long   m_llDueMs;
+};
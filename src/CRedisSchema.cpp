@@ -0,0 +1,394 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisSchema.h"
+#include "CRedisRequest.h"
+#include "extra/CLuaReply.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+// Registry table mapping loaded objects to their encoded values as loaded.
+// Weak keys, a snapshot goes away with its object.
+#define SCHEMA_SNAPSHOTS "redis.schemaSnapshots"
+
+// KEYS: hash  ARGV: number of removed fields, removed fields, field/value pairs
+static const char* szSaveScript =
+    "local removed = tonumber(ARGV[1])\n"
+    "for i = 2, removed + 1 do redis.call('HDEL', KEYS[1], ARGV[i]) end\n"
+    "for i = removed + 2, #ARGV, 2 do redis.call('HSET', KEYS[1], ARGV[i], ARGV[i + 1]) end\n"
+    "return #ARGV - 1 - removed\n";
+
+static void PushSnapshots(lua_State* luaVM)
+{
+    lua_getfield(luaVM, LUA_REGISTRYINDEX, SCHEMA_SNAPSHOTS);
+    if (lua_istable(luaVM, -1))
+        return;
+
+    lua_pop(luaVM, 1);
+    lua_newtable(luaVM);
+    lua_createtable(luaVM, 0, 1);
+    lua_pushstring(luaVM, "k");
+    lua_setfield(luaVM, -2, "__mode");
+    lua_setmetatable(luaVM, -2);
+    lua_pushvalue(luaVM, -1);
+    lua_setfield(luaVM, LUA_REGISTRYINDEX, SCHEMA_SNAPSHOTS);
+}
+
+CRedisSchema::CRedisSchema(std::vector<std::pair<std::string, eSchemaType>>&& fields) : m_Fields(std::move(fields))
+{
+    m_LoadArgv.reserve(m_Fields.size() + 2);
+    m_LoadArgv.push_back("HMGET");
+    m_LoadArgv.push_back(NULL);
+    m_LoadArgvLen.push_back(5);
+    m_LoadArgvLen.push_back(0);
+    for (const auto& field : m_Fields)
+    {
+        m_LoadArgv.push_back(field.first.c_str());
+        m_LoadArgvLen.push_back(field.first.length());
+    }
+}
+
+bool CRedisSchema::ParseType(const char* szType, eSchemaType& eType)
+{
+    static const std::pair<const char*, eSchemaType> types[] = {
+        {"int", SCHEMA_INT}, {"float", SCHEMA_FLOAT}, {"bool", SCHEMA_BOOL}, {"string", SCHEMA_STRING}, {"packed", SCHEMA_PACKED}};
+
+    for (const auto& type : types)
+    {
+        if (strcmp(szType, type.first) == 0)
+        {
+            eType = type.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CRedisSchema::GetLoadCommand(std::string_view strKey, int& argc, const char**& argv, const size_t*& argvlen)
+{
+    // Only the key changes between loads, valid until the next call
+    m_LoadArgv[1] = strKey.data();
+    m_LoadArgvLen[1] = strKey.length();
+    argc = static_cast<int>(m_LoadArgv.size());
+    argv = m_LoadArgv.data();
+    argvlen = m_LoadArgvLen.data();
+}
+
+void CRedisSchema::GetSaveCommand(std::string_view strKey, const SChanges& changes, std::string& strRemoved, std::vector<const char*>& argv,
+                                  std::vector<size_t>& argvlen) const
+{
+    // Pointers into strKey, strRemoved, changes and the field names
+    strRemoved = std::to_string(changes.removed.size());
+    argv = {"EVAL", szSaveScript, "1", strKey.data(), strRemoved.c_str()};
+    argvlen = {4, strlen(szSaveScript), 1, strKey.length(), strRemoved.length()};
+    for (size_t sizeIndex : changes.removed)
+    {
+        argv.push_back(m_Fields[sizeIndex].first.c_str());
+        argvlen.push_back(m_Fields[sizeIndex].first.length());
+    }
+    for (size_t i = 0; i < changes.changed.size(); i++)
+    {
+        const std::string& strField = m_Fields[changes.changed[i]].first;
+        argv.insert(argv.end(), {strField.c_str(), changes.values[i].data()});
+        argvlen.insert(argvlen.end(), {strField.length(), changes.values[i].length()});
+    }
+}
+
+int CRedisSchema::PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const
+{
+    if (!pReply || pReply->type == REDIS_REPLY_ERROR)
+        return CLuaReply::PushResult(luaVM, pReply, szError);
+
+    if (pReply->type != REDIS_REPLY_ARRAY || pReply->elements != m_Fields.size())
+    {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, "Unexpected reply");
+        return 2;
+    }
+
+    // HMGET can't tell a missing key from a hash without these fields
+    size_t sizeFound = 0;
+    for (size_t i = 0; i < pReply->elements; i++)
+        sizeFound += pReply->element[i]->type != REDIS_REPLY_NIL;
+    if (sizeFound == 0)
+    {
+        lua_pushnil(luaVM);
+        return 1;
+    }
+
+    lua_checkstack(luaVM, 6);
+    lua_createtable(luaVM, 0, static_cast<int>(sizeFound));
+    PushSnapshots(luaVM);
+    lua_pushvalue(luaVM, -2);
+    lua_createtable(luaVM, 0, static_cast<int>(sizeFound));
+    for (size_t i = 0; i < pReply->elements; i++)
+    {
+        const redisReply* pElement = pReply->element[i];
+        if (pElement->type == REDIS_REPLY_NIL)
+            continue;
+
+        PushValue(luaVM, m_Fields[i].second, pElement);
+        lua_setfield(luaVM, -5, m_Fields[i].first.c_str());
+        lua_pushlstring(luaVM, pElement->str, pElement->len);
+        lua_setfield(luaVM, -2, m_Fields[i].first.c_str());
+    }
+    lua_rawset(luaVM, -3);
+    lua_pop(luaVM, 1);
+    return 1;
+}
+
+void CRedisSchema::PushValue(lua_State* luaVM, eSchemaType eType, const redisReply* pReply) const
+{
+    const char* szBegin = pReply->str;
+    const char* szEnd = pReply->str + pReply->len;
+    switch (eType)
+    {
+        case SCHEMA_INT:
+        {
+            long long llValue;
+            auto      result = std::from_chars(szBegin, szEnd, llValue);
+            if (result.ec == std::errc() && result.ptr == szEnd)
+            {
+                lua_pushnumber(luaVM, static_cast<lua_Number>(llValue));
+                return;
+            }
+            break;
+        }
+
+        case SCHEMA_FLOAT:
+        {
+            double dValue;
+            auto   result = std::from_chars(szBegin, szEnd, dValue);
+            if (result.ec == std::errc() && result.ptr == szEnd)
+            {
+                lua_pushnumber(luaVM, dValue);
+                return;
+            }
+            break;
+        }
+
+        case SCHEMA_BOOL:
+            lua_pushboolean(luaVM, pReply->len == 1 && szBegin[0] == '1');
+            return;
+
+        case SCHEMA_PACKED:
+        {
+            if (pReply->len % sizeof(double) != 0)
+                break;
+
+            size_t sizeCount = pReply->len / sizeof(double);
+            lua_createtable(luaVM, static_cast<int>(sizeCount), 0);
+            for (size_t i = 0; i < sizeCount; i++)
+            {
+                double dValue;
+                memcpy(&dValue, szBegin + i * sizeof(double), sizeof(double));
+                lua_pushnumber(luaVM, dValue);
+                lua_rawseti(luaVM, -2, static_cast<int>(i + 1));
+            }
+            return;
+        }
+
+        case SCHEMA_STRING:
+        default:
+            break;
+    }
+
+    // Strings, and whatever doesn't match its type is handed over as stored
+    lua_pushlstring(luaVM, pReply->str, pReply->len);
+}
+
+bool CRedisSchema::Encode(lua_State* luaVM, int iIndex, eSchemaType eType, std::string& strValue) const
+{
+    char szBuffer[32];
+    switch (eType)
+    {
+        case SCHEMA_INT:
+        {
+            if (lua_type(luaVM, iIndex) != LUA_TNUMBER)
+                return false;
+            double dValue = lua_tonumber(luaVM, iIndex);
+            if (dValue != std::floor(dValue) || std::fabs(dValue) > 9007199254740992.0)
+                return false;
+
+            auto result = std::to_chars(szBuffer, szBuffer + sizeof(szBuffer), static_cast<long long>(dValue));
+            strValue.assign(szBuffer, result.ptr);
+            return true;
+        }
+
+        case SCHEMA_FLOAT:
+        {
+            if (lua_type(luaVM, iIndex) != LUA_TNUMBER)
+                return false;
+
+            auto result = std::to_chars(szBuffer, szBuffer + sizeof(szBuffer), static_cast<double>(lua_tonumber(luaVM, iIndex)));
+            strValue.assign(szBuffer, result.ptr);
+            return true;
+        }
+
+        case SCHEMA_BOOL:
+            if (lua_type(luaVM, iIndex) != LUA_TBOOLEAN)
+                return false;
+            strValue = lua_toboolean(luaVM, iIndex) ? "1" : "0";
+            return true;
+
+        case SCHEMA_STRING:
+        {
+            int iType = lua_type(luaVM, iIndex);
+            if (iType != LUA_TSTRING && iType != LUA_TNUMBER)
+                return false;
+
+            size_t      sizeValue = 0;
+            const char* szValue = lua_tolstring(luaVM, iIndex, &sizeValue);
+            strValue.assign(szValue, sizeValue);
+            return true;
+        }
+
+        case SCHEMA_PACKED:
+        {
+            if (lua_type(luaVM, iIndex) != LUA_TTABLE)
+                return false;
+
+            size_t sizeCount = lua_objlen(luaVM, iIndex);
+            strValue.resize(sizeCount * sizeof(double));
+            for (size_t i = 0; i < sizeCount; i++)
+            {
+                lua_rawgeti(luaVM, iIndex, static_cast<int>(i + 1));
+                bool   bNumber = lua_type(luaVM, -1) == LUA_TNUMBER;
+                double dValue = lua_tonumber(luaVM, -1);
+                lua_pop(luaVM, 1);
+                if (!bNumber)
+                    return false;
+                memcpy(&strValue[i * sizeof(double)], &dValue, sizeof(double));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void CRedisSchema::PushSnapshot(lua_State* luaVM, int iObject) const
+{
+    // nil for objects that were never loaded or saved
+    PushSnapshots(luaVM);
+    lua_pushvalue(luaVM, iObject);
+    lua_rawget(luaVM, -2);
+    lua_remove(luaVM, -2);
+}
+
+bool CRedisSchema::GetChanges(lua_State* luaVM, int iObject, SChanges& changes, std::string& strError) const
+{
+    static const char* szTypes[] = {"int", "float", "bool", "string", "packed"};
+
+    lua_checkstack(luaVM, 4);
+    PushSnapshot(luaVM, iObject);
+    int         iSnapshot = lua_gettop(luaVM);
+    bool        bSnapshot = lua_istable(luaVM, iSnapshot);
+    std::string strValue;
+    for (size_t i = 0; i < m_Fields.size(); i++)
+    {
+        const char* szField = m_Fields[i].first.c_str();
+        lua_getfield(luaVM, iObject, szField);
+        if (bSnapshot)
+            lua_getfield(luaVM, iSnapshot, szField);
+        else
+            lua_pushnil(luaVM);
+
+        if (lua_isnil(luaVM, -2))
+        {
+            if (!lua_isnil(luaVM, -1))
+                changes.removed.push_back(i);
+        }
+        else if (!Encode(luaVM, lua_gettop(luaVM) - 1, m_Fields[i].second, strValue))
+        {
+            strError = std::string("Field '") + szField + "' must be " + szTypes[m_Fields[i].second];
+            lua_settop(luaVM, iSnapshot - 1);
+            return false;
+        }
+        else
+        {
+            size_t      sizeSnapshot = 0;
+            const char* szSnapshot = lua_isstring(luaVM, -1) ? lua_tolstring(luaVM, -1, &sizeSnapshot) : NULL;
+            if (!szSnapshot || sizeSnapshot != strValue.length() || memcmp(szSnapshot, strValue.data(), sizeSnapshot) != 0)
+            {
+                changes.changed.push_back(i);
+                changes.values.push_back(strValue);
+            }
+        }
+        lua_pop(luaVM, 2);
+    }
+    lua_settop(luaVM, iSnapshot - 1);
+    return true;
+}
+
+void CRedisSchema::CommitChanges(lua_State* luaVM, int iObject, const SChanges& changes) const
+{
+    lua_checkstack(luaVM, 4);
+    PushSnapshot(luaVM, iObject);
+    if (!lua_istable(luaVM, -1))
+    {
+        // First save of an object that wasn't loaded
+        lua_pop(luaVM, 1);
+        PushSnapshots(luaVM);
+        lua_pushvalue(luaVM, iObject);
+        lua_newtable(luaVM);
+        lua_pushvalue(luaVM, -1);
+        lua_insert(luaVM, -4);
+        lua_rawset(luaVM, -3);
+        lua_pop(luaVM, 1);
+    }
+
+    for (size_t i = 0; i < changes.changed.size(); i++)
+    {
+        lua_pushlstring(luaVM, changes.values[i].data(), changes.values[i].length());
+        lua_setfield(luaVM, -2, m_Fields[changes.changed[i]].first.c_str());
+    }
+    for (size_t sizeIndex : changes.removed)
+    {
+        lua_pushnil(luaVM);
+        lua_setfield(luaVM, -2, m_Fields[sizeIndex].first.c_str());
+    }
+    lua_pop(luaVM, 1);
+}
+
+CRedisSchemaSave::CRedisSchemaSave(lua_State* luaVM, int iObject, const std::shared_ptr<CRedisSchema>& pSchema, CRedisSchema::SChanges&& changes)
+    : m_pSchema(pSchema), m_Changes(std::move(changes)), m_Object(luaVM, iObject)
+{
+}
+
+int CRedisSchemaSave::PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const
+{
+    return CLuaReply::PushResult(luaVM, pReply, szError);
+}
+
+void CRedisSchemaSave::Dispatch(CRedisRequest* pRequest)
+{
+    // A failed save leaves the snapshot alone, the next save retries the fields
+    lua_State* luaVM = m_Object.GetLuaVM();
+    if (luaVM && pRequest->pReply && pRequest->pReply->type != REDIS_REPLY_ERROR)
+    {
+        int iTop = lua_gettop(luaVM);
+        if (m_Object.Push())
+            m_pSchema->CommitChanges(luaVM, lua_gettop(luaVM), m_Changes);
+        lua_settop(luaVM, iTop);
+    }
+    m_Object.Release();
+
+    CRedisReplyHandler::Dispatch(pRequest);
+}
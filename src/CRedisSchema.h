@@ -0,0 +1,106 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisSchema;
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Common.h"
+#include "CRedisReplyHandler.h"
+#include "extra/CLuaFunctionRef.h"
+#include "hiredis.h"
+
+class CRedisRequest;
+
+// Type of one hash field, decoded and encoded in C++
+enum eSchemaType
+{
+    SCHEMA_INT,
+    SCHEMA_FLOAT,
+    SCHEMA_BOOL,
+    SCHEMA_STRING,
+    SCHEMA_PACKED,            // array of numbers stored as raw doubles
+};
+
+//
+// Known fields of a hash in a fixed order. Loads are one HMGET with the
+// field names formatted once, values are decoded straight into a lua
+// table. The encoded values of a load are kept as a snapshot in a weak
+// keyed registry table, keyed by that table, so a save only writes the
+// fields that changed. Saves are one script, removals and changes apply
+// together or not at all.
+//
+// Async loads carry the schema as their handler and pass (object) or
+// (false, error) to the callback of the request.
+//
+class CRedisSchema : public CRedisReplyHandler
+{
+public:
+    struct SChanges
+    {
+        std::vector<size_t>      changed;            // field indices
+        std::vector<std::string> values;             // encoded, parallel to changed
+        std::vector<size_t>      removed;            // field indices set to nil
+    };
+
+    CRedisSchema(std::vector<std::pair<std::string, eSchemaType>>&& fields);
+
+    static bool ParseType(const char* szType, eSchemaType& eType);
+
+    const std::string& GetFieldName(size_t sizeIndex) const { return m_Fields[sizeIndex].first; };
+
+    // Main thread
+    void GetLoadCommand(std::string_view strKey, int& argc, const char**& argv, const size_t*& argvlen);
+    void GetSaveCommand(std::string_view strKey, const SChanges& changes, std::string& strRemoved, std::vector<const char*>& argv,
+                        std::vector<size_t>& argvlen) const;
+    int  PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const;
+    bool GetChanges(lua_State* luaVM, int iObject, SChanges& changes, std::string& strError) const;
+    void CommitChanges(lua_State* luaVM, int iObject, const SChanges& changes) const;
+
+private:
+    void PushValue(lua_State* luaVM, eSchemaType eType, const redisReply* pReply) const;
+    bool Encode(lua_State* luaVM, int iIndex, eSchemaType eType, std::string& strValue) const;
+    void PushSnapshot(lua_State* luaVM, int iObject) const;
+
+    std::vector<std::pair<std::string, eSchemaType>> m_Fields;
+    std::vector<const char*>                         m_LoadArgv;            // HMGET <key> <fields...>, key set per call
+    std::vector<size_t>                              m_LoadArgvLen;
+};
+
+//
+// Async save of one object. The snapshot is only updated once the server
+// confirmed the write, the callback then gets the reply or (false, error).
+//
+class CRedisSchemaSave : public CRedisReplyHandler
+{
+public:
+    CRedisSchemaSave(lua_State* luaVM, int iObject, const std::shared_ptr<CRedisSchema>& pSchema, CRedisSchema::SChanges&& changes);
+
+    int  PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError) const;
+    void Dispatch(CRedisRequest* pRequest);
+
+private:
+    std::shared_ptr<CRedisSchema> m_pSchema;
+    CRedisSchema::SChanges        m_Changes;
+    CLuaFunctionRef               m_Object;            // pins the saved table until the reply
+};
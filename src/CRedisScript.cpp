@@ -0,0 +1,136 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisScript.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//
+// SHA-1 (FIPS 180-1), only used to name scripts the way the server does
+//
+static std::string Sha1Hex(const char* szData, size_t sizeData)
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    // Message, 0x80, zero padding, 64 bit big endian bit length
+    std::vector<unsigned char> message(szData, szData + sizeData);
+    message.push_back(0x80);
+    while (message.size() % 64 != 56)
+        message.push_back(0);
+    uint64_t ullBits = static_cast<uint64_t>(sizeData) * 8;
+    for (int i = 7; i >= 0; i--)
+        message.push_back(static_cast<unsigned char>(ullBits >> (i * 8)));
+
+    auto Rotate = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    for (size_t sizeBlock = 0; sizeBlock < message.size(); sizeBlock += 64)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            const unsigned char* p = &message[sizeBlock + i * 4];
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++)
+            w[i] = Rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+                f = (b & c) | (~b & d), k = 0x5A827999;
+            else if (i < 40)
+                f = b ^ c ^ d, k = 0x6ED9EBA1;
+            else if (i < 60)
+                f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+            else
+                f = b ^ c ^ d, k = 0xCA62C1D6;
+
+            uint32_t temp = Rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = Rotate(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    char szHex[41];
+    for (int i = 0; i < 5; i++)
+        snprintf(szHex + i * 8, 9, "%08x", h[i]);
+    return std::string(szHex, 40);
+}
+
+CRedisScript::CRedisScript(const char* szSource)
+{
+    m_szSource = szSource;
+    m_strSha1 = Sha1Hex(szSource, strlen(szSource));
+}
+
+bool CRedisScript::IsNoScript(const redisReply* reply)
+{
+    return reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0;
+}
+
+void CRedisScript::FormatArguments(std::vector<const char*>& outArgv, std::vector<size_t>& outArgvLen, const std::string& strKeys, int argc,
+                                   const char** argv, const size_t* argvlen, bool bSource) const
+{
+    outArgv = {bSource ? "EVAL" : "EVALSHA", bSource ? m_szSource : m_strSha1.c_str(), strKeys.c_str()};
+    outArgvLen = {strlen(outArgv[0]), strlen(outArgv[1]), strKeys.length()};
+    for (int i = 0; i < argc; i++)
+    {
+        outArgv.push_back(argv[i]);
+        outArgvLen.push_back(argvlen ? argvlen[i] : strlen(argv[i]));
+    }
+}
+
+redisReply* CRedisScript::Call(redisContext* c, int iKeys, int argc, const char** argv, const size_t* argvlen) const
+{
+    std::string              strKeys = std::to_string(iKeys);
+    std::vector<const char*> commandArgv;
+    std::vector<size_t>      commandArgvLen;
+
+    FormatArguments(commandArgv, commandArgvLen, strKeys, argc, argv, argvlen, false);
+    redisReply* reply = static_cast<redisReply*>(redisCommandArgv(c, static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data()));
+    if (!IsNoScript(reply))
+        return reply;
+
+    // The server doesn't know it (yet), EVAL caches it for next time
+    freeReplyObject(reply);
+    FormatArguments(commandArgv, commandArgvLen, strKeys, argc, argv, argvlen, true);
+    return static_cast<redisReply*>(redisCommandArgv(c, static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data()));
+}
+
+int CRedisScript::CallAsync(redisAsyncContext* ac, redisCallbackFn* fn, void* privdata, int iKeys, int argc, const char** argv, const size_t* argvlen,
+                            bool bSource) const
+{
+    std::string              strKeys = std::to_string(iKeys);
+    std::vector<const char*> commandArgv;
+    std::vector<size_t>      commandArgvLen;
+
+    FormatArguments(commandArgv, commandArgvLen, strKeys, argc, argv, argvlen, bSource);
+    return redisAsyncCommandArgv(ac, fn, privdata, static_cast<int>(commandArgv.size()), commandArgv.data(), commandArgvLen.data());
+}
@@ -0,0 +1,61 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisScript;
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "hiredis.h"
+#include "async.h"
+
+//
+// Server side lua script run through EVALSHA. The hash is computed up
+// front, the source is only sent when the server reports NOSCRIPT
+// (first use, restart, SCRIPT FLUSH, failover).
+//
+// Immutable once constructed, shared freely between threads.
+//
+class CRedisScript
+{
+public:
+    CRedisScript(const char* szSource);
+
+    const char*        GetSource() const { return m_szSource; };
+    const std::string& GetSha1() const { return m_strSha1; };
+
+    // Blocking. argv holds the keys followed by the other arguments.
+    redisReply* Call(redisContext* c, int iKeys, int argc, const char** argv, const size_t* argvlen) const;
+
+    // I/O thread. Retry with bSource when the reply is NOSCRIPT.
+    int CallAsync(redisAsyncContext* ac, redisCallbackFn* fn, void* privdata, int iKeys, int argc, const char** argv, const size_t* argvlen,
+                  bool bSource = false) const;
+
+    // EVALSHA (EVAL with bSource) command line for requests sent elsewhere,
+    // outArgv points into strKeys and argv
+    void FormatArguments(std::vector<const char*>& outArgv, std::vector<size_t>& outArgvLen, const std::string& strKeys, int argc, const char** argv,
+                         const size_t* argvlen, bool bSource) const;
+
+    static bool IsNoScript(const redisReply* reply);
+
+private:
+    const char* m_szSource;
+    std::string m_strSha1;
+};
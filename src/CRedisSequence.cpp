@@ -0,0 +1,116 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisSequence.h"
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+// Share of a block left when the next one is fetched
+#define SEQUENCE_PREFETCH_DIVISOR 4
+
+static bool GetBlock(const redisReply* pReply, long long llSize, long long& llNext, long long& llEnd)
+{
+    if (!pReply || pReply->type != REDIS_REPLY_INTEGER)
+        return false;
+
+    // INCRBY answers with the last id of the block
+    llEnd = pReply->integer + 1;
+    llNext = llEnd - llSize;
+    return true;
+}
+
+CRedisSequence::CRedisSequence(const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey) : m_pClient(pClient), m_strKey(strKey)
+{
+    m_uiBlockSize = 1;
+    m_Current = {0, 0};
+    m_Next = {0, 0};
+    m_bFetching = false;
+    m_uiFetchSize = 0;
+}
+
+bool CRedisSequence::Next(unsigned int uiBlockSize, long long& llId, std::string& strError)
+{
+    // Takes effect with the next reservation
+    m_uiBlockSize = uiBlockSize;
+
+    if (m_Current.llNext == m_Current.llEnd)
+    {
+        if (m_Next.llNext != m_Next.llEnd)
+        {
+            m_Current = m_Next;
+            m_Next = {0, 0};
+        }
+        else if (!Reserve(strError))
+            return false;
+    }
+
+    llId = m_Current.llNext++;
+
+    long long llLeft = m_Current.llEnd - m_Current.llNext;
+    if (llLeft <= static_cast<long long>(m_uiBlockSize / SEQUENCE_PREFETCH_DIVISOR) && m_Next.llNext == m_Next.llEnd && !m_bFetching)
+        Prefetch();
+    return true;
+}
+
+bool CRedisSequence::Reserve(std::string& strError)
+{
+    // Ran dry before the prefetched block arrived, it is kept for later
+    std::string strSize = std::to_string(m_uiBlockSize);
+    const char* argv[] = {"INCRBY", m_strKey.c_str(), strSize.c_str()};
+    size_t      argvlen[] = {6, m_strKey.length(), strSize.length()};
+
+    redisReply* pReply = m_pClient->Command(3, argv, argvlen, 0, strError);
+    bool        bSuccess = GetBlock(pReply, m_uiBlockSize, m_Current.llNext, m_Current.llEnd);
+    if (!bSuccess && pReply)
+        strError = pReply->type == REDIS_REPLY_ERROR ? pReply->str : "Unexpected reply";
+
+    if (pReply)
+        freeReplyObject(pReply);
+    return bSuccess;
+}
+
+void CRedisSequence::Prefetch()
+{
+    std::string strSize = std::to_string(m_uiBlockSize);
+    const char* argv[] = {"INCRBY", m_strKey.c_str(), strSize.c_str()};
+    size_t      argvlen[] = {6, m_strKey.length(), strSize.length()};
+    m_uiFetchSize = m_uiBlockSize;
+
+    // Dispatched ahead of normal traffic, every pulse it waits makes a blocking reservation likelier
+    CRedisRequest* pRequest = pRedisManager->AcquireRequest();
+    pRequest->luaVM = m_pClient->GetLuaVM();
+    pRequest->pHandler = shared_from_this();
+    pRequest->ePriority = PRIORITY_HIGH;
+    m_bFetching = pRequest->SetCommand(3, argv, argvlen) && pRedisManager->Send(m_pClient.get(), pRequest);
+    if (!m_bFetching)
+        pRedisManager->ReleaseRequest(pRequest);
+}
+
+void CRedisSequence::Dispatch(CRedisRequest* pRequest)
+{
+    m_bFetching = false;
+
+    // Sized as sent, the block size may have changed since
+    if (!GetBlock(pRequest->pReply, m_uiFetchSize, m_Next.llNext, m_Next.llEnd))
+    {
+        m_Next = {0, 0};
+        pModuleManager->ErrorPrintf("Redis Module: can't reserve ids for %s: %s\n", m_strKey.c_str(),
+                                    pRequest->pReply && pRequest->pReply->str ? pRequest->pReply->str : pRequest->strError.c_str());
+    }
+}
@@ -0,0 +1,70 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisSequence;
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Common.h"
+#include "CRedisHandler.h"
+#include "hiredis.h"
+
+class CRedisClient;
+class CRedisRequest;
+
+//
+// Counter handing out ids from blocks reserved with INCRBY, unique across
+// every server sharing the key. Once a block is mostly used up the next
+// one is fetched in the background, only running dry before it arrives
+// costs a blocking round trip. Ids left in a block when it is dropped are
+// never handed out, so a sequence has gaps but never repeats.
+//
+class CRedisSequence : public CRedisHandler, public std::enable_shared_from_this<CRedisSequence>
+{
+public:
+    CRedisSequence(const std::shared_ptr<CRedisClient>& pClient, const std::string& strKey);
+
+    // Main thread. False with strError set when no block could be reserved.
+    bool Next(unsigned int uiBlockSize, long long& llId, std::string& strError);
+
+    void Dispatch(CRedisRequest* pRequest);
+    bool IsCancelled() const { return false; };
+
+    CRedisClient* GetClient() const { return m_pClient.get(); };
+
+private:
+    struct SBlock
+    {
+        long long llNext;
+        long long llEnd;            // one past the last id
+    };
+
+    void Prefetch();
+    bool Reserve(std::string& strError);
+
+    std::shared_ptr<CRedisClient> m_pClient;
+    std::string                   m_strKey;
+    unsigned int                  m_uiBlockSize;
+    SBlock                        m_Current;
+    SBlock                        m_Next;                // reserved in the background, empty until it arrives
+    bool                          m_bFetching;
+    unsigned int                  m_uiFetchSize;            // block size of the INCRBY in flight
+};
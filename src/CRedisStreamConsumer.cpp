@@ -0,0 +1,200 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisStreamConsumer.h"
+#include "CRedisRequest.h"
+#include "extra/CLuaReply.h"
+
+#include <cstring>
+
+// Back off after a server error instead of spinning on it
+#define CONSUMER_ERROR_DELAY 1000
+
+CRedisStreamConsumer::CRedisStreamConsumer(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strStream,
+                                           const std::string& strGroup, const std::string& strConsumer, unsigned int uiCount, unsigned int uiBlockMs)
+    : CRedisWorker(luaVM, pOwner, std::move(callback))
+{
+    m_strStream = strStream;
+    m_strGroup = strGroup;
+    m_strConsumer = strConsumer;
+    m_uiCount = uiCount;
+    m_uiBlockMs = uiBlockMs;
+    m_bGroupReady = false;
+    m_bReadPending = true;
+    m_strPendingCursor = "0";
+    m_bBatchInFlight = false;
+}
+
+void CRedisStreamConsumer::OnConnected()
+{
+    // Pending entries survive reconnects, pick them up again
+    m_bReadPending = true;
+    m_strPendingCursor = "0";
+}
+
+bool CRedisStreamConsumer::CreateGroup(redisContext* c)
+{
+    const char* argv[] = {"XGROUP", "CREATE", m_strStream.c_str(), m_strGroup.c_str(), "$", "MKSTREAM"};
+    redisReply* reply = static_cast<redisReply*>(redisCommandArgv(c, 6, argv, NULL));
+    if (!reply)
+        return false;
+
+    // BUSYGROUP just means somebody else created it already
+    m_bGroupReady = reply->type != REDIS_REPLY_ERROR || strncmp(reply->str, "BUSYGROUP", 9) == 0;
+    freeReplyObject(reply);
+    return true;
+}
+
+bool CRedisStreamConsumer::Acknowledge(redisContext* c)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_SendingAcks.swap(m_Acks);
+    }
+    if (m_SendingAcks.empty())
+        return true;
+
+    std::vector<const char*> argv = {"XACK", m_strStream.c_str(), m_strGroup.c_str()};
+    for (const std::string& strId : m_SendingAcks)
+        argv.push_back(strId.c_str());
+
+    redisReply* reply = static_cast<redisReply*>(redisCommandArgv(c, static_cast<int>(argv.size()), argv.data(), NULL));
+    if (!reply)
+    {
+        // Put them back, they go out again after the reconnect
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Acks.insert(m_Acks.end(), m_SendingAcks.begin(), m_SendingAcks.end());
+        m_SendingAcks.clear();
+        return false;
+    }
+
+    freeReplyObject(reply);
+    m_SendingAcks.clear();
+    return true;
+}
+
+bool CRedisStreamConsumer::Work(redisContext* c)
+{
+    if (!m_bGroupReady)
+    {
+        if (!CreateGroup(c))
+            return false;
+        if (!m_bGroupReady)
+            return Sleep(CONSUMER_ERROR_DELAY);
+    }
+
+    if (!Acknowledge(c))
+        return false;
+
+    std::string strCount = std::to_string(m_uiCount);
+    std::string strBlock = std::to_string(m_uiBlockMs);
+    const char* argv[] = {"XREADGROUP", "GROUP", m_strGroup.c_str(), m_strConsumer.c_str(), "COUNT", strCount.c_str(), "BLOCK", strBlock.c_str(),
+                          "STREAMS", m_strStream.c_str(), m_bReadPending ? m_strPendingCursor.c_str() : ">"};
+    redisReply* reply = static_cast<redisReply*>(redisCommandArgv(c, 11, argv, NULL));
+    if (!reply)
+        return false;
+
+    if (reply->type == REDIS_REPLY_ERROR)
+    {
+        // The stream or group was deleted under us
+        if (strncmp(reply->str, "NOGROUP", 7) == 0)
+            m_bGroupReady = false;
+        freeReplyObject(reply);
+        return Sleep(CONSUMER_ERROR_DELAY);
+    }
+
+    // *1 [stream, [[id, [field, value, ...]], ...]] or nil on timeout
+    size_t sizeEntries = 0;
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 1 && reply->element[0]->elements == 2)
+        sizeEntries = reply->element[0]->element[1]->elements;
+
+    if (sizeEntries == 0)
+    {
+        m_bReadPending = false;
+        freeReplyObject(reply);
+        return true;
+    }
+
+    // Entries the script refuses stay pending, don't read them again in a loop
+    if (m_bReadPending)
+    {
+        redisReply* last = reply->element[0]->element[1]->element[sizeEntries - 1]->element[0];
+        m_strPendingCursor.assign(last->str, last->len);
+    }
+
+    // Hand the batch over and wait for the script before acking and reading on
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bBatchInFlight = true;
+    }
+    Deliver(reply);
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Condition.wait(lock, [this]() { return !m_bBatchInFlight || IsStopping(); });
+    return true;
+}
+
+void CRedisStreamConsumer::Dispatch(CRedisRequest* pRequest)
+{
+    lua_State*  luaVM = GetLuaVM();
+    redisReply* entries = pRequest->pReply->element[0]->element[1];
+    int         iTop = lua_gettop(luaVM);
+    bool        bAcknowledge = false;
+
+    if (m_Callback.Push())
+    {
+        // { {id = "...", fields = {field = value}}, ... }
+        lua_createtable(luaVM, static_cast<int>(entries->elements), 0);
+        for (size_t i = 0; i < entries->elements; i++)
+        {
+            redisReply* entry = entries->element[i];
+            lua_createtable(luaVM, 0, 2);
+            CLuaReply::Push(luaVM, entry->element[0]);
+            lua_setfield(luaVM, -2, "id");
+
+            // Deleted entries still pending come back without fields
+            lua_newtable(luaVM);
+            redisReply* fields = entry->elements > 1 ? entry->element[1] : NULL;
+            for (size_t j = 0; fields && j + 1 < fields->elements; j += 2)
+            {
+                CLuaReply::Push(luaVM, fields->element[j]);
+                CLuaReply::Push(luaVM, fields->element[j + 1]);
+                lua_rawset(luaVM, -3);
+            }
+            lua_setfield(luaVM, -2, "fields");
+            lua_rawseti(luaVM, -2, static_cast<int>(i + 1));
+        }
+
+        // Returning false keeps the batch pending in the group
+        if (CLuaFunctionRef::Call(luaVM, 1, 1))
+            bAcknowledge = !(lua_isboolean(luaVM, -1) && !lua_toboolean(luaVM, -1));
+    }
+    lua_settop(luaVM, iTop);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (bAcknowledge)
+    {
+        for (size_t i = 0; i < entries->elements; i++)
+        {
+            redisReply* id = entries->element[i]->element[0];
+            m_Acks.emplace_back(id->str, id->len);
+        }
+    }
+    m_bBatchInFlight = false;
+    m_Condition.notify_all();
+}
@@ -0,0 +1,64 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisStreamConsumer;
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "CRedisWorker.h"
+
+//
+// Consumer group member reading a stream with XREADGROUP BLOCK. One batch
+// is in flight at a time: the worker waits until the script callback has
+// returned, acks the batch and only then reads the next one.
+//
+class CRedisStreamConsumer : public CRedisWorker
+{
+public:
+    CRedisStreamConsumer(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback, const std::string& strStream, const std::string& strGroup,
+                         const std::string& strConsumer, unsigned int uiCount, unsigned int uiBlockMs);
+
+    void Dispatch(CRedisRequest* pRequest);
+
+protected:
+    bool Work(redisContext* c);
+    void OnConnected();
+
+private:
+    bool CreateGroup(redisContext* c);
+    bool Acknowledge(redisContext* c);
+
+    std::string  m_strStream;
+    std::string  m_strGroup;
+    std::string  m_strConsumer;
+    unsigned int m_uiCount;
+    unsigned int m_uiBlockMs;
+
+    // Worker thread
+    bool        m_bGroupReady;
+    bool        m_bReadPending;            // own pending entries first, left unacked by a previous run
+    std::string m_strPendingCursor;
+
+    // Guarded by m_Mutex
+    bool                     m_bBatchInFlight;
+    std::vector<std::string> m_Acks;
+    std::vector<std::string> m_SendingAcks;            // worker thread
+};
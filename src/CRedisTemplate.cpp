@@ -0,0 +1,112 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisTemplate.h"
+
+#include <charconv>
+#include <new>
+
+#define TEMPLATE_METATABLE "redis.template"
+#define TEMPLATE_PLACEHOLDER "?"
+
+CRedisTemplate::CRedisTemplate(const std::vector<std::string_view>& arguments)
+{
+    std::string strSegment = "*" + std::to_string(arguments.size()) + "\r\n";
+    for (const std::string_view& strArgument : arguments)
+    {
+        if (strArgument == TEMPLATE_PLACEHOLDER)
+        {
+            m_Segments.push_back(std::move(strSegment));
+            strSegment.clear();
+            continue;
+        }
+        AppendBulk(strSegment, strArgument.data(), strArgument.length());
+    }
+    m_Segments.push_back(std::move(strSegment));
+}
+
+void CRedisTemplate::AppendBulk(std::string& strBuffer, const char* szValue, size_t sizeValue)
+{
+    char szLength[24];
+    auto result = std::to_chars(szLength, szLength + sizeof(szLength), sizeValue);
+    strBuffer += '$';
+    strBuffer.append(szLength, result.ptr);
+    strBuffer.append("\r\n", 2);
+    strBuffer.append(szValue, sizeValue);
+    strBuffer.append("\r\n", 2);
+}
+
+bool CRedisTemplate::Format(lua_State* luaVM, int iFirst, std::string& strBuffer) const
+{
+    strBuffer.assign(m_Segments[0]);
+    for (size_t i = 1; i < m_Segments.size(); i++)
+    {
+        int iIndex = iFirst + static_cast<int>(i) - 1;
+        int iType = lua_type(luaVM, iIndex);
+        if (iType != LUA_TSTRING && iType != LUA_TNUMBER)
+            return false;
+
+        size_t      sizeValue = 0;
+        const char* szValue = lua_tolstring(luaVM, iIndex, &sizeValue);
+        AppendBulk(strBuffer, szValue, sizeValue);
+        strBuffer.append(m_Segments[i]);
+    }
+    return true;
+}
+
+void CRedisTemplate::Push(lua_State* luaVM, const std::vector<std::string_view>& arguments)
+{
+    lua_checkstack(luaVM, 3);
+    new (lua_newuserdata(luaVM, sizeof(CRedisTemplate))) CRedisTemplate(arguments);
+
+    if (luaL_newmetatable(luaVM, TEMPLATE_METATABLE))
+    {
+        lua_pushcfunction(luaVM, Collect);
+        lua_setfield(luaVM, -2, "__gc");
+        lua_pushcfunction(luaVM, ToString);
+        lua_setfield(luaVM, -2, "__tostring");
+    }
+    lua_setmetatable(luaVM, -2);
+}
+
+CRedisTemplate* CRedisTemplate::Get(lua_State* luaVM, int iIndex)
+{
+    void* pData = lua_touserdata(luaVM, iIndex);
+    if (!pData || lua_type(luaVM, iIndex) != LUA_TUSERDATA || !lua_getmetatable(luaVM, iIndex))
+        return NULL;
+
+    luaL_getmetatable(luaVM, TEMPLATE_METATABLE);
+    bool bTemplate = lua_rawequal(luaVM, -1, -2) != 0;
+    lua_pop(luaVM, 2);
+    return bTemplate ? static_cast<CRedisTemplate*>(pData) : NULL;
+}
+
+int CRedisTemplate::Collect(lua_State* luaVM)
+{
+    CRedisTemplate* pTemplate = Get(luaVM, 1);
+    if (pTemplate)
+        pTemplate->~CRedisTemplate();
+    return 0;
+}
+
+int CRedisTemplate::ToString(lua_State* luaVM)
+{
+    CRedisTemplate* pTemplate = Get(luaVM, 1);
+    lua_pushfstring(luaVM, "redis template: %d placeholders", pTemplate ? static_cast<int>(pTemplate->GetPlaceholderCount()) : 0);
+    return 1;
+}
@@ -0,0 +1,56 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisTemplate;
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Common.h"
+
+//
+// Command shape encoded once. The constant arguments are kept as ready
+// RESP pieces around the placeholders ("?" arguments), so a call only
+// appends the placeholder values taken straight from the lua stack.
+//
+// Lives in a full userdata owned by lua, see Push and Get.
+//
+class CRedisTemplate
+{
+public:
+    CRedisTemplate(const std::vector<std::string_view>& arguments);
+
+    size_t GetPlaceholderCount() const { return m_Segments.size() - 1; };
+
+    // Replaces strBuffer with the command for the values at iFirst and up,
+    // false when one isn't a string or number
+    bool Format(lua_State* luaVM, int iFirst, std::string& strBuffer) const;
+
+    static void            Push(lua_State* luaVM, const std::vector<std::string_view>& arguments);
+    static CRedisTemplate* Get(lua_State* luaVM, int iIndex);            // NULL for anything else
+
+private:
+    static void AppendBulk(std::string& strBuffer, const char* szValue, size_t sizeValue);
+    static int  Collect(lua_State* luaVM);
+    static int  ToString(lua_State* luaVM);
+
+    std::vector<std::string> m_Segments;            // one more than placeholders
+};
@@ -0,0 +1,135 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CRedisWorker.h"
+#include "CRedisClient.h"
+#include "CRedisManager.h"
+#include "CRedisRequest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sys/socket.h>
+
+// Delay between reconnect attempts, doubled up to the maximum
+#define WORKER_RECONNECT_DELAY     250
+#define WORKER_RECONNECT_DELAY_MAX 5000
+#define WORKER_CONNECT_TIMEOUT     2
+
+CRedisWorker::CRedisWorker(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback) : m_Callback(std::move(callback))
+{
+    m_uiId = 0;
+    m_luaVM = CLuaFunctionRef::GetMainState(luaVM);
+    m_pOwner = pOwner;
+    m_strHost = pOwner->GetHost();
+    m_iPort = pOwner->GetPort();
+    m_bStarted = false;
+    m_bFinished = false;
+    m_pContext = NULL;
+}
+
+CRedisWorker::~CRedisWorker()
+{
+    Stop();
+    Join();
+}
+
+bool CRedisWorker::Startup()
+{
+    m_ThreadData.bAbortThread = false;
+    m_bStarted = Start(&m_ThreadData);
+    if (!m_bStarted)
+        m_bFinished = true;
+    return m_bStarted;
+}
+
+void CRedisWorker::Stop()
+{
+    // The lua state may be about to go away, drop our reference right now
+    if (m_Callback.IsValid())
+        m_Callback.Release();
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ThreadData.bAbortThread = true;
+
+    // Kick the thread out of a blocking read, it owns and frees the context
+    if (m_pContext)
+        shutdown(m_pContext->fd, SHUT_RDWR);
+    m_Condition.notify_all();
+}
+
+int CRedisWorker::Execute(CThreadData* pData)
+{
+    unsigned int uiDelay = WORKER_RECONNECT_DELAY;
+
+    while (!pData->bAbortThread)
+    {
+        timeval timeout = {WORKER_CONNECT_TIMEOUT, 0};
+        redisContext* c = redisConnectWithTimeout(m_strHost.c_str(), m_iPort, timeout);
+        if (!c || c->err)
+        {
+            if (c)
+                redisFree(c);
+
+            Sleep(uiDelay);
+            uiDelay = std::min(uiDelay * 2, (unsigned int)WORKER_RECONNECT_DELAY_MAX);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (pData->bAbortThread)
+            {
+                redisFree(c);
+                break;
+            }
+            m_pContext = c;
+        }
+
+        uiDelay = WORKER_RECONNECT_DELAY;
+        OnConnected();
+        while (!pData->bAbortThread && Work(c))
+            ;
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_pContext = NULL;
+        }
+        redisFree(c);
+    }
+
+    OnFinished();
+    m_bFinished = true;
+    return 0;
+}
+
+void CRedisWorker::Deliver(redisReply* pReply)
+{
+    // Not from the pool, that one belongs to the main thread
+    CRedisRequest* pRequest = new CRedisRequest();
+    pRequest->pHandler = shared_from_this();
+    pRequest->luaVM = m_luaVM;
+    pRequest->pReply = pReply;
+    pRedisManager->Complete(pRequest);
+}
+
+bool CRedisWorker::Sleep(unsigned int uiMilliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Condition.wait_for(lock, std::chrono::milliseconds(uiMilliseconds), [this]() { return (bool)m_ThreadData.bAbortThread; });
+    return !m_ThreadData.bAbortThread;
+}
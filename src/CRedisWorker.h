@@ -0,0 +1,95 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+class CRedisWorker;
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Common.h"
+#include "CRedisHandler.h"
+#include "CThread.h"
+#include "CThreadData.h"
+#include "extra/CLuaFunctionRef.h"
+#include "hiredis.h"
+
+class CRedisClient;
+class CRedisRequest;
+
+//
+// Background thread owning a blocking connection of its own, for commands
+// that wait on the server (XREADGROUP BLOCK, BLPOP, ...). Results travel to
+// the main thread as requests through the completion queue and come back
+// to Dispatch() from DoPulse.
+//
+// Workers are owned by CRedisManager, Stop() never blocks: the socket is
+// shut down to break out of the pending read and the thread is reaped once
+// it has finished.
+//
+class CRedisWorker : public CThread, public CRedisHandler, public std::enable_shared_from_this<CRedisWorker>
+{
+public:
+    CRedisWorker(lua_State* luaVM, CRedisClient* pOwner, CLuaFunctionRef&& callback);
+    virtual ~CRedisWorker();
+
+    // Main thread
+    bool Startup();
+    void Stop();
+    bool IsStopping() const { return m_ThreadData.bAbortThread; };
+    bool IsFinished() const { return m_bFinished; };
+
+    void          SetId(unsigned int uiId) { m_uiId = uiId; };
+    unsigned int  GetId() const { return m_uiId; };
+    lua_State*    GetLuaVM() const { return m_luaVM; };
+    CRedisClient* GetOwner() const { return m_pOwner; };
+
+    bool         IsCancelled() const { return IsStopping(); };
+    virtual void Pulse() {};            // once per DoPulse, and right before Stop() from the manager
+
+protected:
+    int Execute(CThreadData* pData);
+
+    // Worker thread. Returning false drops the connection and reconnects.
+    virtual bool Work(redisContext* c) = 0;
+    virtual void OnConnected() {};
+    virtual void OnFinished() {};
+
+    // Worker thread
+    void Deliver(redisReply* pReply);
+    bool Sleep(unsigned int uiMilliseconds);
+
+    CLuaFunctionRef         m_Callback;            // main thread only
+    std::mutex              m_Mutex;
+    std::condition_variable m_Condition;
+
+private:
+    unsigned int      m_uiId;
+    lua_State*        m_luaVM;
+    CRedisClient*     m_pOwner;
+    std::string       m_strHost;
+    int               m_iPort;
+    CThreadData       m_ThreadData;
+    std::atomic<bool> m_bStarted;
+    std::atomic<bool> m_bFinished;
+    redisContext*     m_pContext;            // guarded by m_Mutex
+};
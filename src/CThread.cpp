@@ -22,9 +22,7 @@ CThread::CThread()
 {
     m_pThreadData = NULL;
     m_pArg = NULL;
-#ifdef WIN32    // Win32 threads
-    m_hThread = NULL;
-#endif
+    m_hThread = 0;
 }
 
 CThread::~CThread()
@@ -63,6 +61,20 @@ void CThread::Stop()
     }
 }
 
+void CThread::Join()
+{
+    if (!m_hThread)
+        return;
+
+    #ifdef WIN32    // Win32 threads
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    #else           // POSIX threads
+    pthread_join(m_hThread, NULL);
+    #endif
+    m_hThread = 0;
+}
+
 bool CThread::TryLock(ThreadMutex* Mutex)
 {
     #ifdef WIN32
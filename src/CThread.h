@@ -46,6 +46,7 @@ public:
 
     bool Start(CThreadData* pData);
     void Stop();
+    void Join();
 
     static bool TryLock(ThreadMutex* Mutex);
     static void Lock(ThreadMutex* Mutex);
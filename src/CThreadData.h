@@ -20,6 +20,7 @@ class CThreadData;
 
 #pragma once
 
+#include <atomic>
 #include "CThread.h"
 
 class CThreadData
@@ -28,7 +29,7 @@ public:
     CThreadData();
     ~CThreadData();
 
-    bool        bAbortThread;
-    ThreadMutex MutexPrimary;            // primary mutex for suspend/resume operations
-    ThreadMutex MutexLogical;            // logical mutex for proper CThreadData sync
+    std::atomic<bool> bAbortThread;
+    ThreadMutex       MutexPrimary;            // primary mutex for suspend/resume operations
+    ThreadMutex       MutexLogical;            // logical mutex for proper CThreadData sync
 };
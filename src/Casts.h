@@ -3,12 +3,19 @@
 #include <string>
 #include "hiredis.h"
 
+class CRedisClient;
+
 // class -> class name
 inline std::string GetClassTypeName(redisContext*)
 {
     return "redis-context";
 }
 
+inline std::string GetClassTypeName(CRedisClient*)
+{
+    return "redis-client";
+}
+
 //
 // T from userdata
 //
@@ -17,3 +24,9 @@ T* UserDataCast(T*, void* ptr, lua_State*)
 {
     return reinterpret_cast<T*>(ptr);
 }
+
+//
+// CRedisClient from userdata, rejects clients already destroyed
+//
+template <>
+CRedisClient* UserDataCast<CRedisClient>(CRedisClient*, void* ptr, lua_State*);
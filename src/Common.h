@@ -23,6 +23,12 @@ extern "C"
     #include <lauxlib.h>
 }
 
+// The event loop and the workers use POSIX sockets, pipes and poll, like the
+// vendored hiredis 0.14.1 does. Windows needs ports of both first.
+#if defined(WIN32) || defined(_WIN32)
+    #error "ml_redis builds on POSIX systems only (Linux, macOS)"
+#endif
+
 #ifdef WIN32
     #define MTAEXPORT extern "C" __declspec(dllexport)
 #else
@@ -19,26 +19,27 @@
 #include "CLuaArgument.h"
 #include <assert.h>
 #include <cstring>
+#include <utility>
 
 using namespace std;
 
 CLuaArgument::CLuaArgument()
 {
-    m_szString = NULL;
     m_iType = LUA_TNIL;
+    m_sizeString = 0;
 }
 
 CLuaArgument::CLuaArgument(bool bBool)
 {
-    m_szString = NULL;
     m_iType = LUA_TBOOLEAN;
+    m_sizeString = 0;
     m_bBoolean = bBool;
 }
 
 CLuaArgument::CLuaArgument(double dNumber)
 {
-    m_szString = NULL;
     m_iType = LUA_TNUMBER;
+    m_sizeString = 0;
     m_Number = dNumber;
 }
 
@@ -46,53 +47,73 @@ CLuaArgument::CLuaArgument(const char* szString)
 {
     assert(szString);
 
-    m_iType = LUA_TSTRING;
-    m_szString = new char[strlen(szString) + 1];
-    strcpy(m_szString, szString);
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
+    SetString(szString, strlen(szString));
+}
+
+CLuaArgument::CLuaArgument(const char* szString, size_t sizeLength)
+{
+    assert(szString || sizeLength == 0);
+
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
+    SetString(szString, sizeLength);
+}
+
+CLuaArgument::CLuaArgument(std::string_view strString)
+{
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
+    SetString(strString.data(), strString.length());
 }
 
 CLuaArgument::CLuaArgument(void* pUserData)
 {
-    m_szString = NULL;
     m_iType = LUA_TLIGHTUSERDATA;
+    m_sizeString = 0;
     m_pLightUserData = pUserData;
 }
 
 CLuaArgument::CLuaArgument(const CLuaArgument& Argument)
 {
     // Initialize and call our = on the argument
-    m_szString = NULL;
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
     operator=(Argument);
 }
 
+CLuaArgument::CLuaArgument(CLuaArgument&& Argument) noexcept
+{
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
+    operator=(std::move(Argument));
+}
+
 CLuaArgument::CLuaArgument(lua_State* luaVM, unsigned int uiArgument)
 {
     // Read the argument out of the lua VM
-    m_szString = NULL;
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
     Read(luaVM, uiArgument);
 }
 
 CLuaArgument::~CLuaArgument()
 {
     // Eventually destroy our string
-    if (m_szString)
-    {
-        delete[] m_szString;
-    }
+    Clear();
 }
 
-const CLuaArgument& CLuaArgument::operator=(const CLuaArgument& Argument)
+CLuaArgument& CLuaArgument::operator=(const CLuaArgument& Argument)
 {
+    if (this == &Argument)
+        return *this;
+
     // Destroy our old string if neccessary
-    if (m_szString)
-    {
-        delete[] m_szString;
-        m_szString = NULL;
-    }
+    Clear();
 
     // Set our variable equally to the copy class
-    m_iType = Argument.m_iType;
-    switch (m_iType)
+    switch (Argument.m_iType)
     {
         case LUA_TBOOLEAN:
         {
@@ -114,24 +135,37 @@ const CLuaArgument& CLuaArgument::operator=(const CLuaArgument& Argument)
 
         case LUA_TSTRING:
         {
-            if (Argument.m_szString)
-            {
-                m_szString = new char[strlen(Argument.m_szString) + 1];
-                strcpy(m_szString, Argument.m_szString);
-            }
-
+            SetString(Argument.GetString(), Argument.m_sizeString);
             break;
         }
 
         default:
             break;
     }
+    m_iType = Argument.m_iType;
+
+    // Return ourselves allowing for chaining
+    return *this;
+}
+
+CLuaArgument& CLuaArgument::operator=(CLuaArgument&& Argument) noexcept
+{
+    if (this == &Argument)
+        return *this;
+
+    Clear();
+
+    // Steal the heap string if there is one, everything else is plain data
+    m_iType = Argument.m_iType;
+    m_sizeString = Argument.m_sizeString;
+    memcpy(m_szInlineString, Argument.m_szInlineString, sizeof(m_szInlineString));
 
-    // Return the given class allowing for chaining
-    return Argument;
+    Argument.m_iType = LUA_TNIL;
+    Argument.m_sizeString = 0;
+    return *this;
 }
 
-bool CLuaArgument::operator==(const CLuaArgument& Argument)
+bool CLuaArgument::operator==(const CLuaArgument& Argument) const
 {
     // If the types differ, they're not matching
     if (Argument.m_iType != m_iType)
@@ -157,43 +191,37 @@ bool CLuaArgument::operator==(const CLuaArgument& Argument)
 
         case LUA_TSTRING:
         {
-            if (m_szString)
-            {
-                if (Argument.m_szString)
-                    return strcmp(m_szString, Argument.m_szString) == 0;
-                else
-                    return false;
-            }
-            else
-            {
-                return Argument.m_szString == NULL;
-            }
+            return GetStringView() == Argument.GetStringView();
         }
     }
 
     return true;
 }
 
-bool CLuaArgument::operator!=(const CLuaArgument& Argument)
+bool CLuaArgument::operator!=(const CLuaArgument& Argument) const
 {
     return !(operator==(Argument));
 }
 
+const char* CLuaArgument::GetString() const
+{
+    if (m_iType != LUA_TSTRING)
+        return NULL;
+
+    return IsInlineString() ? m_szInlineString : m_pString;
+}
+
 void CLuaArgument::Read(lua_State* luaVM, unsigned int uiArgument)
 {
     // Eventually delete our previous string
-    if (m_szString)
-    {
-        delete[] m_szString;
-        m_szString = NULL;
-    }
+    Clear();
 
     // Grab the argument type
-    m_iType = lua_type(luaVM, uiArgument);
-    if (m_iType != LUA_TNONE)
+    int iType = lua_type(luaVM, uiArgument);
+    if (iType != LUA_TNONE)
     {
         // Read out the content depending on the type
-        switch (m_iType)
+        switch (iType)
         {
             case LUA_TNIL:
                 break;
@@ -218,23 +246,21 @@ void CLuaArgument::Read(lua_State* luaVM, unsigned int uiArgument)
 
             case LUA_TSTRING:
             {
-                // Grab the lua string and its size
-                const char* szLuaString = lua_tostring(luaVM, uiArgument);
-                size_t      sizeLuaString = strlen(szLuaString);
-
-                // Allocate our buffer
-                m_szString = new char[sizeLuaString + 1];
-                strcpy(m_szString, szLuaString);
+                // Grab the lua string and its size, it may contain zeros
+                size_t      sizeLuaString = 0;
+                const char* szLuaString = lua_tolstring(luaVM, uiArgument, &sizeLuaString);
+                SetString(szLuaString, sizeLuaString);
                 break;
             }
 
             default:
             {
-                m_iType = LUA_TNONE;
+                iType = LUA_TNONE;
                 break;
             }
         }
     }
+    m_iType = iType;
 }
 
 void CLuaArgument::Push(lua_State* luaVM) const
@@ -271,18 +297,36 @@ void CLuaArgument::Push(lua_State* luaVM) const
 
             case LUA_TSTRING:
             {
-                // Push the string if we got any
-                if (m_szString)
-                {
-                    lua_pushstring(luaVM, m_szString);
-                }
-                else
-                {
-                    lua_pushstring(luaVM, "");
-                }
-
+                lua_pushlstring(luaVM, GetString(), m_sizeString);
                 break;
             }
         }
     }
 }
+
+void CLuaArgument::SetString(const char* szString, size_t sizeLength)
+{
+    Clear();
+
+    m_sizeString = sizeLength;
+    char* szTarget = m_szInlineString;
+    if (!IsInlineString())
+    {
+        m_pString = new char[sizeLength + 1];
+        szTarget = m_pString;
+    }
+
+    if (sizeLength)
+        memcpy(szTarget, szString, sizeLength);
+    szTarget[sizeLength] = 0;
+    m_iType = LUA_TSTRING;
+}
+
+void CLuaArgument::Clear()
+{
+    if (m_iType == LUA_TSTRING && !IsInlineString())
+        delete[] m_pString;
+
+    m_iType = LUA_TNIL;
+    m_sizeString = 0;
+}
@@ -22,7 +22,13 @@ extern "C"
 {
     #include <lua.h>
 }
+#include <cstddef>
+#include <string_view>
 
+//
+// Value type holding one lua argument. Strings carry an explicit length
+// (binary safe) and short ones live inline without touching the heap.
+//
 class CLuaArgument
 {
 public:
@@ -30,29 +36,46 @@ public:
     CLuaArgument(bool bBool);
     CLuaArgument(double dNumber);
     CLuaArgument(const char* szString);
+    CLuaArgument(const char* szString, size_t sizeLength);
+    CLuaArgument(std::string_view strString);
     CLuaArgument(void* pUserData);
     CLuaArgument(const CLuaArgument& Argument);
+    CLuaArgument(CLuaArgument&& Argument) noexcept;
     CLuaArgument(lua_State* luaVM, unsigned int uiArgument);
     ~CLuaArgument();
 
-    const CLuaArgument& operator=(const CLuaArgument& Argument);
-    bool                operator==(const CLuaArgument& Argument);
-    bool                operator!=(const CLuaArgument& Argument);
+    CLuaArgument& operator=(const CLuaArgument& Argument);
+    CLuaArgument& operator=(CLuaArgument&& Argument) noexcept;
+    bool          operator==(const CLuaArgument& Argument) const;
+    bool          operator!=(const CLuaArgument& Argument) const;
 
     void Read(lua_State* luaVM, unsigned int uiArgument);
     void Push(lua_State* luaVM) const;
 
     int GetType() const { return m_iType; };
 
-    bool        GetBoolean() const { return m_bBoolean; };
-    lua_Number  GetNumber() const { return m_Number; };
-    const char* GetString() const { return m_szString; };
-    void*       GetLightUserData() const { return m_pLightUserData; };
+    bool             GetBoolean() const { return m_bBoolean; };
+    lua_Number       GetNumber() const { return m_Number; };
+    const char*      GetString() const;
+    size_t           GetStringLength() const { return m_iType == LUA_TSTRING ? m_sizeString : 0; };
+    std::string_view GetStringView() const { return std::string_view(GetString() ? GetString() : "", GetStringLength()); };
+    void*            GetLightUserData() const { return m_pLightUserData; };
 
 private:
-    int        m_iType;
-    bool       m_bBoolean;
-    lua_Number m_Number;
-    char*      m_szString;
-    void*      m_pLightUserData;
+    static const size_t INLINE_STRING_CAPACITY = 24;            // including the terminator
+
+    void SetString(const char* szString, size_t sizeLength);
+    void Clear();
+    bool IsInlineString() const { return m_sizeString < INLINE_STRING_CAPACITY; };
+
+    int    m_iType;
+    size_t m_sizeString;
+    union
+    {
+        bool       m_bBoolean;
+        lua_Number m_Number;
+        void*      m_pLightUserData;
+        char*      m_pString;
+        char       m_szInlineString[INLINE_STRING_CAPACITY];
+    };
 };
@@ -18,33 +18,29 @@
 
 #include "CLuaArguments.h"
 #include <assert.h>
+#include <utility>
 
-CLuaArguments::CLuaArguments(const CLuaArguments& Arguments)
+CLuaArguments::CLuaArguments(const CLuaArguments& Arguments) : m_Arguments(Arguments.m_Arguments)
 {
-    // Copy all the arguments
-    vector<CLuaArgument*>::const_iterator iter = Arguments.m_Arguments.begin();
-    for (; iter != Arguments.m_Arguments.end(); iter++)
-    {
-        CLuaArgument* pArgument = new CLuaArgument(**iter);
-        m_Arguments.push_back(pArgument);
-    }
 }
 
-const CLuaArguments& CLuaArguments::operator=(const CLuaArguments& Arguments)
+CLuaArguments::CLuaArguments(CLuaArguments&& Arguments) noexcept : m_Arguments(std::move(Arguments.m_Arguments))
 {
-    // Clear our previous list if any
-    DeleteArguments();
+}
 
-    // Copy all the arguments
-    vector<CLuaArgument*>::const_iterator iter = Arguments.m_Arguments.begin();
-    for (; iter != Arguments.m_Arguments.end(); iter++)
-    {
-        CLuaArgument* pArgument = new CLuaArgument(**iter);
-        m_Arguments.push_back(pArgument);
-    }
+CLuaArguments& CLuaArguments::operator=(const CLuaArguments& Arguments)
+{
+    // Copy all the arguments, reusing our storage
+    m_Arguments = Arguments.m_Arguments;
 
-    // Return the given reference allowing for chaining
-    return Arguments;
+    // Return ourselves allowing for chaining
+    return *this;
+}
+
+CLuaArguments& CLuaArguments::operator=(CLuaArguments&& Arguments) noexcept
+{
+    m_Arguments = std::move(Arguments.m_Arguments);
+    return *this;
 }
 
 void CLuaArguments::ReadArguments(lua_State* luaVM, unsigned int uiIndexBegin)
@@ -53,32 +49,30 @@ void CLuaArguments::ReadArguments(lua_State* luaVM, unsigned int uiIndexBegin)
     DeleteArguments();
 
     // Start reading arguments until there are none left
+    int iTop = lua_gettop(luaVM);
+    if (iTop >= static_cast<int>(uiIndexBegin))
+        m_Arguments.reserve(iTop - uiIndexBegin + 1);
+
     while (lua_type(luaVM, uiIndexBegin) != LUA_TNONE)
     {
-        // Create an argument, let it read out the argument and add it to our vector
-        CLuaArgument* pArgument = new CLuaArgument(luaVM, uiIndexBegin++);
-        m_Arguments.push_back(pArgument);
+        // Let the argument read itself out in place
+        m_Arguments.emplace_back(luaVM, uiIndexBegin++);
     }
 }
 
 void CLuaArguments::PushArguments(lua_State* luaVM) const
 {
     // Push all our arguments
-    vector<CLuaArgument*>::const_iterator iter = m_Arguments.begin();
+    vector<CLuaArgument>::const_iterator iter = m_Arguments.begin();
     for (; iter != m_Arguments.end(); iter++)
     {
-        (*iter)->Push(luaVM);
+        iter->Push(luaVM);
     }
 }
 
-void CLuaArguments::PushArguments(CLuaArguments& Arguments)
+void CLuaArguments::PushArguments(const CLuaArguments& Arguments)
 {
-    vector<CLuaArgument*>::const_iterator iter = Arguments.IterBegin();
-    for (; iter != Arguments.IterEnd(); iter++)
-    {
-        CLuaArgument* pArgument = new CLuaArgument(**iter);
-        m_Arguments.push_back(pArgument);
-    }
+    m_Arguments.insert(m_Arguments.end(), Arguments.m_Arguments.begin(), Arguments.m_Arguments.end());
 }
 
 bool CLuaArguments::Call(lua_State* luaVM, const char* szFunction) const
@@ -97,8 +91,8 @@ bool CLuaArguments::Call(lua_State* luaVM, const char* szFunction) const
     int iret = lua_pcall(luaVM, m_Arguments.size(), 0, 0);
     if (iret == LUA_ERRRUN || iret == LUA_ERRMEM)
     {
-        const char* szRes = lua_tostring(luaVM, -1);
-        return false;            // the function call failed
+        lua_pop(luaVM, 1);            // error message
+        return false;                 // the function call failed
     }
 
     return true;
@@ -106,48 +100,42 @@ bool CLuaArguments::Call(lua_State* luaVM, const char* szFunction) const
 
 CLuaArgument* CLuaArguments::PushNil()
 {
-    CLuaArgument* pArgument = new CLuaArgument;
-    m_Arguments.push_back(pArgument);
-    return pArgument;
+    m_Arguments.emplace_back();
+    return &m_Arguments.back();
 }
 
 CLuaArgument* CLuaArguments::PushBoolean(bool bBool)
 {
-    CLuaArgument* pArgument = new CLuaArgument(bBool);
-    m_Arguments.push_back(pArgument);
-    return pArgument;
+    m_Arguments.emplace_back(bBool);
+    return &m_Arguments.back();
 }
 
 CLuaArgument* CLuaArguments::PushNumber(double dNumber)
 {
-    CLuaArgument* pArgument = new CLuaArgument(dNumber);
-    m_Arguments.push_back(pArgument);
-    return pArgument;
+    m_Arguments.emplace_back(dNumber);
+    return &m_Arguments.back();
 }
 
 CLuaArgument* CLuaArguments::PushString(const char* szString)
 {
-    CLuaArgument* pArgument = new CLuaArgument(szString);
-    m_Arguments.push_back(pArgument);
-    return pArgument;
+    m_Arguments.emplace_back(szString);
+    return &m_Arguments.back();
+}
+
+CLuaArgument* CLuaArguments::PushString(const char* szString, size_t sizeLength)
+{
+    m_Arguments.emplace_back(szString, sizeLength);
+    return &m_Arguments.back();
 }
 
 CLuaArgument* CLuaArguments::PushUserData(void* pUserData)
 {
-    CLuaArgument* pArgument = new CLuaArgument(pUserData);
-    m_Arguments.push_back(pArgument);
-    return pArgument;
+    m_Arguments.emplace_back(pUserData);
+    return &m_Arguments.back();
 }
 
 void CLuaArguments::DeleteArguments()
 {
-    // Delete each item
-    vector<CLuaArgument*>::iterator iter = m_Arguments.begin();
-    for (; iter != m_Arguments.end(); iter++)
-    {
-        delete *iter;
-    }
-
-    // Clear the vector
+    // Destroys the items but keeps the capacity for the next read
     m_Arguments.clear();
 }
@@ -33,27 +33,32 @@ class CLuaArguments
 public:
     CLuaArguments(){};
     CLuaArguments(const CLuaArguments& Arguments);
+    CLuaArguments(CLuaArguments&& Arguments) noexcept;
     ~CLuaArguments() { DeleteArguments(); };
 
-    const CLuaArguments& operator=(const CLuaArguments& Arguments);
+    CLuaArguments& operator=(const CLuaArguments& Arguments);
+    CLuaArguments& operator=(CLuaArguments&& Arguments) noexcept;
 
     void ReadArguments(lua_State* luaVM, unsigned int uiIndexBegin = 1);
     void PushArguments(lua_State* luaVM) const;
-    void PushArguments(CLuaArguments& Arguments);
+    void PushArguments(const CLuaArguments& Arguments);
     bool Call(lua_State* luaVM, const char* szFunction) const;
 
     CLuaArgument* PushNil();
     CLuaArgument* PushBoolean(bool bBool);
     CLuaArgument* PushNumber(double dNumber);
     CLuaArgument* PushString(const char* szString);
+    CLuaArgument* PushString(const char* szString, size_t sizeLength);
     CLuaArgument* PushUserData(void* pUserData);
 
     void DeleteArguments();
+    void Reserve(size_t sizeArguments) { m_Arguments.reserve(sizeArguments); };
 
-    unsigned int                          Count() const { return static_cast<unsigned int>(m_Arguments.size()); };
-    vector<CLuaArgument*>::const_iterator IterBegin() { return m_Arguments.begin(); };
-    vector<CLuaArgument*>::const_iterator IterEnd() { return m_Arguments.end(); };
+    unsigned int                         Count() const { return static_cast<unsigned int>(m_Arguments.size()); };
+    vector<CLuaArgument>::const_iterator IterBegin() const { return m_Arguments.begin(); };
+    vector<CLuaArgument>::const_iterator IterEnd() const { return m_Arguments.end(); };
 
 private:
-    vector<CLuaArgument*> m_Arguments;
+    // Stored by value, contiguous; the vector keeps its capacity across DeleteArguments
+    vector<CLuaArgument> m_Arguments;
 };
@@ -0,0 +1,141 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CLuaFunctionRef.h"
+#include "../include/ILuaModuleManager.h"
+#include <string>
+
+extern ILuaModuleManager10* pModuleManager;
+
+#define MAX_TRACEBACK_LEVELS 12
+
+// Registry field holding the main state of a resource
+#define MAIN_STATE_KEY "redis.mainState"
+
+CLuaFunctionRef::CLuaFunctionRef()
+{
+    m_luaVM = NULL;
+    m_iRef = LUA_NOREF;
+}
+
+CLuaFunctionRef::CLuaFunctionRef(lua_State* luaVM, int iIndex)
+{
+    m_luaVM = GetMainState(luaVM);
+    lua_pushvalue(luaVM, iIndex);
+    m_iRef = luaL_ref(luaVM, LUA_REGISTRYINDEX);
+}
+
+CLuaFunctionRef::CLuaFunctionRef(CLuaFunctionRef&& Other)
+{
+    m_luaVM = Other.m_luaVM;
+    m_iRef = Other.m_iRef;
+    Other.m_luaVM = NULL;
+    Other.m_iRef = LUA_NOREF;
+}
+
+CLuaFunctionRef::~CLuaFunctionRef()
+{
+    Release();
+}
+
+CLuaFunctionRef& CLuaFunctionRef::operator=(CLuaFunctionRef&& Other)
+{
+    if (this != &Other)
+    {
+        Release();
+        m_luaVM = Other.m_luaVM;
+        m_iRef = Other.m_iRef;
+        Other.m_luaVM = NULL;
+        Other.m_iRef = LUA_NOREF;
+    }
+    return *this;
+}
+
+bool CLuaFunctionRef::Push() const
+{
+    if (!IsValid())
+        return false;
+
+    lua_rawgeti(m_luaVM, LUA_REGISTRYINDEX, m_iRef);
+    return true;
+}
+
+void CLuaFunctionRef::Release()
+{
+    if (IsValid())
+        luaL_unref(m_luaVM, LUA_REGISTRYINDEX, m_iRef);
+
+    m_luaVM = NULL;
+    m_iRef = LUA_NOREF;
+}
+
+static int ErrorHandler(lua_State* luaVM)
+{
+    // Same layout as debug.traceback, without relying on the debug library
+    std::string strMessage = lua_isstring(luaVM, 1) ? lua_tostring(luaVM, 1) : "(error object is not a string)";
+    strMessage += "\nstack traceback:";
+
+    lua_Debug ar;
+    for (int iLevel = 1; iLevel <= MAX_TRACEBACK_LEVELS && lua_getstack(luaVM, iLevel, &ar); iLevel++)
+    {
+        lua_getinfo(luaVM, "Snl", &ar);
+        strMessage += "\n\t";
+        strMessage += ar.short_src;
+        if (ar.currentline > 0)
+            strMessage += ":" + std::to_string(ar.currentline);
+        if (ar.name)
+            strMessage += std::string(" in function '") + ar.name + "'";
+        else if (*ar.what == 'm')
+            strMessage += " in main chunk";
+    }
+
+    lua_pushstring(luaVM, strMessage.c_str());
+    return 1;
+}
+
+bool CLuaFunctionRef::Call(lua_State* luaVM, int iArguments, int iResults)
+{
+    int iBase = lua_gettop(luaVM) - iArguments;
+    lua_pushcfunction(luaVM, ErrorHandler);
+    lua_insert(luaVM, iBase);
+
+    int iResult = lua_pcall(luaVM, iArguments, iResults, iBase);
+    lua_remove(luaVM, iBase);
+
+    if (iResult != 0)
+    {
+        pModuleManager->ErrorPrintf("Redis Module: callback failed: %s\n", lua_tostring(luaVM, -1));
+        lua_pop(luaVM, 1);
+        return false;
+    }
+    return true;
+}
+
+void CLuaFunctionRef::SetMainState(lua_State* luaVM)
+{
+    lua_pushlightuserdata(luaVM, luaVM);
+    lua_setfield(luaVM, LUA_REGISTRYINDEX, MAIN_STATE_KEY);
+}
+
+lua_State* CLuaFunctionRef::GetMainState(lua_State* luaVM)
+{
+    lua_getfield(luaVM, LUA_REGISTRYINDEX, MAIN_STATE_KEY);
+    lua_State* pMain = static_cast<lua_State*>(lua_touserdata(luaVM, -1));
+    lua_pop(luaVM, 1);
+    return pMain ? pMain : luaVM;
+}
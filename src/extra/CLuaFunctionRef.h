@@ -0,0 +1,63 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#pragma once
+
+extern "C"
+{
+    #include <lua.h>
+    #include <lauxlib.h>
+}
+
+//
+// Lua function (closures included) pinned in the registry of its lua state.
+// Must only be released on the main thread while that state is alive. The
+// state kept is the main state of the resource, never a coroutine.
+//
+class CLuaFunctionRef
+{
+public:
+    CLuaFunctionRef();
+    CLuaFunctionRef(lua_State* luaVM, int iIndex);
+    CLuaFunctionRef(CLuaFunctionRef&& Other);
+    ~CLuaFunctionRef();
+
+    CLuaFunctionRef& operator=(CLuaFunctionRef&& Other);
+
+    CLuaFunctionRef(const CLuaFunctionRef&) = delete;
+    CLuaFunctionRef& operator=(const CLuaFunctionRef&) = delete;
+
+    bool       IsValid() const { return m_luaVM && m_iRef != LUA_NOREF && m_iRef != LUA_REFNIL; };
+    lua_State* GetLuaVM() const { return m_luaVM; };
+
+    bool Push() const;
+    void Release();
+
+    // Calls the function and its arguments on top of the stack, errors are
+    // reported with a traceback through the module manager
+    static bool Call(lua_State* luaVM, int iArguments, int iResults = 0);
+
+    // Coroutines share the registry of their resource, the main state is
+    // recorded there when the module functions get registered
+    static void       SetMainState(lua_State* luaVM);
+    static lua_State* GetMainState(lua_State* luaVM);
+
+private:
+    lua_State* m_luaVM;
+    int        m_iRef;
+};
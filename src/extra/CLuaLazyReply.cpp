@@ -0,0 +1,160 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CLuaLazyReply.h"
+#include "CLuaReply.h"
+
+extern "C"
+{
+    #include <lauxlib.h>
+}
+#include <cstring>
+#include <new>
+
+#define LAZY_REPLY_METATABLE "redis.reply"
+
+void CLuaLazyReply::Push(lua_State* luaVM, redisReply* pReply, unsigned int uiFlags)
+{
+    Push(luaVM, std::shared_ptr<redisReply>(pReply, freeReplyObject), pReply, uiFlags);
+}
+
+void CLuaLazyReply::Push(lua_State* luaVM, const std::shared_ptr<redisReply>& pRoot, const redisReply* pReply, unsigned int uiFlags)
+{
+    lua_checkstack(luaVM, 3);
+    new (lua_newuserdata(luaVM, sizeof(SWrapper))) SWrapper{pRoot, pReply, uiFlags};
+
+    // One metatable per lua state, registered with the first wrapper
+    if (luaL_newmetatable(luaVM, LAZY_REPLY_METATABLE))
+    {
+        lua_pushcfunction(luaVM, Index);
+        lua_setfield(luaVM, -2, "__index");
+        lua_pushcfunction(luaVM, Length);
+        lua_setfield(luaVM, -2, "__len");
+        lua_pushcfunction(luaVM, Collect);
+        lua_setfield(luaVM, -2, "__gc");
+        lua_pushcfunction(luaVM, ToString);
+        lua_setfield(luaVM, -2, "__tostring");
+    }
+    lua_setmetatable(luaVM, -2);
+}
+
+void CLuaLazyReply::PushElement(lua_State* luaVM, const SWrapper* pWrapper, size_t sizeIndex)
+{
+    const redisReply* pReply = pWrapper->pReply;
+    if (CLuaReply::IsPairs(pReply, pWrapper->uiFlags))
+    {
+        CLuaReply::PushPair(luaVM, pReply->element[sizeIndex * 2], pReply->element[sizeIndex * 2 + 1], pWrapper->uiFlags);
+        return;
+    }
+
+    // Pairs only apply to the top level
+    const redisReply* pElement = pReply->element[sizeIndex];
+    if (pElement->type == REDIS_REPLY_ARRAY)
+        Push(luaVM, pWrapper->pRoot, pElement, pWrapper->uiFlags & ~REPLY_PAIRS);
+    else
+        CLuaReply::Push(luaVM, pElement, pWrapper->uiFlags);
+}
+
+size_t CLuaLazyReply::GetLength(const SWrapper* pWrapper)
+{
+    size_t sizeElements = pWrapper->pReply->elements;
+    return CLuaReply::IsPairs(pWrapper->pReply, pWrapper->uiFlags) ? sizeElements / 2 : sizeElements;
+}
+
+CLuaLazyReply::SWrapper* CLuaLazyReply::Check(lua_State* luaVM, int iIndex)
+{
+    return static_cast<SWrapper*>(luaL_checkudata(luaVM, iIndex, LAZY_REPLY_METATABLE));
+}
+
+int CLuaLazyReply::Index(lua_State* luaVM)
+{
+    SWrapper* pWrapper = Check(luaVM, 1);
+    if (lua_type(luaVM, 2) == LUA_TNUMBER)
+    {
+        lua_Number dIndex = lua_tonumber(luaVM, 2);
+        size_t     sizeIndex = static_cast<size_t>(dIndex);
+        if (dIndex >= 1 && sizeIndex == dIndex && sizeIndex <= GetLength(pWrapper))
+        {
+            PushElement(luaVM, pWrapper, sizeIndex - 1);
+            return 1;
+        }
+    }
+    else if (lua_type(luaVM, 2) == LUA_TSTRING)
+    {
+        // Methods, ipairs() of lua 5.1 doesn't look at metatables
+        const char* szKey = lua_tostring(luaVM, 2);
+        if (strcmp(szKey, "ipairs") == 0)
+        {
+            lua_pushcfunction(luaVM, Iterate);
+            return 1;
+        }
+        if (strcmp(szKey, "totable") == 0)
+        {
+            lua_pushcfunction(luaVM, ToTable);
+            return 1;
+        }
+    }
+    lua_pushnil(luaVM);
+    return 1;
+}
+
+int CLuaLazyReply::Length(lua_State* luaVM)
+{
+    lua_pushnumber(luaVM, static_cast<lua_Number>(GetLength(Check(luaVM, 1))));
+    return 1;
+}
+
+int CLuaLazyReply::Collect(lua_State* luaVM)
+{
+    Check(luaVM, 1)->~SWrapper();
+    return 0;
+}
+
+int CLuaLazyReply::ToString(lua_State* luaVM)
+{
+    lua_pushfstring(luaVM, "redis reply: %d elements", static_cast<int>(GetLength(Check(luaVM, 1))));
+    return 1;
+}
+
+int CLuaLazyReply::Iterate(lua_State* luaVM)
+{
+    Check(luaVM, 1);
+    lua_pushcfunction(luaVM, Next);
+    lua_pushvalue(luaVM, 1);
+    lua_pushnumber(luaVM, 0);
+    return 3;
+}
+
+int CLuaLazyReply::Next(lua_State* luaVM)
+{
+    SWrapper* pWrapper = Check(luaVM, 1);
+    size_t    sizeIndex = static_cast<size_t>(luaL_checknumber(luaVM, 2));
+    if (sizeIndex >= GetLength(pWrapper))
+        return 0;
+
+    lua_pushnumber(luaVM, static_cast<lua_Number>(sizeIndex + 1));
+    PushElement(luaVM, pWrapper, sizeIndex);
+    return 2;
+}
+
+int CLuaLazyReply::ToTable(lua_State* luaVM)
+{
+    SWrapper* pWrapper = Check(luaVM, 1);
+    CLuaReply::Push(luaVM, pWrapper->pReply, pWrapper->uiFlags);
+    return 1;
+}
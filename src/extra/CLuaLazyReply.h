@@ -0,0 +1,64 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#pragma once
+
+extern "C"
+{
+    #include <lua.h>
+}
+#include <memory>
+#include "hiredis.h"
+
+//
+// Array reply kept in C++ and wrapped in a userdata for lua. Elements are
+// converted on access only, which saves building big tables that are read
+// once. Nested arrays share the reply of their parent.
+//
+//   reply[i], #reply, reply:ipairs(), reply:totable()
+//
+// With REPLY_PAIRS every element of the top level is one pair.
+//
+class CLuaLazyReply
+{
+public:
+    // Takes over the reply, it is freed when lua collects the last wrapper.
+    // Elements are converted with the eReplyFlags of the command.
+    static void Push(lua_State* luaVM, redisReply* pReply, unsigned int uiFlags);
+
+private:
+    struct SWrapper
+    {
+        std::shared_ptr<redisReply> pRoot;
+        const redisReply*           pReply;
+        unsigned int                uiFlags;
+    };
+
+    static void      Push(lua_State* luaVM, const std::shared_ptr<redisReply>& pRoot, const redisReply* pReply, unsigned int uiFlags);
+    static void      PushElement(lua_State* luaVM, const SWrapper* pWrapper, size_t sizeIndex);
+    static size_t    GetLength(const SWrapper* pWrapper);
+    static SWrapper* Check(lua_State* luaVM, int iIndex);
+
+    static int Index(lua_State* luaVM);
+    static int Length(lua_State* luaVM);
+    static int Collect(lua_State* luaVM);
+    static int ToString(lua_State* luaVM);
+    static int Iterate(lua_State* luaVM);
+    static int Next(lua_State* luaVM);
+    static int ToTable(lua_State* luaVM);
+};
@@ -0,0 +1,130 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#include "CLuaReply.h"
+#include "CLuaLazyReply.h"
+
+#include <charconv>
+#include <cmath>
+
+void CLuaReply::Push(lua_State* luaVM, const redisReply* pReply, unsigned int uiFlags)
+{
+    switch (pReply->type)
+    {
+        case REDIS_REPLY_STRING:
+            if ((uiFlags & REPLY_NUMBERS) && PushNumber(luaVM, pReply->str, pReply->len))
+                break;
+            lua_pushlstring(luaVM, pReply->str, pReply->len);
+            break;
+
+        case REDIS_REPLY_STATUS:
+        case REDIS_REPLY_ERROR:
+            lua_pushlstring(luaVM, pReply->str, pReply->len);
+            break;
+
+        case REDIS_REPLY_INTEGER:
+            lua_pushnumber(luaVM, static_cast<lua_Number>(pReply->integer));
+            break;
+
+        case REDIS_REPLY_ARRAY:
+        {
+            lua_checkstack(luaVM, 4);
+            if (IsPairs(pReply, uiFlags))
+            {
+                lua_createtable(luaVM, static_cast<int>(pReply->elements / 2), 0);
+                for (size_t i = 0; i < pReply->elements; i += 2)
+                {
+                    PushPair(luaVM, pReply->element[i], pReply->element[i + 1], uiFlags);
+                    lua_rawseti(luaVM, -2, static_cast<int>(i / 2 + 1));
+                }
+                break;
+            }
+
+            lua_createtable(luaVM, static_cast<int>(pReply->elements), 0);
+            for (size_t i = 0; i < pReply->elements; i++)
+            {
+                Push(luaVM, pReply->element[i], uiFlags & ~REPLY_PAIRS);
+                lua_rawseti(luaVM, -2, static_cast<int>(i + 1));
+            }
+            break;
+        }
+
+        case REDIS_REPLY_NIL:
+        default:
+            lua_pushnil(luaVM);
+            break;
+    }
+}
+
+void CLuaReply::PushPair(lua_State* luaVM, const redisReply* pFirst, const redisReply* pSecond, unsigned int uiFlags)
+{
+    // Members stay strings even when they look like numbers, scores don't
+    lua_createtable(luaVM, 2, 0);
+    Push(luaVM, pFirst, uiFlags & ~(REPLY_PAIRS | REPLY_NUMBERS));
+    lua_rawseti(luaVM, -2, 1);
+    Push(luaVM, pSecond, uiFlags & ~REPLY_PAIRS);
+    lua_rawseti(luaVM, -2, 2);
+}
+
+bool CLuaReply::PushNumber(lua_State* luaVM, const char* szValue, size_t sizeValue)
+{
+    // Whole string only. inf, -inf (sorted set scores) and nan stay strings,
+    // lua has no literal for them and they would compare oddly
+    double dValue;
+    auto   result = std::from_chars(szValue, szValue + sizeValue, dValue);
+    if (sizeValue == 0 || result.ec != std::errc() || result.ptr != szValue + sizeValue || !std::isfinite(dValue))
+        return false;
+
+    lua_pushnumber(luaVM, dValue);
+    return true;
+}
+
+int CLuaReply::PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError, unsigned int uiFlags)
+{
+    if (!pReply || pReply->type == REDIS_REPLY_ERROR)
+    {
+        lua_pushboolean(luaVM, 0);
+        if (pReply)
+            lua_pushlstring(luaVM, pReply->str, pReply->len);
+        else
+            lua_pushstring(luaVM, szError ? szError : "Unknown error");
+        return 2;
+    }
+
+    // Not a reply of a member/score command, better said than half paired
+    if ((uiFlags & REPLY_PAIRS) && pReply->type == REDIS_REPLY_ARRAY && !IsPairs(pReply, uiFlags))
+    {
+        lua_pushboolean(luaVM, 0);
+        lua_pushstring(luaVM, "Reply has an odd number of elements, can't make pairs");
+        return 2;
+    }
+
+    Push(luaVM, pReply, uiFlags);
+    return 1;
+}
+
+int CLuaReply::PushResult(lua_State* luaVM, redisReply*& pReply, const char* szError, unsigned int uiFlags)
+{
+    if ((uiFlags & REPLY_LAZY) && pReply && pReply->type == REDIS_REPLY_ARRAY && (!(uiFlags & REPLY_PAIRS) || IsPairs(pReply, uiFlags)))
+    {
+        CLuaLazyReply::Push(luaVM, pReply, uiFlags);
+        pReply = NULL;
+        return 1;
+    }
+    return PushResult(luaVM, static_cast<const redisReply*>(pReply), szError, uiFlags);
+}
@@ -0,0 +1,62 @@
+/*********************************************************
+ *
+ *  Multi Theft Auto: San Andreas - Deathmatch
+ *
+ *  ml_base, External lua add-on module
+ *
+ *  Copyright © 2003-2018 MTA.  All Rights Reserved.
+ *
+ *  Grand Theft Auto is © 2002-2018 Rockstar North
+ *
+ *  THE FOLLOWING SOURCES ARE PART OF THE MULTI THEFT
+ *  AUTO SOFTWARE DEVELOPMENT KIT AND ARE RELEASED AS
+ *  OPEN SOURCE FILES. THESE FILES MAY BE USED AS LONG
+ *  AS THE DEVELOPER AGREES TO THE LICENSE THAT IS
+ *  PROVIDED WITH THIS PACKAGE.
+ *
+ *********************************************************/
+
+#pragma once
+
+extern "C"
+{
+    #include <lua.h>
+}
+#include "hiredis.h"
+
+// How a command wants its reply handed to lua
+enum eReplyFlags
+{
+    REPLY_LAZY = 1 << 0,               // arrays stay in C++ behind a CLuaLazyReply
+    REPLY_NUMBERS = 1 << 1,            // numeric strings become lua numbers
+    REPLY_PAIRS = 1 << 2,              // flat top level arrays become {first, second} pairs, only second is numeric; odd lengths fail
+};
+
+//
+// Pushes redis replies straight onto a lua stack
+//
+class CLuaReply
+{
+public:
+    // Pushes the reply as a single value, arrays become (nested) tables
+    static void Push(lua_State* luaVM, const redisReply* pReply, unsigned int uiFlags = 0);
+
+    // One {first, second} table of a REPLY_PAIRS array
+    static void PushPair(lua_State* luaVM, const redisReply* pFirst, const redisReply* pSecond, unsigned int uiFlags);
+
+    // Whether the array is pushed as pairs
+    static bool IsPairs(const redisReply* pReply, unsigned int uiFlags)
+    {
+        return (uiFlags & REPLY_PAIRS) && pReply->elements % 2 == 0;
+    };
+
+    // Pushes the callback arguments (reply, error) of a finished command.
+    // Error replies and failed commands push false and the message.
+    static int PushResult(lua_State* luaVM, const redisReply* pReply, const char* szError, unsigned int uiFlags = 0);
+
+    // Same, a REPLY_LAZY array takes over the reply and pReply is NULL afterwards
+    static int PushResult(lua_State* luaVM, redisReply*& pReply, const char* szError, unsigned int uiFlags);
+
+private:
+    static bool PushNumber(lua_State* luaVM, const char* szValue, size_t sizeValue);
+};
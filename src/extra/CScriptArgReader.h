@@ -5,10 +5,12 @@ extern "C"
     #include <lua.h>
 }
 #include "../Casts.h"
+#include "CLuaFunctionRef.h"
 #include <limits>
 #include <type_traits>
 #include <cfloat>
 #include <cmath>
+#include <string_view>
 
 /////////////////////////////////////////////////////////////////////////
 //
@@ -213,6 +215,36 @@ public:
         m_iIndex++;
     }
 
+    //
+    // Read next string without copying it. The view points into the lua
+    // state and is only valid while the argument stays on the stack.
+    //
+    void ReadStringView(std::string_view& outValue, const char* defaultValue = NULL)
+    {
+        int iArgument = lua_type(m_luaVM, m_iIndex);
+
+        if (iArgument == LUA_TSTRING || iArgument == LUA_TNUMBER)
+        {
+            size_t      length = 0;
+            const char* szValue = lua_tolstring(m_luaVM, m_iIndex++, &length);
+            outValue = std::string_view(szValue, length);
+            return;
+        }
+        else if (iArgument == LUA_TNONE || iArgument == LUA_TNIL)
+        {
+            if (defaultValue)
+            {
+                m_iIndex++;
+                outValue = defaultValue;
+                return;
+            }
+        }
+
+        outValue = std::string_view();
+        SetTypeError("string");
+        m_iIndex++;
+    }
+
     //
     // Force-reads next argument as string
     //
@@ -455,7 +487,7 @@ protected:
         }
 
         outValue = NULL;
-        //SetTypeErrorSetTypeError(GetClassTypeName((T*)0));
+        SetTypeError(GetClassTypeName((T*)0));
         m_iIndex++;
     }
 
@@ -711,56 +743,21 @@ protected:
 
 public:
     //
-    // Read a function, but don't do it yet due to Lua stack issues
-    //
-    // void ReadFunction(CLuaFunctionRef& outValue, int defaultValue = -2)
-    // {
-    //     assert(!m_pPendingFunctionOutValue);
-
-    //     int iArgument = lua_type(m_luaVM, m_iIndex);
-    //     if (iArgument == LUA_TFUNCTION)
-    //     {
-    //         m_pPendingFunctionOutValue = &outValue;
-    //         m_pPendingFunctionIndex = m_iIndex++;
-    //         return;
-    //     }
-    //     else if (iArgument == LUA_TNONE || iArgument == LUA_TNIL)
-    //     {
-    //         // Only valid default value for function is nil
-    //         if (defaultValue == LUA_REFNIL)
-    //         {
-    //             outValue = CLuaFunctionRef();
-    //             m_iIndex++;
-    //             return;
-    //         }
-    //     }
-
-    //     SetTypeError("function", m_iIndex);
-    //     m_iIndex++;
-    // }
-
-    //
-    // Call after other arguments have been read
+    // Read a function (or closure) and pin it in the registry
     //
-    // void ReadFunctionComplete()
-    // {
-    //     if (!m_pPendingFunctionOutValue)
-    //         return;
-
-    //     // As we are going to change the stack, save any error info already gotten
-    //     ResolveErrorGotArgumentTypeAndValue();
-
-    //     assert(m_pPendingFunctionIndex != -1);
-    //     *m_pPendingFunctionOutValue = luaM_toref(m_luaVM, m_pPendingFunctionIndex);
-    //     if (VERIFY_FUNCTION(*m_pPendingFunctionOutValue))
-    //     {
-    //         m_pPendingFunctionIndex = -1;
-    //         return;
-    //     }
+    void ReadFunction(CLuaFunctionRef& outValue)
+    {
+        int iArgument = lua_type(m_luaVM, m_iIndex);
+        if (iArgument == LUA_TFUNCTION)
+        {
+            outValue = CLuaFunctionRef(m_luaVM, m_iIndex++);
+            return;
+        }
 
-    //     SetTypeError("function", m_pPendingFunctionIndex);
-    //     m_pPendingFunctionIndex = -1;
-    // }
+        outValue.Release();
+        SetTypeError("function", m_iIndex);
+        m_iIndex++;
+    }
 
     // Debug check
     bool IsReadFunctionPending() const { return /*m_pPendingFunctionOutValue &&*/ m_pPendingFunctionIndex != -1; }
@@ -17,6 +17,7 @@
  *********************************************************/
 
 #include "ml_redis.h"
+#include "CRedisManager.h"
 
 ILuaModuleManager10* pModuleManager = NULL;
 
@@ -30,6 +31,7 @@ MTAEXPORT bool InitModule(ILuaModuleManager10* pManager, char* szModuleName, cha
     strncpy(szAuthor, MODULE_AUTHOR, MAX_INFO_LENGTH);
     (*fVersion) = MODULE_VERSION;
 
+    pRedisManager = new CRedisManager();
     return true;
 }
 
@@ -37,13 +39,58 @@ MTAEXPORT void RegisterFunctions(lua_State* luaVM)
 {
     if (pModuleManager && luaVM)
     {
+      // Everything created from a coroutine belongs to this state
+      CLuaFunctionRef::SetMainState(luaVM);
+
       std::map<const char*, lua_CFunction> functions{
         {"createRedisClient", CFunctions::CreateRedisClient},
         {"redisClientPing", CFunctions::RedisClientPing},
         {"redisClientCommand", CFunctions::RedisClientCommand},
+        {"redisClientCommandAsync", CFunctions::RedisClientCommandAsync},
+        {"redisClientCancel", CFunctions::RedisClientCancel},
         {"redisClientSet", CFunctions::RedisClientSet},
         {"redisClientGet", CFunctions::RedisClientGet},
         {"redisClientDestroy", CFunctions::RedisClientDestroy},
+        {"redisClientAutoBatch", CFunctions::RedisClientAutoBatch},
+        {"redisClientLaneStats", CFunctions::RedisClientLaneStats},
+        {"redisClientSetLimits", CFunctions::RedisClientSetLimits},
+        {"redisSetLimits", CFunctions::RedisSetLimits},
+        {"redisSetDispatchBudget", CFunctions::RedisSetDispatchBudget},
+        {"redisGetDispatchStats", CFunctions::RedisGetDispatchStats},
+        {"redisTransaction", CFunctions::RedisTransaction},
+        {"redisTransactionRetry", CFunctions::RedisTransactionRetry},
+        {"redisStreamAdd", CFunctions::RedisStreamAdd},
+        {"redisStreamConsume", CFunctions::RedisStreamConsume},
+        {"redisStreamStop", CFunctions::RedisStreamStop},
+        {"redisBlockingPop", CFunctions::RedisBlockingPop},
+        {"redisQueueConsume", CFunctions::RedisQueueConsume},
+        {"redisQueueStop", CFunctions::RedisQueueStop},
+        {"redisSchedule", CFunctions::RedisSchedule},
+        {"redisScheduleConsume", CFunctions::RedisScheduleConsume},
+        {"redisScheduleStop", CFunctions::RedisScheduleStop},
+        {"redisLock", CFunctions::RedisLock},
+        {"redisUnlock", CFunctions::RedisUnlock},
+        {"redisLockHeld", CFunctions::RedisLockHeld},
+        {"redisRateLimit", CFunctions::RedisRateLimit},
+        {"redisDefineSchema", CFunctions::RedisDefineSchema},
+        {"redisLoad", CFunctions::RedisLoad},
+        {"redisSave", CFunctions::RedisSave},
+        {"redisPrepare", CFunctions::RedisPrepare},
+        {"redisExecute", CFunctions::RedisExecute},
+        {"redisExecuteAsync", CFunctions::RedisExecuteAsync},
+        {"redisLeaderboard", CFunctions::RedisLeaderboard},
+        {"redisLeaderboardAdd", CFunctions::RedisLeaderboardAdd},
+        {"redisLeaderboardTop", CFunctions::RedisLeaderboardTop},
+        {"redisLeaderboardRanks", CFunctions::RedisLeaderboardRanks},
+        {"redisLeaderboardDestroy", CFunctions::RedisLeaderboardDestroy},
+        {"redisGeo", CFunctions::RedisGeo},
+        {"redisGeoUpdate", CFunctions::RedisGeoUpdate},
+        {"redisGeoRemove", CFunctions::RedisGeoRemove},
+        {"redisGeoNear", CFunctions::RedisGeoNear},
+        {"redisGeoDestroy", CFunctions::RedisGeoDestroy},
+        {"redisNextId", CFunctions::RedisNextId},
+        {"redisKeepAlive", CFunctions::RedisKeepAlive},
+        {"redisKeepAliveStop", CFunctions::RedisKeepAliveStop},
 
       };
 
@@ -56,20 +103,28 @@ MTAEXPORT void RegisterFunctions(lua_State* luaVM)
 
 MTAEXPORT bool DoPulse(void)
 {
+    if (pRedisManager)
+        pRedisManager->DoPulse();
     return true;
 }
 
 MTAEXPORT bool ShutdownModule(void)
 {
+    delete pRedisManager;
+    pRedisManager = NULL;
     return true;
 }
 
 MTAEXPORT bool ResourceStopping(lua_State* luaVM)
 {
+    if (pRedisManager)
+        pRedisManager->ResourceStopping(luaVM);
     return true;
 }
 
 MTAEXPORT bool ResourceStopped(lua_State* luaVM)
 {
+    if (pRedisManager)
+        pRedisManager->ResourceStopped(luaVM);
     return true;
 }